@@ -0,0 +1,35 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_INCLUDE_VPLCPU_MFXCPUMEMORY_H_
+#define CPU_INCLUDE_VPLCPU_MFXCPUMEMORY_H_
+
+#include "vpl/mfxvideo.h"
+
+// Memory held by a session of the CPU implementation
+//
+//     mfxCpuMemoryStats *stats = NULL;
+//     MFXVideoCORE_GetHandle(session, MFX_HANDLE_CPU_MEMORY_STATS, (mfxHDL *)&stats);
+//
+// The statistics are gathered on every call into memory owned by the
+//   session, they stay valid until the next call or MFXClose().
+#define MFX_HANDLE_CPU_MEMORY_STATS ((mfxHandleType)MFX_MAKEFOURCC('C', 'M', 'E', 'M'))
+
+typedef struct {
+    // surfaces of the internal pools, including pool memory not handed
+    //   out yet
+    mfxU64 FrameBytes;
+    // pictures held by the decoder, encoder and VPP contexts, estimated
+    //   from the stream parameters
+    mfxU64 CodecBytes;
+    // encoded data queued in the session
+    mfxU64 BitstreamBytes;
+    // surfaces allocated in the internal pools
+    mfxU32 NumFrames;
+    mfxU32 reserved[9];
+} mfxCpuMemoryStats;
+
+#endif // CPU_INCLUDE_VPLCPU_MFXCPUMEMORY_H_
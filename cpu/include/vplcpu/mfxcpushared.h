@@ -0,0 +1,59 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_INCLUDE_VPLCPU_MFXCPUSHARED_H_
+#define CPU_INCLUDE_VPLCPU_MFXCPUSHARED_H_
+
+#include "vpl/mfxvideo.h"
+
+// Frames in shared memory (Linux only)
+//
+// With VPL_CPU_POOL_SHARED=1 the internal surfaces of a session live in
+//   memfd files. mfxFrameSurfaceInterface::GetNativeHandle of such a surface
+//   returns MFX_RESOURCE_CPU_SHARED and a mfxCpuSharedSurface describing
+//   it. The description belongs to the surface and stays valid while the
+//   application holds a reference, the file descriptor belongs to the
+//   runtime, send it with SCM_RIGHTS or dup() it to keep it.
+//
+// The receiving process wraps the frame as a surface for VPP or encode
+//   input, without copying it:
+//
+//     mfxCpuSharedInterface *shared = NULL;
+//     MFXVideoCORE_GetHandle(session, MFX_HANDLE_CPU_SHARED_INTERFACE, (mfxHDL *)&shared);
+//     shared->ImportSurface(shared, &desc, &surface);
+//
+// The imported surface keeps its own mapping of the file, the fd in desc
+//   may be closed once ImportSurface returns.
+#define MFX_RESOURCE_CPU_SHARED         ((mfxResourceType)MFX_MAKEFOURCC('C', 'S', 'H', 'M'))
+#define MFX_HANDLE_CPU_SHARED_INTERFACE ((mfxHandleType)MFX_MAKEFOURCC('C', 'S', 'H', 'I'))
+
+typedef struct {
+    // memfd holding the frame
+    int Fd;
+    mfxU32 FourCC;
+    mfxU16 Width;
+    mfxU16 Height;
+    // bytes of the file the frame spans, starting at Offset
+    mfxU64 Offset;
+    mfxU64 Size;
+    // plane layout, offsets are relative to Offset
+    mfxU32 NumPlanes;
+    mfxU32 Pitch[4];
+    mfxU64 PlaneOffset[4];
+    mfxU32 reserved[8];
+} mfxCpuSharedSurface;
+
+typedef struct mfxCpuSharedInterface {
+    mfxHDL Context;
+    // new surface referencing the frame desc describes, released by the
+    //   application like any other surface
+    mfxStatus (*ImportSurface)(struct mfxCpuSharedInterface *shared,
+                               const mfxCpuSharedSurface *desc,
+                               mfxFrameSurface1 **surface);
+    mfxHDL reserved[6];
+} mfxCpuSharedInterface;
+
+#endif // CPU_INCLUDE_VPLCPU_MFXCPUSHARED_H_
@@ -5,6 +5,7 @@
   ############################################################################*/
 
 #include "src/cpu_common.h"
+#include "src/cpu_copy.h"
 #include "src/frame_lock.h"
 
 AVPixelFormat MFXFourCC2AVPixelFormat(uint32_t fourcc) {
@@ -89,8 +90,6 @@ mfxStatus AVFrame2mfxFrameSurface(mfxFrameSurface1 *surface,
     mfxFrameData *data = locker.GetData();
     mfxFrameInfo *info = &surface->Info;
 
-    mfxU32 w, h, y, pitch, offset;
-
     RET_IF_FALSE(info->Width == frame->width && info->Height == frame->height,
                  MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
 
@@ -147,83 +146,39 @@ mfxStatus AVFrame2mfxFrameSurface(mfxFrameSurface1 *surface,
     }
     if (frame->format == AV_PIX_FMT_YUV420P10LE) {
         RET_IF_FALSE(info->FourCC == MFX_FOURCC_I010, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
-
-        w = info->Width * 2;
-        h = info->Height;
     }
     else if (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P) {
         RET_IF_FALSE(info->FourCC == MFX_FOURCC_I420, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
-
-        w = info->Width;
-        h = info->Height;
     }
     else if (frame->format == AV_PIX_FMT_YUV422P10LE) {
         RET_IF_FALSE(info->FourCC == MFX_FOURCC_I210, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
-
-        w = info->Width * 2;
-        h = info->Height;
     }
     else if (frame->format == AV_PIX_FMT_YUV422P) {
         RET_IF_FALSE(info->FourCC == MFX_FOURCC_I422, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
-
-        w = info->Width;
-        h = info->Height;
     }
     else if (frame->format == AV_PIX_FMT_BGRA) {
         RET_IF_FALSE(info->FourCC == MFX_FOURCC_RGB4, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
-
-        w = info->Width * 4;
-        h = info->Height;
     }
     else {
         RET_ERROR(MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
     }
 
-    pitch = data->Pitch;
-
-    if (frame->format == AV_PIX_FMT_BGRA) {
-        for (y = 0; y < h; y++) {
-            offset = pitch * (y + info->CropY) + info->CropX;
-            memcpy_s(data->B + offset, w, frame->data[0] + y * frame->linesize[0], w);
-        }
-    }
-    else if ((frame->format == AV_PIX_FMT_YUV422P) || (frame->format == AV_PIX_FMT_YUV422P10LE)) {
-        // copy Y plane
-        for (y = 0; y < h; y++) {
-            offset = pitch * (y + info->CropY) + info->CropX;
-            memcpy_s(data->Y + offset, w, frame->data[0] + y * frame->linesize[0], w);
-        }
-
-        // copy U plane
-        for (y = 0; y < h; y++) {
-            offset = pitch / 2 * (y + info->CropY) + info->CropX;
-            memcpy_s(data->U + offset, w / 2, frame->data[1] + y * frame->linesize[1], w / 2);
-        }
-
-        // copy V plane
-        for (y = 0; y < h; y++) {
-            offset = pitch / 2 * (y + info->CropY) + info->CropX;
-            memcpy_s(data->V + offset, w / 2, frame->data[2] + y * frame->linesize[2], w / 2);
-        }
-    }
-    else {
-        // copy Y plane
-        for (y = 0; y < h; y++) {
-            offset = pitch * (y + info->CropY) + info->CropX;
-            memcpy_s(data->Y + offset, w, frame->data[0] + y * frame->linesize[0], w);
-        }
-
-        // copy U plane
-        for (y = 0; y < h / 2; y++) {
-            offset = pitch / 2 * (y + info->CropY) + info->CropX;
-            memcpy_s(data->U + offset, w / 2, frame->data[1] + y * frame->linesize[1], w / 2);
-        }
-
-        // copy V plane
-        for (y = 0; y < h / 2; y++) {
-            offset = pitch / 2 * (y + info->CropY) + info->CropX;
-            memcpy_s(data->V + offset, w / 2, frame->data[2] + y * frame->linesize[2], w / 2);
-        }
+    switch (info->FourCC) {
+        case MFX_FOURCC_I010:
+            CpuCopyFrame<MFX_FOURCC_I010>(data, frame);
+            break;
+        case MFX_FOURCC_I210:
+            CpuCopyFrame<MFX_FOURCC_I210>(data, frame);
+            break;
+        case MFX_FOURCC_I422:
+            CpuCopyFrame<MFX_FOURCC_I422>(data, frame);
+            break;
+        case MFX_FOURCC_RGB4:
+            CpuCopyFrame<MFX_FOURCC_RGB4>(data, frame);
+            break;
+        default:
+            CpuCopyFrame<MFX_FOURCC_I420>(data, frame);
+            break;
     }
 
     if (frame->pts) {
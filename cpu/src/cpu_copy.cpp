@@ -0,0 +1,410 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_copy.h"
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "src/cpu_threads.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define COPY_X86
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define COPY_TARGET(_ISA)
+    #else
+        #define COPY_TARGET(_ISA) __attribute__((target(_ISA)))
+    #endif
+#endif
+
+#if defined(__linux__)
+    #include <unistd.h>
+#endif
+
+// last level cache size when the system does not report it
+#define COPY_DEFAULT_LLC_SIZE (8 * 1024 * 1024)
+// frames at least this large (a 4K 4:2:0 picture) are split into stripes
+#define COPY_SPLIT_MIN_SIZE (3840 * 2160 * 3 / 2)
+#define COPY_MAX_STRIPES    4
+
+typedef void (*CopyRowFunc)(uint8_t *dst, const uint8_t *src, size_t size);
+
+static void CopyRowCached(uint8_t *dst, const uint8_t *src, size_t size) {
+    memcpy(dst, src, size);
+}
+
+#ifdef COPY_X86
+// Non-temporal copies: the unaligned head goes through memcpy so the
+//   streaming stores hit aligned addresses, the caller fences at the end.
+COPY_TARGET("sse2")
+static void CopyRowStreamSSE2(uint8_t *dst, const uint8_t *src, size_t size) {
+    size_t head = std::min(size, static_cast<size_t>(-reinterpret_cast<uintptr_t>(dst) & 15));
+    memcpy(dst, src, head);
+
+    size_t i = head;
+    for (; i + 64 <= size; i += 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + i), a);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + i + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + i + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + i + 48), d);
+    }
+    memcpy(dst + i, src + i, size - i);
+}
+
+COPY_TARGET("avx2")
+static void CopyRowStreamAVX2(uint8_t *dst, const uint8_t *src, size_t size) {
+    size_t head = std::min(size, static_cast<size_t>(-reinterpret_cast<uintptr_t>(dst) & 31));
+    memcpy(dst, src, head);
+
+    size_t i = head;
+    for (; i + 128 <= size; i += 128) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 32));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 64));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 96));
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i), a);
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i + 32), b);
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i + 64), c);
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i + 96), d);
+    }
+    memcpy(dst + i, src + i, size - i);
+}
+
+COPY_TARGET("avx512f")
+static void CopyRowStreamAVX512(uint8_t *dst, const uint8_t *src, size_t size) {
+    size_t head = std::min(size, static_cast<size_t>(-reinterpret_cast<uintptr_t>(dst) & 63));
+    memcpy(dst, src, head);
+
+    size_t i = head;
+    for (; i + 128 <= size; i += 128) {
+        __m512i a = _mm512_loadu_si512(src + i);
+        __m512i b = _mm512_loadu_si512(src + i + 64);
+        _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + i), a);
+        _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + i + 64), b);
+    }
+    memcpy(dst + i, src + i, size - i);
+}
+
+// one output row of CpuHalveChroma, returns the columns done
+COPY_TARGET("sse2")
+static size_t HalveChromaRowSSE2(uint8_t *dst,
+                                 const uint8_t *src0,
+                                 const uint8_t *src1,
+                                 size_t width,
+                                 bool bHorizontal) {
+    size_t x = 0;
+    if (!bHorizontal) {
+        for (; x + 16 <= width; x += 16) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src0 + x));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src1 + x));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_avg_epu8(a, b));
+        }
+        return x;
+    }
+
+    // vertical pairs first, then the even and odd columns as 16-bit lanes
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    for (; 2 * x + 32 <= width; x += 16) {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src0 + 2 * x));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src0 + 2 * x + 16));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src1 + 2 * x));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src1 + 2 * x + 16));
+        __m128i v0 = _mm_avg_epu8(a0, b0);
+        __m128i v1 = _mm_avg_epu8(a1, b1);
+        __m128i h0 = _mm_avg_epu16(_mm_and_si128(v0, lowBytes), _mm_srli_epi16(v0, 8));
+        __m128i h1 = _mm_avg_epu16(_mm_and_si128(v1, lowBytes), _mm_srli_epi16(v1, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_packus_epi16(h0, h1));
+    }
+    return x;
+}
+
+static bool HasAVX2() {
+    #if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return false;
+    __cpuid(regs, 1);
+    // OSXSAVE and AVX, then the OS saving the YMM state
+    if ((regs[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+    #else
+    return __builtin_cpu_supports("avx2");
+    #endif
+}
+
+static bool HasAVX512() {
+    #if defined(_MSC_VER)
+    if (!HasAVX2() || (_xgetbv(0) & 0xE6) != 0xE6)
+        return false;
+    int regs[4];
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 16)) != 0;
+    #else
+    return __builtin_cpu_supports("avx512f");
+    #endif
+}
+#endif
+
+// widest streaming copy the CPU runs, decided once
+static CopyRowFunc GetStreamCopy() {
+#ifdef COPY_X86
+    if (HasAVX512())
+        return CopyRowStreamAVX512;
+    if (HasAVX2())
+        return CopyRowStreamAVX2;
+    return CopyRowStreamSSE2;
+#else
+    return nullptr;
+#endif
+}
+
+void CpuHalveChroma(uint8_t *plane,
+                    size_t pitch,
+                    size_t dstPitch,
+                    size_t width,
+                    size_t height,
+                    bool bHorizontal) {
+    size_t outWidth  = bHorizontal ? (width + 1) / 2 : width;
+    size_t outHeight = (height + 1) / 2;
+
+    // row y is written after rows 2y and 2y + 1 are read, and column x
+    //   after columns 2x and 2x + 1, so the plane can be reused
+    for (size_t y = 0; y < outHeight; y++) {
+        const uint8_t *src0 = plane + 2 * y * pitch;
+        const uint8_t *src1 = (2 * y + 1 < height) ? src0 + pitch : src0;
+        uint8_t *dst        = plane + y * dstPitch;
+
+        size_t x = 0;
+#ifdef COPY_X86
+        x = HalveChromaRowSSE2(dst, src0, src1, width, bHorizontal);
+#endif
+        for (; x < outWidth; x++) {
+            if (!bHorizontal) {
+                dst[x] = (uint8_t)((src0[x] + src1[x] + 1) >> 1);
+                continue;
+            }
+            size_t x1 = (2 * x + 1 < width) ? 2 * x + 1 : 2 * x;
+            int even  = (src0[2 * x] + src1[2 * x] + 1) >> 1;
+            int odd   = (src0[x1] + src1[x1] + 1) >> 1;
+            dst[x]    = (uint8_t)((even + odd + 1) >> 1);
+        }
+    }
+}
+
+static size_t ReadLLCSize() {
+#if defined(__linux__) && defined(_SC_LEVEL3_CACHE_SIZE)
+    long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (size > 0)
+        return static_cast<size_t>(size);
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (size > 0)
+        return static_cast<size_t>(size);
+#endif
+    return COPY_DEFAULT_LLC_SIZE;
+}
+
+static void CopyStripe(const CpuPlaneCopy *planes,
+                       int numPlanes,
+                       int stripe,
+                       int numStripes,
+                       CopyRowFunc copyRow) {
+    for (int i = 0; i < numPlanes; i++) {
+        const CpuPlaneCopy &plane = planes[i];
+
+        size_t first = plane.rows * stripe / numStripes;
+        size_t last  = plane.rows * (stripe + 1) / numStripes;
+
+        // one call when both planes are contiguous
+        if (plane.dstPitch == plane.rowBytes && plane.srcPitch == plane.rowBytes) {
+            copyRow(plane.dst + first * plane.dstPitch,
+                    plane.src + first * plane.srcPitch,
+                    (last - first) * plane.rowBytes);
+            continue;
+        }
+
+        for (size_t y = first; y < last; y++)
+            copyRow(plane.dst + y * plane.dstPitch, plane.src + y * plane.srcPitch, plane.rowBytes);
+    }
+
+#ifdef COPY_X86
+    // order the streaming stores before the frame is handed on
+    if (copyRow != CopyRowCached)
+        _mm_sfence();
+#endif
+}
+
+// stripes of one frame copy, the calling thread takes stripe 0
+struct CopyBatch {
+    const CpuPlaneCopy *planes;
+    int numPlanes;
+    int numStripes;
+    CopyRowFunc copyRow;
+    int nextStripe; // first stripe nobody took yet
+    int numDone;
+};
+
+// Helper threads for striped copies, started with the first split copy and
+//   stopped when the library is unloaded. Each batch takes as many of them
+//   as the thread budget has to spare, the caller copies the stripes no
+//   helper took in time itself.
+class CopyHelpers {
+public:
+    static CopyHelpers &Get() {
+        static CopyHelpers helpers;
+        return helpers;
+    }
+
+    ~CopyHelpers() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bStop = true;
+        }
+        m_cvWork.notify_all();
+        for (auto &thread : m_threads)
+            thread.join();
+    }
+
+    // copy the stripes of batch on up to numHelpers helpers and the
+    //   calling thread, returns when all are done
+    void Run(CopyBatch *batch, int numHelpers) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Start(numHelpers);
+
+        batch->nextStripe = 1;
+        batch->numDone    = 0;
+        if (!m_threads.empty()) {
+            m_batches.push_back(batch);
+            m_cvWork.notify_all();
+        }
+        lock.unlock();
+
+        CopyStripe(batch->planes, batch->numPlanes, 0, batch->numStripes, batch->copyRow);
+
+        lock.lock();
+        batch->numDone++;
+        int stripe;
+        while ((stripe = TakeStripe(batch)) >= 0) {
+            lock.unlock();
+            CopyStripe(batch->planes, batch->numPlanes, stripe, batch->numStripes, batch->copyRow);
+            lock.lock();
+            batch->numDone++;
+        }
+        m_cvDone.wait(lock, [&] {
+            return batch->numDone == batch->numStripes;
+        });
+    }
+
+private:
+    CopyHelpers() : m_mutex(), m_cvWork(), m_cvDone(), m_batches(), m_threads(), m_bStop(false) {}
+
+    // caller holds m_mutex
+    void Start(int numHelpers) {
+        while ((int)m_threads.size() < numHelpers) {
+            try {
+                m_threads.emplace_back(&CopyHelpers::HelperThread, this);
+            }
+            catch (...) {
+                // no thread, the callers copy their stripes themselves
+                break;
+            }
+        }
+    }
+
+    // next stripe of batch, -1 when all are taken, caller holds m_mutex
+    int TakeStripe(CopyBatch *batch) {
+        if (batch->nextStripe >= batch->numStripes)
+            return -1;
+
+        int stripe = batch->nextStripe++;
+        if (batch->nextStripe == batch->numStripes) {
+            auto it = std::find(m_batches.begin(), m_batches.end(), batch);
+            if (it != m_batches.end())
+                m_batches.erase(it);
+        }
+        return stripe;
+    }
+
+    void HelperThread() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_cvWork.wait(lock, [&] {
+                return m_bStop || !m_batches.empty();
+            });
+            if (m_bStop)
+                return;
+
+            CopyBatch *batch = m_batches.front();
+            int stripe       = TakeStripe(batch);
+            lock.unlock();
+            CopyStripe(batch->planes, batch->numPlanes, stripe, batch->numStripes, batch->copyRow);
+            lock.lock();
+
+            if (++batch->numDone == batch->numStripes)
+                m_cvDone.notify_all();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cvWork;
+    std::condition_variable m_cvDone;
+    std::deque<CopyBatch *> m_batches; // batches with stripes left
+    std::vector<std::thread> m_threads;
+    bool m_bStop;
+
+    /* copy not allowed */
+    CopyHelpers(const CopyHelpers &);
+    CopyHelpers &operator=(const CopyHelpers &);
+};
+
+void CpuCopyPlanes(const CpuPlaneCopy *planes, int numPlanes) {
+    static const size_t llcSize = ReadLLCSize();
+
+    size_t frameSize = 0;
+    for (int i = 0; i < numPlanes; i++)
+        frameSize += planes[i].rowBytes * planes[i].rows;
+
+    // a frame that does not fit the cache would only evict other data
+    CpuCopyMode mode = (frameSize > llcSize) ? CPU_COPY_STREAMING : CPU_COPY_CACHED;
+    int numStripes   = (frameSize >= COPY_SPLIT_MIN_SIZE) ? COPY_MAX_STRIPES : 1;
+
+    CpuCopyPlanes(planes, numPlanes, mode, numStripes);
+}
+
+void CpuCopyPlanes(const CpuPlaneCopy *planes, int numPlanes, CpuCopyMode mode, int numStripes) {
+    static const CopyRowFunc streamCopy = GetStreamCopy();
+
+    CopyRowFunc copyRow = (mode == CPU_COPY_STREAMING && streamCopy) ? streamCopy : CopyRowCached;
+
+    // helpers are sized from the budget and charged to it while they copy
+    int maxHelpers = std::min(COPY_MAX_STRIPES, CpuThreadBudget::GetMaxThreads()) - 1;
+    int numHelpers = 0;
+    if (numStripes > 1 && maxHelpers > 0)
+        numHelpers = CpuThreadBudget::AcquireSpare(std::min(numStripes - 1, maxHelpers));
+
+    if (!numHelpers) {
+        // budget used up, the calling thread copies the frame
+        CopyStripe(planes, numPlanes, 0, 1, copyRow);
+        return;
+    }
+
+    // one stripe per helper granted, so no more helpers work on it
+    CopyBatch batch = { planes, numPlanes, numHelpers + 1, copyRow, 0, 0 };
+    CopyHelpers::Get().Run(&batch, numHelpers);
+
+    CpuThreadBudget::ReleaseSpare(numHelpers);
+}
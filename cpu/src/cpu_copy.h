@@ -0,0 +1,107 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_COPY_H_
+#define CPU_SRC_CPU_COPY_H_
+
+#include "src/cpu_common.h"
+
+// one plane of a frame copy, sizes in bytes
+struct CpuPlaneCopy {
+    uint8_t *dst;
+    size_t dstPitch;
+    const uint8_t *src;
+    size_t srcPitch;
+    size_t rowBytes;
+    size_t rows;
+};
+
+// how a frame is written
+enum CpuCopyMode {
+    CPU_COPY_CACHED, // memcpy, the frame stays in cache for the next stage
+    CPU_COPY_STREAMING // non-temporal stores, memcpy where the CPU has none
+};
+
+// Plane copy engine for frames in system memory
+// Rows are copied with the widest vector stores the CPU supports, picked at
+//   run time. Frames larger than the last level cache are written with
+//   non-temporal stores so they do not evict the working set of the codec,
+//   4K and larger frames are split into stripes. Stripes run on a few
+//   helper threads kept for the life of the process, as far as the thread
+//   budget has threads to spare, the rest on the calling thread.
+void CpuCopyPlanes(const CpuPlaneCopy *planes, int numPlanes);
+
+// same with the mode and number of stripes given instead of picked from the
+//   frame size, stripes the budget has no helpers for are merged
+void CpuCopyPlanes(const CpuPlaneCopy *planes, int numPlanes, CpuCopyMode mode, int numStripes);
+
+// Halve an 8-bit chroma plane of width x height in place, vertically (4:2:2
+//   to 4:2:0) and also horizontally if bHorizontal (4:4:4 to 4:2:0). Pairs
+//   are averaged with rounding, output rows are dstPitch apart, which must
+//   not be larger than pitch.
+void CpuHalveChroma(uint8_t *plane,
+                    size_t pitch,
+                    size_t dstPitch,
+                    size_t width,
+                    size_t height,
+                    bool bHorizontal);
+
+// plane layout of a FourCC, chroma planes are subsampled by 1 << shift
+template <mfxU32 FourCC>
+struct CpuPlaneLayout;
+template <>
+struct CpuPlaneLayout<MFX_FOURCC_I420> {
+    enum { numPlanes = 3, bytesPerPixel = 1, chromaShiftX = 1, chromaShiftY = 1 };
+};
+template <>
+struct CpuPlaneLayout<MFX_FOURCC_I010> {
+    enum { numPlanes = 3, bytesPerPixel = 2, chromaShiftX = 1, chromaShiftY = 1 };
+};
+template <>
+struct CpuPlaneLayout<MFX_FOURCC_I422> {
+    enum { numPlanes = 3, bytesPerPixel = 1, chromaShiftX = 1, chromaShiftY = 0 };
+};
+template <>
+struct CpuPlaneLayout<MFX_FOURCC_I210> {
+    enum { numPlanes = 3, bytesPerPixel = 2, chromaShiftX = 1, chromaShiftY = 0 };
+};
+template <>
+struct CpuPlaneLayout<MFX_FOURCC_RGB4> {
+    enum { numPlanes = 1, bytesPerPixel = 4, chromaShiftX = 0, chromaShiftY = 0 };
+};
+
+// copy the planes of 'frame' into 'data', chroma pitches of the surface
+//   are its luma pitch subsampled like the chroma width
+// Chroma of odd sizes is rounded up like libav does, rows are cut at the
+//   surface pitch.
+template <mfxU32 FourCC>
+void CpuCopyFrame(mfxFrameData *data, const AVFrame *frame) {
+    typedef CpuPlaneLayout<FourCC> Layout;
+
+    size_t pitch       = ((size_t)data->PitchHigh << 16) | data->PitchLow;
+    size_t width       = (size_t)frame->width;
+    size_t height      = (size_t)frame->height;
+    uint8_t *dst[3]    = { data->Y, data->U, data->V };
+    CpuPlaneCopy plane = {};
+
+    CpuPlaneCopy planes[3];
+    for (int i = 0; i < Layout::numPlanes; i++) {
+        int shiftX     = i ? Layout::chromaShiftX : 0;
+        int shiftY     = i ? Layout::chromaShiftY : 0;
+        size_t rowSize = ((width + (1 << shiftX) - 1) >> shiftX) * Layout::bytesPerPixel;
+        plane.dst      = (Layout::numPlanes == 1) ? data->B : dst[i];
+        plane.dstPitch = pitch >> shiftX;
+        plane.src      = frame->data[i];
+        plane.srcPitch = frame->linesize[i];
+        plane.rowBytes = (rowSize < plane.dstPitch) ? rowSize : plane.dstPitch;
+        plane.rows     = (height + (1 << shiftY) - 1) >> shiftY;
+        planes[i]      = plane;
+    }
+
+    CpuCopyPlanes(planes, Layout::numPlanes);
+}
+
+#endif // CPU_SRC_CPU_COPY_H_
@@ -0,0 +1,36 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_deadline.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DEADLINE_ENV "VPL_CPU_DEADLINE"
+
+static CpuDeadlinePolicy ReadDeadlinePolicy() {
+    const char *env = getenv(DEADLINE_ENV);
+    if (env && !strcmp(env, "skip"))
+        return CPU_DEADLINE_SKIP;
+    if (env && !strcmp(env, "drop"))
+        return CPU_DEADLINE_DROP;
+
+    return CPU_DEADLINE_OFF;
+}
+
+void CpuDeadline::Init(const mfxFrameInfo &info, mfxU16 asyncDepth) {
+    static const CpuDeadlinePolicy policy = ReadDeadlinePolicy();
+
+    m_bLate = false;
+    if (!info.FrameRateExtN || !info.FrameRateExtD) {
+        m_policy = CPU_DEADLINE_OFF;
+        return;
+    }
+
+    // frame interval in microseconds, times the frames allowed in flight
+    mfxU64 interval = 1000000ull * info.FrameRateExtD / info.FrameRateExtN;
+    m_budget        = std::chrono::microseconds(interval * (asyncDepth ? asyncDepth : 1));
+    m_policy        = policy;
+}
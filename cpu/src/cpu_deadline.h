@@ -0,0 +1,68 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_DEADLINE_H_
+#define CPU_SRC_CPU_DEADLINE_H_
+
+#include <atomic>
+#include <chrono>
+#include "src/cpu_common.h"
+
+enum CpuDeadlinePolicy {
+    CPU_DEADLINE_OFF = 0,
+    CPU_DEADLINE_SKIP, // decoder skips non-reference frames while late
+    CPU_DEADLINE_DROP // VPP and encode also drop frames while late
+};
+
+// Real-time deadlines of a component's frames
+// Set VPL_CPU_DEADLINE to "skip" or "drop" to enable them. A frame is due
+//   AsyncDepth (at least 1) frame intervals after it arrives. Once a frame
+//   finishes past its deadline the component is late, until a frame meets
+//   its deadline again. Streams without a frame rate have no deadlines.
+class CpuDeadline {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    CpuDeadline() : m_policy(CPU_DEADLINE_OFF), m_budget(), m_bLate(false) {}
+
+    void Init(const mfxFrameInfo &info, mfxU16 asyncDepth);
+
+    CpuDeadlinePolicy GetPolicy() const {
+        return m_policy;
+    }
+
+    // deadline of a frame arriving now
+    Clock::time_point Arrive() const {
+        return Clock::now() + m_budget;
+    }
+
+    // called from the task once the frame is done
+    void Complete(Clock::time_point deadline) {
+        if (m_policy != CPU_DEADLINE_OFF)
+            m_bLate = (Clock::now() > deadline);
+    }
+
+    bool IsLate() const {
+        return m_bLate;
+    }
+
+    // VPP and encode drop a new frame only while older frames are still
+    //   in flight, so a component which dropped everything catches up
+    bool ShouldDrop(size_t framesInFlight) const {
+        return m_policy == CPU_DEADLINE_DROP && m_bLate && framesInFlight;
+    }
+
+private:
+    CpuDeadlinePolicy m_policy;
+    Clock::duration m_budget;
+    std::atomic<bool> m_bLate;
+
+    /* copy not allowed */
+    CpuDeadline(const CpuDeadline &);
+    CpuDeadline &operator=(const CpuDeadline &);
+};
+
+#endif // CPU_SRC_CPU_DEADLINE_H_
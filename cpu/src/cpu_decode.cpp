@@ -5,23 +5,87 @@
   ############################################################################*/
 
 #include "src/cpu_decode.h"
+#include <string.h>
 #include <memory>
+#include <new>
 #include <utility>
+#include <vector>
+#include "src/cpu_copy.h"
+#include "src/cpu_threads.h"
 #include "src/cpu_workstream.h"
 
+#define DECODE_KEY_SKIP_LEVEL 4
+#define DECODE_MAX_SKIP_LEVEL DECODE_KEY_SKIP_LEVEL
+
+// extension buffers the decoder takes
+static bool IsSupportedExtBuffer(const mfxExtBuffer *ext) {
+    switch (ext->BufferId) {
+        case MFX_EXTBUFF_DEC_VIDEO_PROCESSING:
+            return ext->BufferSz == sizeof(mfxExtDecVideoProcessing);
+        case MFX_EXTBUFF_VIDEO_SIGNAL_INFO:
+            return ext->BufferSz == sizeof(mfxExtVideoSignalInfo);
+        default:
+            return false;
+    }
+}
+
+static bool HasSupportedExtBuffers(const mfxVideoParam *par) {
+    if (!par->NumExtParam)
+        return true;
+    if (!par->ExtParam)
+        return false;
+
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        if (!par->ExtParam[i] || !IsSupportedExtBuffer(par->ExtParam[i]))
+            return false;
+    }
+    return true;
+}
+
+static mfxExtBuffer *FindExtBuffer(const mfxVideoParam *par, mfxU32 bufferId) {
+    if (!par->ExtParam)
+        return nullptr;
+
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        if (par->ExtParam[i] && par->ExtParam[i]->BufferId == bufferId)
+            return par->ExtParam[i];
+    }
+    return nullptr;
+}
+
 CpuDecode::CpuDecode(CpuWorkstream *session)
         : m_avDecCodec(nullptr),
           m_avDecContext(nullptr),
           m_avDecParser(nullptr),
+          m_avParserContext(nullptr),
+          m_avKeyParser(nullptr),
+          m_avKeyParserContext(nullptr),
           m_avDecPacket(nullptr),
-          m_avDecFrameOut(nullptr),
+          m_codecThreads(0),
           m_swsContext(nullptr),
+          m_outScale(),
+          m_bScale(false),
+          m_scaleContext(nullptr),
           m_param(),
           m_decSurfaces(),
-          m_bFrameBuffered(false),
-          m_bStreamInfo(false),
+          m_decFrames(),
+          m_decFramesMutex(),
+          m_decTasks(),
+          m_lastTask(nullptr),
+          m_offered(),
+          m_lent(),
+          m_returned(),
+          m_lendMutex(),
           m_session(session),
-          m_frameOrder(0) {}
+          m_frameOrder(0),
+          m_numError(0),
+          m_spsDpbFrames(0),
+          m_deadline(),
+          m_numSkipPackets(0),
+          m_numSkipFrames(0),
+          m_skipLevel(0),
+          m_bWaitKey(false),
+          m_queuedBytes(0) {}
 
 mfxStatus CpuDecode::ValidateDecodeParams(mfxVideoParam *par, bool canCorrect) {
     bool fixedIncompatible = false;
@@ -55,9 +119,6 @@ mfxStatus CpuDecode::ValidateDecodeParams(mfxVideoParam *par, bool canCorrect) {
 
         if (!par->mfx.FrameInfo.FourCC)
             par->mfx.FrameInfo.FourCC = MFX_FOURCC_I420;
-
-        if (par->mfx.NumThread)
-            par->mfx.NumThread = 0; //not supported
     }
     else {
         if (par->AsyncDepth > 16) {
@@ -66,15 +127,12 @@ mfxStatus CpuDecode::ValidateDecodeParams(mfxVideoParam *par, bool canCorrect) {
 
         if (par->Protected)
             return MFX_ERR_INVALID_VIDEO_PARAM;
-        if (par->NumExtParam)
+        if (!HasSupportedExtBuffers(par))
             return MFX_ERR_INVALID_VIDEO_PARAM;
 
         if (par->IOPattern != MFX_IOPATTERN_OUT_SYSTEM_MEMORY)
             return MFX_ERR_INVALID_VIDEO_PARAM;
 
-        if (par->mfx.NumThread)
-            return MFX_ERR_INVALID_VIDEO_PARAM;
-
         //only YUV420 or YUV422 chromaformats accepted
         if ((par->mfx.FrameInfo.ChromaFormat) &&
             !((par->mfx.FrameInfo.ChromaFormat == MFX_CHROMAFORMAT_YUV420) ||
@@ -203,7 +261,8 @@ mfxStatus CpuDecode::ValidateDecodeParams(mfxVideoParam *par, bool canCorrect) {
 //InitDecode can operate in two modes:
 // With no bitstream: assumes header decoded elsewhere, validates params given
 // With bitstream
-//  1. Attempts to decode a frame
+//  1. Reads the sequence header, or decodes a frame if that is not enough,
+//     MFX_ERR_MORE_DATA if neither gives the stream parameters
 //  2. Gets parameters
 mfxStatus CpuDecode::InitDecode(mfxVideoParam *par, mfxBitstream *bs) {
     AVCodecID cid = MFXCodecId_to_AVCodecID(par->mfx.CodecId);
@@ -230,8 +289,26 @@ mfxStatus CpuDecode::InitDecode(mfxVideoParam *par, mfxBitstream *bs) {
         return MFX_ERR_INVALID_VIDEO_PARAM;
     }
 
+    m_avParserContext = avcodec_alloc_context3(m_avDecCodec);
+    if (!m_avParserContext) {
+        return MFX_ERR_MEMORY_ALLOC;
+    }
+
+    // the decoder is not opened when the header gives the stream parameters
+    if (bs && ProbeHeader(bs) == MFX_ERR_NONE) {
+        m_param = *par;
+        if (m_avDecCodec->id == AV_CODEC_ID_AV1)
+            RET_ERROR(UpdateAV1Info());
+        GetVideoParam(par);
+        return valSts;
+    }
+
 #ifdef ENABLE_LIBAV_AUTO_THREADS
-    m_avDecContext->thread_count = 0;
+    // threads asked for by the stream or the session, otherwise a share of
+    //   the process-wide budget instead of one thread per core
+    m_codecThreads = CpuThreadBudget::Acquire(par->mfx.NumThread ? par->mfx.NumThread
+                                                                 : m_session->GetNumThread());
+    m_avDecContext->thread_count = m_codecThreads;
 #endif
 
     if (!bs) {
@@ -247,7 +324,25 @@ mfxStatus CpuDecode::InitDecode(mfxVideoParam *par, mfxBitstream *bs) {
         }
     }
 
-    if (avcodec_open2(m_avDecContext, m_avDecCodec, NULL) < 0) {
+    if (!bs)
+        RET_ERROR(InitScale(par));
+
+    // application surfaces are decoded into directly when they fit, scaled
+    //   output always goes through a copy
+    if (!m_bScale && (m_avDecCodec->capabilities & AV_CODEC_CAP_DR1)) {
+        m_avDecContext->opaque      = this;
+        m_avDecContext->get_buffer2 = GetBuffer;
+#if FF_API_THREAD_SAFE_CALLBACKS
+        m_avDecContext->thread_safe_callbacks = 1;
+#endif
+    }
+
+    // frame threads started here stay on the session's CPUs and priority
+    int err = 0;
+    m_session->RunPlaced([&]() {
+        err = avcodec_open2(m_avDecContext, m_avDecCodec, NULL);
+    });
+    if (err < 0) {
         return MFX_ERR_INVALID_VIDEO_PARAM;
     }
 
@@ -256,42 +351,55 @@ mfxStatus CpuDecode::InitDecode(mfxVideoParam *par, mfxBitstream *bs) {
         return MFX_ERR_MEMORY_ALLOC;
     }
 
-    m_avDecFrameOut = av_frame_alloc();
-    if (!m_avDecFrameOut) {
-        return MFX_ERR_MEMORY_ALLOC;
-    }
-
     m_param = *par;
 
     if (bs) {
-        // create copy to not modify caller's mfxBitstream
-        // todo: this only works if input is large enough to
-        // decode a frame
+        // create copy to not modify caller's mfxBitstream, without a header
+        //   the parameters are only known once a frame is decoded
         mfxBitstream bs2 = *bs;
-        bs2.DataFlag |= MFX_BITSTREAM_EOS;
-        m_bStreamInfo = true;
-        DecodeFrame(&bs2, nullptr, nullptr);
+        RET_ERROR(ProbeStream(&bs2));
+        RET_IF_FALSE(m_avDecContext->width && m_avDecContext->height, MFX_ERR_MORE_DATA);
         GetVideoParam(par);
     }
 
+    m_deadline.Init(m_param.mfx.FrameInfo, m_param.AsyncDepth);
+
     return valSts;
 }
 
 CpuDecode::~CpuDecode() {
+    // queued tasks use the decoder context
+    if (m_lastTask)
+        m_session->GetScheduler()->WaitAll();
+
+    for (auto &decoded : m_decFrames) {
+        if (decoded.frame)
+            av_frame_free(&decoded.frame);
+    }
+
     if (m_swsContext) {
         sws_freeContext(m_swsContext);
     }
 
-    if (m_avDecFrameOut) {
-        av_frame_free(&m_avDecFrameOut);
-        m_avDecFrameOut = nullptr;
-    }
+    if (m_scaleContext)
+        sws_freeContext(m_scaleContext);
 
     if (m_avDecParser) {
         av_parser_close(m_avDecParser);
         m_avDecParser = nullptr;
     }
 
+    if (m_avParserContext)
+        avcodec_free_context(&m_avParserContext);
+
+    if (m_avKeyParser) {
+        av_parser_close(m_avKeyParser);
+        m_avKeyParser = nullptr;
+    }
+
+    if (m_avKeyParserContext)
+        avcodec_free_context(&m_avKeyParserContext);
+
     if (m_avDecPacket) {
         av_packet_free(&m_avDecPacket);
         m_avDecPacket = nullptr;
@@ -302,273 +410,1356 @@ CpuDecode::~CpuDecode() {
         avcodec_free_context(&m_avDecContext);
         m_avDecContext = nullptr;
     }
+
+    // lent surfaces came back with the decoder's last buffers
+    TakeBackOfferedSurfaces();
+
+    if (m_codecThreads)
+        CpuThreadBudget::Release(m_codecThreads);
 }
 
-// bs == 0 is a signal to drain
+// DecodeFrame splits the bitstream into access units on the calling thread
+//   and decodes them on the session worker (bs == 0 is a signal to drain).
+//   With AsyncDepth set, up to AsyncDepth access units are in flight and
+//   MFX_WRN_DEVICE_BUSY is returned while all of them are still decoding.
+//   Otherwise every access unit is decoded before the call returns.
 mfxStatus CpuDecode::DecodeFrame(mfxBitstream *bs,
                                  mfxFrameSurface1 *surface_work,
-                                 mfxFrameSurface1 **surface_out) {
-    if (m_bFrameBuffered) {
-        if (surface_work && surface_out) {
-            RET_ERROR(AVFrame2mfxFrameSurface(surface_work,
-                                              m_avDecFrameOut,
-                                              m_session->GetFrameAllocator()));
-
-            surface_work->Data.FrameOrder = m_frameOrder++;
-            *surface_out                  = surface_work;
-            m_bFrameBuffered              = false;
+                                 mfxFrameSurface1 **surface_out,
+                                 mfxSyncPoint *syncp) {
+    CpuScheduler *scheduler = m_session->GetScheduler();
+    bool bPipelined         = (bs && m_param.AsyncDepth);
+
+    // application surfaces may receive a picture without a copy
+    UnlockReturnedSurfaces();
+    if (surface_work && !CpuFrame::TryCast(surface_work))
+        OfferSurface(surface_work);
+
+    for (;;) {
+        if (HasDecodedFrame())
+            return OutputFrame(surface_work, surface_out, syncp);
+
+        if (bPipelined) {
+            mfxStatus sts = scheduler->Throttle(&m_decTasks, m_param.AsyncDepth, false);
+            RET_ERROR(sts);
+            if (HasDecodedFrame())
+                return OutputFrame(surface_work, surface_out, syncp);
+            if (sts == MFX_WRN_DEVICE_BUSY)
+                return sts;
+        }
+
+        AVPacket *packet = nullptr;
+        RET_ERROR(ParsePacket(bs, &packet));
+        if (packet)
+            RET_ERROR(QueueDecode(packet));
+
+        if (!bs) {
+            // null bitstream indicates drain, send EOF packet
+            RET_ERROR(QueueDecode(nullptr));
+        }
+
+        if (!bPipelined)
+            RET_ERROR(scheduler->Throttle(&m_decTasks, 1, true));
+
+        if (HasDecodedFrame())
+            return OutputFrame(surface_work, surface_out, syncp);
+
+        if (bs && bs->DataLength)
+            continue; // we have more input data
+
+        // surfaces the decoder did not take go back to the application,
+        //   which may pass a different one with the next call
+        TakeBackOfferedSurfaces();
+
+        return MFX_ERR_MORE_DATA;
+    }
+}
+
+// Split the next access unit off the bitstream, packet stays null if the
+//   parser needs more data. bs == 0 flushes the parser.
+mfxStatus CpuDecode::ParsePacket(mfxBitstream *bs, AVPacket **packet) {
+    *packet = nullptr;
+
+    bool bComplete =
+        bs && ((bs->DataFlag & MFX_BITSTREAM_COMPLETE_FRAME) == MFX_BITSTREAM_COMPLETE_FRAME);
+    if (bComplete) {
+        m_avDecPacket->data = bs->Data + bs->DataOffset;
+        m_avDecPacket->size = bs->DataLength;
+        bs->DataOffset += bs->DataLength;
+        bs->DataLength = 0;
+    }
+    else {
+        // parse
+        auto data_ptr    = bs ? (bs->Data + bs->DataOffset) : nullptr;
+        int data_size    = bs ? bs->DataLength : 0;
+        int bytes_parsed = av_parser_parse2(m_avDecParser,
+                                            m_avParserContext,
+                                            &m_avDecPacket->data,
+                                            &m_avDecPacket->size,
+                                            data_ptr,
+                                            data_size,
+                                            AV_NOPTS_VALUE,
+                                            AV_NOPTS_VALUE,
+                                            0);
+
+        if (bs && bytes_parsed) {
+            bs->DataOffset += bytes_parsed;
+            bs->DataLength -= bytes_parsed;
+        }
+    }
+
+    if (!m_avDecPacket->size)
+        return MFX_ERR_NONE;
+
+    // keyframes only, or the first keyframe after them
+    if (m_bWaitKey) {
+        if (!IsKeyPacket(bComplete)) {
+            m_numSkipPackets++;
             return MFX_ERR_NONE;
         }
-        else {
-            return MFX_ERR_MORE_SURFACE;
+        if (m_skipLevel < DECODE_KEY_SKIP_LEVEL)
+            m_bWaitKey = false;
+    }
+
+    if (bs && bs->TimeStamp)
+        m_avDecPacket->pts = bs->TimeStamp;
+
+    // packet data belongs to the caller's bitstream or the parser,
+    //   decoding happens later so take a copy
+    *packet = av_packet_alloc();
+    RET_IF_FALSE(*packet, MFX_ERR_MEMORY_ALLOC);
+    if (av_packet_ref(*packet, m_avDecPacket) < 0) {
+        av_packet_free(packet);
+        return MFX_ERR_MEMORY_ALLOC;
+    }
+
+    return MFX_ERR_NONE;
+}
+
+// Whether the access unit in m_avDecPacket starts a sequence the decoder can
+//   enter. The parser sets key_frame for IDR and recovery point pictures,
+//   IRAP pictures and AV1 key frames, MPEG-2 only reports the picture type.
+//   Parsed packets take the flags from the parse that produced them, complete
+//   frames bypass the stream parser and are read by a separate parser that
+//   does not combine packets.
+bool CpuDecode::IsKeyPacket(bool bComplete) {
+    if (m_avDecCodec->id == AV_CODEC_ID_MJPEG)
+        return true;
+
+    AVCodecParserContext *parser = m_avDecParser;
+    if (bComplete) {
+        if (!m_avKeyParser) {
+            m_avKeyParser = av_parser_init(m_avDecCodec->id);
+            if (m_avKeyParser)
+                m_avKeyParser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
         }
+        if (!m_avKeyParserContext)
+            m_avKeyParserContext = avcodec_alloc_context3(m_avDecCodec);
+        // without a parser every frame is taken
+        if (!m_avKeyParser || !m_avKeyParserContext)
+            return true;
+
+        uint8_t *out = nullptr;
+        int outSize  = 0;
+        av_parser_parse2(m_avKeyParser,
+                         m_avKeyParserContext,
+                         &out,
+                         &outSize,
+                         m_avDecPacket->data,
+                         m_avDecPacket->size,
+                         AV_NOPTS_VALUE,
+                         AV_NOPTS_VALUE,
+                         0);
+        parser = m_avKeyParser;
     }
 
-    // Try get AVFrame from surface_work
-    AVFrame *avframe    = nullptr;
-    CpuFrame *cpu_frame = CpuFrame::TryCast(surface_work);
-    if (cpu_frame) {
-        avframe = cpu_frame->GetAVFrame();
+    if (parser->key_frame >= 0)
+        return parser->key_frame == 1;
+    return parser->pict_type == AV_PICTURE_TYPE_I;
+}
+
+// queue the packet for decoding on the session worker, takes ownership
+mfxStatus CpuDecode::QueueDecode(AVPacket *packet) {
+    CpuDeadline::Clock::time_point deadline = m_deadline.Arrive();
+
+    size_t packetBytes  = packet ? packet->size : 0;
+    ParsedFields fields = GetParsedFields();
+    m_queuedBytes += packetBytes;
+
+    mfxSyncPoint taskSyncp = nullptr;
+    mfxStatus submitSts    = m_session->Submit(
+        [this, packet, packetBytes, fields, deadline]() mutable {
+            // late sessions catch up by decoding only reference frames
+            ApplySkipLevel(m_skipLevel, m_deadline.IsLate());
+            ApplyParsedFields(fields);
+
+            mfxStatus sts = DecodePacket(packet);
+            av_packet_free(&packet);
+            m_queuedBytes -= packetBytes;
+            m_deadline.Complete(deadline);
+            return sts;
+        },
+        &taskSyncp,
+        CPU_STAGE_DECODE);
+    if (submitSts != MFX_ERR_NONE) {
+        av_packet_free(&packet);
+        m_queuedBytes -= packetBytes;
+        return submitSts;
     }
-    if (!avframe) { // Otherwise use AVFrame allocated in this class
-        avframe = m_avDecFrameOut;
+
+    m_decTasks.push_back(taskSyncp);
+    m_lastTask = taskSyncp;
+
+    return MFX_ERR_NONE;
+}
+
+// read on the calling thread, right after the parser split off the packet
+CpuDecode::ParsedFields CpuDecode::GetParsedFields() {
+    ParsedFields fields = { m_avParserContext->framerate,
+                            m_avParserContext->profile,
+                            m_avParserContext->level };
+    return fields;
+}
+
+// decoders that report these themselves keep their values
+void CpuDecode::ApplyParsedFields(const ParsedFields &fields) {
+    if (!m_avDecContext->framerate.num && fields.framerate.num)
+        m_avDecContext->framerate = fields.framerate;
+    if (m_avDecContext->profile == FF_PROFILE_UNKNOWN)
+        m_avDecContext->profile = fields.profile;
+    if (m_avDecContext->level == FF_LEVEL_UNKNOWN)
+        m_avDecContext->level = fields.level;
+}
+
+// Skip levels, each adds to the one before:
+//   1 - no loop filter on non-reference frames
+//   2 - non-reference frames are not decoded
+//   3 - no loop filter at all, IDCT only on keyframes where the codec
+//       supports it (MPEG-2, JPEG), references degrade until the next key
+//   4 - only keyframes reach the decoder, the rest is dropped after
+//       parsing, see ParsePacket
+void CpuDecode::ApplySkipLevel(int level, bool bLate) {
+    AVDiscard loopFilter = AVDISCARD_DEFAULT;
+    if (level >= 3)
+        loopFilter = AVDISCARD_ALL;
+    else if (level >= 1)
+        loopFilter = AVDISCARD_NONREF;
+
+    m_avDecContext->skip_loop_filter = loopFilter;
+    m_avDecContext->skip_frame = (level >= 2 || bLate) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    m_avDecContext->skip_idct  = (level >= 3) ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+}
+
+mfxStatus CpuDecode::SetSkipMode(mfxSkipMode mode) {
+    int level = m_skipLevel;
+
+    switch (mode) {
+        case MFX_SKIPMODE_NOSKIP:
+            level = 0;
+            break;
+        case MFX_SKIPMODE_MORE:
+            RET_IF_FALSE(level < DECODE_MAX_SKIP_LEVEL, MFX_WRN_VALUE_NOT_CHANGED);
+            level++;
+            break;
+        case MFX_SKIPMODE_LESS:
+            RET_IF_FALSE(level > 0, MFX_WRN_VALUE_NOT_CHANGED);
+            level--;
+            break;
+        default:
+            return MFX_ERR_UNSUPPORTED;
     }
 
-    bool complete_frame_mode = false;
-    if (bs && ((bs->DataFlag & MFX_BITSTREAM_COMPLETE_FRAME) == MFX_BITSTREAM_COMPLETE_FRAME)) {
-        complete_frame_mode = true;
+    // the frames after the keyframes reference pictures that were dropped,
+    //   leaving level 4 waits for the next keyframe
+    if (level == DECODE_KEY_SKIP_LEVEL)
+        m_bWaitKey = true;
+
+    m_skipLevel = level;
+    return MFX_ERR_NONE;
+}
+
+// Send one access unit to the decoder (packet == 0 drains it) and collect
+//   every frame it has ready. Runs on the session worker, or on the calling
+//   thread while probing the stream.
+mfxStatus CpuDecode::DecodePacket(AVPacket *packet) {
+    auto av_ret = avcodec_send_packet(m_avDecContext, packet);
+    if (packet) {
+        if (av_ret == AVERROR_INVALIDDATA) {
+            // corrupted stream - set Corrupted flag on the next output surface
+            DecodedFrame corrupted = { nullptr, true, m_avDecContext->framerate };
+            std::lock_guard<std::mutex> lock(m_decFramesMutex);
+            m_decFrames.push_back(corrupted);
+            return MFX_ERR_NONE;
+        }
+
+        RET_IF_FALSE(av_ret >= 0, MFX_ERR_ABORTED);
     }
 
+    bool bSkipping = (packet && m_avDecContext->skip_frame >= AVDISCARD_NONREF);
+    if (bSkipping)
+        m_numSkipPackets++;
+
     for (;;) {
-        int bytes_parsed = 0;
+        AVFrame *avframe = av_frame_alloc();
+        RET_IF_FALSE(avframe, MFX_ERR_MEMORY_ALLOC);
 
-        if (complete_frame_mode) {
-            m_avDecPacket->data = bs->Data + bs->DataOffset;
-            m_avDecPacket->size = bs->DataLength;
-            bytes_parsed        = bs->DataLength;
-            bs->DataOffset += bytes_parsed;
-            bs->DataLength -= bytes_parsed;
+        // receive frame
+        av_ret = avcodec_receive_frame(m_avDecContext, avframe);
+        if (av_ret != 0) {
+            av_frame_free(&avframe);
+            break;
         }
-        else {
-            // parse
-            auto data_ptr = bs ? (bs->Data + bs->DataOffset) : nullptr;
-            int data_size = bs ? bs->DataLength : 0;
-            bytes_parsed += av_parser_parse2(m_avDecParser,
-                                             m_avDecContext,
-                                             &m_avDecPacket->data,
-                                             &m_avDecPacket->size,
-                                             data_ptr,
-                                             data_size,
-                                             AV_NOPTS_VALUE,
-                                             AV_NOPTS_VALUE,
-                                             0);
-
-            if (bs && bytes_parsed) {
-                bs->DataOffset += bytes_parsed;
-                bs->DataLength -= bytes_parsed;
-            }
+
+        // scaled output is converted while scaling
+        mfxStatus sts = MFX_ERR_NONE;
+        if (m_avDecContext->codec_id == AV_CODEC_ID_MJPEG && !m_bScale)
+            sts = ConvertJPEGOutput(&avframe);
+        if (sts == MFX_ERR_NONE)
+            sts = UpdateStreamInfo(avframe);
+        if (sts != MFX_ERR_NONE) {
+            av_frame_free(&avframe);
+            return sts;
         }
 
-        // send packet
-        if (m_avDecPacket->size) {
-            if (bs && bs->TimeStamp)
-                m_avDecPacket->pts = bs->TimeStamp;
+        if (bSkipping)
+            m_numSkipFrames++;
 
-            auto av_ret = avcodec_send_packet(m_avDecContext, m_avDecPacket);
+        DecodedFrame decoded = { avframe, false, m_avDecContext->framerate };
+        std::lock_guard<std::mutex> lock(m_decFramesMutex);
+        m_decFrames.push_back(decoded);
+    }
 
-            if (av_ret == AVERROR_INVALIDDATA) {
-                // corrupted stream - set Corrupted flag in mfxFrameData and return
-                if (surface_work && surface_out) {
-                    surface_work->Data.Corrupted = MFX_CORRUPTION_MAJOR;
-                    *surface_out                 = surface_work;
-                    return MFX_ERR_NONE;
-                }
+    RET_IF_FALSE(av_ret == AVERROR(EAGAIN) || av_ret == AVERROR_EOF, MFX_ERR_ABORTED);
+
+    return MFX_ERR_NONE;
+}
+
+// AV1 profile, level and film grain setting of the sequence header
+mfxStatus CpuDecode::UpdateAV1Info() {
+    // profile
+    switch (m_avDecContext->profile) {
+        case 0:
+            m_param.mfx.CodecProfile = MFX_PROFILE_AV1_MAIN;
+            break;
+        case 1:
+            m_param.mfx.CodecProfile = MFX_PROFILE_AV1_HIGH;
+            break;
+        case 2:
+            m_param.mfx.CodecProfile = MFX_PROFILE_AV1_PRO;
+            break;
+        default:
+            return MFX_ERR_ABORTED;
+    }
+
+    // level
+    //
+    // codes when decoder sets level of context from av1 sequence header
+    //
+    //     c->level = ((p->seq_hdr->operating_points[0].major_level - 2) << 2)
+    //                | p->seq_hdr->operating_points[0].minor_level;
+    //
+    int major_level = (m_avDecContext->level >> 2) + 2;
+    int minor_level = m_avDecContext->level - ((major_level - 2) << 2);
+
+    if (major_level < 2 || major_level > 7 || minor_level < 0 || minor_level > 3)
+        return MFX_ERR_ABORTED;
+
+    // in mfxstructure.h
+    // enum
+    //    MFX_LEVEL_AV1_2                         = 20,
+    //    MFX_LEVEL_AV1_21                        = 21,
+    //    ...
+    //    MFX_LEVEL_AV1_72                        = 72,
+    //    MFX_LEVEL_AV1_73                        = 73,
+    //
+    int mfx_level = (major_level * 10) + minor_level;
+
+    m_param.mfx.CodecLevel = mfx_level;
+
+    int ret;
+    int64_t optval;
+    ret = av_opt_get_int(m_avDecContext->priv_data, "filmgrain", AV_OPT_SEARCH_CHILDREN, &optval);
+    if (ret == 0) {
+        m_param.mfx.FilmGrain = (mfxU16)optval;
+    }
+    else {
+        m_param.mfx.FilmGrain = 0;
+    }
+
+    return MFX_ERR_NONE;
+}
+
+// track stream properties reported by the decoder
+mfxStatus CpuDecode::UpdateStreamInfo(AVFrame *avframe) {
+    if (m_avDecContext->codec_id == AV_CODEC_ID_AV1)
+        RET_ERROR(UpdateAV1Info());
+
+    int width  = 0;
+    int height = 0;
+    GetStreamSize(&width, &height);
+
+    if (m_param.mfx.FrameInfo.Width != width || m_param.mfx.FrameInfo.Height != height) {
+        m_param.mfx.FrameInfo.Width  = width;
+        m_param.mfx.FrameInfo.Height = height;
+
+        switch (m_avDecContext->pix_fmt) {
+            case AV_PIX_FMT_YUV420P10LE:
+                m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I010;
+                break;
+            case AV_PIX_FMT_YUV422P10LE:
+                m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I210;
+                break;
+            case AV_PIX_FMT_YUV422P:
+                m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I422;
+                break;
+            case AV_PIX_FMT_YUV420P:
+            case AV_PIX_FMT_YUVJ420P:
+            default:
+                m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I420;
+                break;
+        }
+    }
+
+    return MFX_ERR_NONE;
+}
+
+// picture size of the stream, the context reports the reduced size of
+//   lowres decoding
+void CpuDecode::GetStreamSize(int *width, int *height) {
+    bool bLowres = m_avDecContext->lowres && m_avDecContext->coded_width;
+    *width       = bLowres ? m_avDecContext->coded_width : m_avDecContext->width;
+    *height      = bLowres ? m_avDecContext->coded_height : m_avDecContext->height;
+}
+
+bool CpuDecode::HasDecodedFrame() {
+    std::lock_guard<std::mutex> lock(m_decFramesMutex);
+    return !m_decFrames.empty();
+}
+
+// hand the oldest decoded frame to the application
+mfxStatus CpuDecode::OutputFrame(mfxFrameSurface1 *surface_work,
+                                 mfxFrameSurface1 **surface_out,
+                                 mfxSyncPoint *syncp) {
+    RET_IF_FALSE(surface_work && surface_out, MFX_ERR_MORE_SURFACE);
+
+    DecodedFrame decoded;
+    {
+        std::lock_guard<std::mutex> lock(m_decFramesMutex);
+        decoded = m_decFrames.front();
+    }
+
+    mfxSyncPoint taskSyncp     = m_lastTask;
+    mfxFrameSurface1 *output   = surface_work;
+    mfxFrameSurface1 *lentSurf = decoded.frame ? FindLentSurface(decoded.frame) : nullptr;
+
+    if (decoded.corrupted) {
+        surface_work->Data.Corrupted = MFX_CORRUPTION_MAJOR;
+        m_numError++;
+    }
+    else if (lentSurf) {
+        // decoded straight into an application surface, which stays locked
+        //   while the decoder keeps it as a reference
+        AVFrame *avframe       = decoded.frame;
+        output                 = lentSurf;
+        output->Info.CropX     = 0;
+        output->Info.CropY     = 0;
+        output->Info.CropW     = (mfxU16)avframe->width;
+        output->Info.CropH     = (mfxU16)avframe->height;
+        output->Data.Corrupted = 0;
+        if (avframe->pts) {
+            output->Data.TimeStamp = avframe->pts;
+            output->Data.DataFlag  = MFX_FRAMEDATA_ORIGINAL_TIMESTAMP;
+        }
+        av_frame_free(&avframe);
+        output->Info.FrameRateExtN = (uint16_t)decoded.framerate.num;
+        output->Info.FrameRateExtD = (uint16_t)decoded.framerate.den;
+    }
+    else {
+        AVFrame *avframe    = decoded.frame;
+        CpuFrame *cpu_frame = CpuFrame::TryCast(surface_work);
+        bool bTakeOver      = cpu_frame && cpu_frame->GetAVFrame() && !m_bScale;
+        // shared memory surfaces of the picture size receive a copy, so they
+        //   stay exportable
+        if (bTakeOver && cpu_frame->IsShared())
+            bTakeOver = surface_work->Info.Width != avframe->width ||
+                        surface_work->Info.Height != avframe->height;
+        if (bTakeOver) {
+            // internally allocated surface takes over the decoded picture, no copy
+            cpu_frame->TakeOver(avframe);
+            av_frame_free(&avframe);
+        }
+        else {
+            // the picture is in a libav buffer, surfaces the decoder did not
+            //   take are returned and surface_work receives a copy
+            TakeBackOfferedSurfaces();
+            RET_IF_FALSE(!IsLent(surface_work), MFX_ERR_MORE_SURFACE);
+            bool bFits = m_bScale ? (surface_work->Info.Width >= m_outScale.Out.Width &&
+                                     surface_work->Info.Height >= m_outScale.Out.Height)
+                                  : (surface_work->Info.Width == avframe->width &&
+                                     surface_work->Info.Height == avframe->height);
+            RET_IF_FALSE(bFits, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
+
+            // frame metadata is available right away, image data is
+            //   copied on the session worker
+            if (avframe->pts) {
+                surface_work->Data.TimeStamp = avframe->pts;
+                surface_work->Data.DataFlag  = MFX_FRAMEDATA_ORIGINAL_TIMESTAMP;
             }
 
-            if (av_ret < 0) {
-                return MFX_ERR_ABORTED;
+            HoldSurface(surface_work);
+            mfxStatus submitSts = m_session->Submit(
+                [this, surface_work, avframe]() mutable {
+                    mfxStatus sts;
+                    if (m_bScale)
+                        sts = ScaleFrame(surface_work, avframe);
+                    else
+                        sts = AVFrame2mfxFrameSurface(surface_work,
+                                                      avframe,
+                                                      m_session->GetFrameAllocator());
+                    av_frame_free(&avframe);
+                    ReleaseSurface(surface_work);
+                    return sts;
+                },
+                &taskSyncp,
+                CPU_STAGE_DECODE,
+                nullptr,
+                surface_work);
+            if (submitSts != MFX_ERR_NONE) {
+                ReleaseSurface(surface_work);
+                return submitSts;
             }
+            m_lastTask = taskSyncp;
         }
+        surface_work->Info.FrameRateExtN = (uint16_t)decoded.framerate.num;
+        surface_work->Info.FrameRateExtD = (uint16_t)decoded.framerate.den;
+    }
 
-        if (!bs) {
-            // null bitstream indicates drain, send EOF packet
-            avcodec_send_packet(m_avDecContext, nullptr);
+    {
+        std::lock_guard<std::mutex> lock(m_decFramesMutex);
+        m_decFrames.pop_front();
+    }
+
+    if (!decoded.corrupted)
+        output->Data.FrameOrder = m_frameOrder++;
+    *surface_out = output;
+    *syncp       = taskSyncp;
+
+    return MFX_ERR_NONE;
+}
+
+// Offer an application surface to the decoder, it is locked until the
+//   decoder returns it, or until DecodeFrame returns without it being taken.
+//   Planar surfaces in system memory at least the stream size are offered,
+//   GetBuffer() checks the rest.
+void CpuDecode::OfferSurface(mfxFrameSurface1 *surface) {
+    if (!m_avDecContext || m_avDecContext->get_buffer2 != GetBuffer)
+        return;
+    if (surface->Info.FourCC != m_param.mfx.FrameInfo.FourCC ||
+        surface->Info.Width < m_param.mfx.FrameInfo.Width ||
+        surface->Info.Height < m_param.mfx.FrameInfo.Height)
+        return;
+    if (!surface->Data.Y || !surface->Data.U || !surface->Data.V || surface->Data.Locked)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_lendMutex);
+    surface->Data.Locked++;
+    m_offered.push_back(surface);
+}
+
+// true if libavcodec can decode a picture of this format and coded size
+//   into the surface, with the padding and alignment it needs
+bool CpuDecode::FitsFrame(mfxFrameSurface1 *surface, int format, int width, int height) {
+    // full range 4:2:0 of MJPEG has the I420 layout
+    if (format == AV_PIX_FMT_YUVJ420P)
+        format = AV_PIX_FMT_YUV420P;
+    if (MFXFourCC2AVPixelFormat(surface->Info.FourCC) != format)
+        return false;
+
+    int align[AV_NUM_DATA_POINTERS] = {};
+    avcodec_align_dimensions2(m_avDecContext, &width, &height, align);
+
+    int linesize[4] = {};
+    if (av_image_fill_linesizes(linesize, (AVPixelFormat)format, width) < 0)
+        return false;
+
+    // chroma planes use half the pitch
+    int pitch = (surface->Data.PitchHigh << 16) | surface->Data.PitchLow;
+    uint8_t *planes[3] = { surface->Data.Y, surface->Data.U, surface->Data.V };
+    int pitches[3]     = { pitch, pitch / 2, pitch / 2 };
+    for (int i = 0; i < 3; i++) {
+        int planeAlign = align[i] ? align[i] : 1;
+        if (pitches[i] < linesize[i] || pitches[i] % planeAlign ||
+            reinterpret_cast<uintptr_t>(planes[i]) % planeAlign)
+            return false;
+    }
+
+    return surface->Info.Width >= width && surface->Info.Height >= height;
+}
+
+// take an offered surface for a new picture, nullptr if none fits
+mfxFrameSurface1 *CpuDecode::LendSurface(AVFrame *frame) {
+    std::lock_guard<std::mutex> lock(m_lendMutex);
+    for (auto it = m_offered.begin(); it != m_offered.end(); ++it) {
+        mfxFrameSurface1 *surface = *it;
+        if (FitsFrame(surface, frame->format, frame->width, frame->height)) {
+            m_offered.erase(it);
+            m_lent[surface->Data.Y] = surface;
+            return surface;
         }
+    }
 
-        // receive frame
-        auto av_ret = avcodec_receive_frame(m_avDecContext, avframe);
-        if (av_ret == 0) {
-            // in case mjpeg, convert yuvj420p -> yuv420p
-            if (m_avDecContext->codec_id == AV_CODEC_ID_MJPEG) {
-                if (m_avDecContext->pix_fmt != AV_PIX_FMT_YUV420P) {
-                    avframe = ConvertJPEGOutputColorSpace(avframe, AV_PIX_FMT_YUV420P);
-                    if (avframe == nullptr)
-                        return MFX_ERR_ABORTED;
-                }
+    return nullptr;
+}
 
-                avframe->color_range = AVCOL_RANGE_UNSPECIFIED;
-            }
+// give a lent surface back to the application, may be called from libav
+//   threads, the surface is unlocked by the next decode call
+void CpuDecode::ReturnLentSurface(mfxFrameSurface1 *surface) {
+    std::lock_guard<std::mutex> lock(m_lendMutex);
+    m_lent.erase(surface->Data.Y);
+    m_returned.push_back(surface);
+}
 
-            if (m_avDecContext->codec_id == AV_CODEC_ID_AV1) {
-                // profile
-                switch (m_avDecContext->profile) {
-                    case 0:
-                        m_param.mfx.CodecProfile = MFX_PROFILE_AV1_MAIN;
-                        break;
-                    case 1:
-                        m_param.mfx.CodecProfile = MFX_PROFILE_AV1_HIGH;
-                        break;
-                    case 2:
-                        m_param.mfx.CodecProfile = MFX_PROFILE_AV1_PRO;
-                        break;
-                    default:
-                        return MFX_ERR_ABORTED;
-                }
+bool CpuDecode::IsLent(mfxFrameSurface1 *surface) {
+    std::lock_guard<std::mutex> lock(m_lendMutex);
+    auto it = m_lent.find(surface->Data.Y);
+    return it != m_lent.end() && it->second == surface;
+}
 
-                // level
-                //
-                // codes when decoder sets level of context from av1 sequence header
-                //
-                //     c->level = ((p->seq_hdr->operating_points[0].major_level - 2) << 2)
-                //                | p->seq_hdr->operating_points[0].minor_level;
-                //
-                int major_level = (m_avDecContext->level >> 2) + 2;
-                int minor_level = m_avDecContext->level - ((major_level - 2) << 2);
-
-                if (major_level < 2 || major_level > 7 || minor_level < 0 || minor_level > 3)
-                    return MFX_ERR_ABORTED;
-
-                // in mfxstructure.h
-                // enum
-                //    MFX_LEVEL_AV1_2                         = 20,
-                //    MFX_LEVEL_AV1_21                        = 21,
-                //    ...
-                //    MFX_LEVEL_AV1_72                        = 72,
-                //    MFX_LEVEL_AV1_73                        = 73,
-                //
-                int mfx_level = (major_level * 10) + minor_level;
-
-                m_param.mfx.CodecLevel = mfx_level;
-
-                int ret;
-                int64_t optval;
-                ret = av_opt_get_int(m_avDecContext->priv_data,
-                                     "filmgrain",
-                                     AV_OPT_SEARCH_CHILDREN,
-                                     &optval);
-                if (ret == 0) {
-                    m_param.mfx.FilmGrain = (mfxU16)optval;
-                }
-                else {
-                    m_param.mfx.FilmGrain = 0;
-                }
-            }
+void CpuDecode::TakeBackOfferedSurfaces() {
+    {
+        std::lock_guard<std::mutex> lock(m_lendMutex);
+        m_returned.insert(m_returned.end(), m_offered.begin(), m_offered.end());
+        m_offered.clear();
+    }
+    UnlockReturnedSurfaces();
+}
 
-            if (m_param.mfx.FrameInfo.Width != m_avDecContext->width ||
-                m_param.mfx.FrameInfo.Height != m_avDecContext->height) {
-                m_param.mfx.FrameInfo.Width  = m_avDecContext->width;
-                m_param.mfx.FrameInfo.Height = m_avDecContext->height;
-
-                switch (m_avDecContext->pix_fmt) {
-                    case AV_PIX_FMT_YUV420P10LE:
-                        m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I010;
-                        break;
-                    case AV_PIX_FMT_YUV422P10LE:
-                        m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I210;
-                        break;
-                    case AV_PIX_FMT_YUV422P:
-                        m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I422;
-                        break;
-                    case AV_PIX_FMT_YUV420P:
-                    case AV_PIX_FMT_YUVJ420P:
-                    default:
-                        m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I420;
-                        break;
-                }
+// the application reads Data.Locked without synchronization, so it is only
+//   changed on the calling thread
+void CpuDecode::UnlockReturnedSurfaces() {
+    std::lock_guard<std::mutex> lock(m_lendMutex);
+    for (mfxFrameSurface1 *surface : m_returned)
+        surface->Data.Locked--;
+    m_returned.clear();
+}
+
+// application surface holding the decoded picture, nullptr if it is in
+//   a libav buffer or cropped away from the start of the surface
+mfxFrameSurface1 *CpuDecode::FindLentSurface(AVFrame *avframe) {
+    if (!avframe->buf[0] || avframe->data[0] != avframe->buf[0]->data)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_lendMutex);
+    auto it = m_lent.find(avframe->buf[0]->data);
+    return (it != m_lent.end()) ? it->second : nullptr;
+}
+
+// AVCodecContext::get_buffer2, may be called from frame threads
+int CpuDecode::GetBuffer(AVCodecContext *ctx, AVFrame *frame, int flags) {
+    CpuDecode *decoder        = static_cast<CpuDecode *>(ctx->opaque);
+    mfxFrameSurface1 *surface = decoder->LendSurface(frame);
+    if (!surface)
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+
+    LentSurface *lent = new (std::nothrow) LentSurface;
+    if (!lent) {
+        decoder->ReturnLentSurface(surface);
+        return AVERROR(ENOMEM);
+    }
+    lent->decoder = decoder;
+    lent->surface = surface;
+    lent->planes  = 3;
+
+    int pitch          = (surface->Data.PitchHigh << 16) | surface->Data.PitchLow;
+    int chromaHeight   = (surface->Info.ChromaFormat == MFX_CHROMAFORMAT_YUV422)
+                             ? surface->Info.Height
+                             : surface->Info.Height / 2;
+    uint8_t *planes[3] = { surface->Data.Y, surface->Data.U, surface->Data.V };
+    int pitches[3]     = { pitch, pitch / 2, pitch / 2 };
+    int heights[3]     = { surface->Info.Height, chromaHeight, chromaHeight };
+
+    for (int i = 0; i < 3; i++) {
+        frame->data[i]     = planes[i];
+        frame->linesize[i] = pitches[i];
+        frame->buf[i] =
+            av_buffer_create(planes[i], pitches[i] * heights[i], ReturnBuffer, lent, 0);
+        if (!frame->buf[i]) {
+            // drop the references of the planes not created
+            for (int j = i; j < 3; j++)
+                ReturnBuffer(lent, planes[j]);
+            for (int j = 0; j < i; j++)
+                av_buffer_unref(&frame->buf[j]);
+            return AVERROR(ENOMEM);
+        }
+    }
+    frame->extended_data = frame->data;
+
+    return 0;
+}
+
+// plane buffer released by libav, the surface is returned with the last one
+void CpuDecode::ReturnBuffer(void *opaque, uint8_t *data) {
+    LentSurface *lent = static_cast<LentSurface *>(opaque);
+    if (--lent->planes > 0)
+        return;
+
+    lent->decoder->ReturnLentSurface(lent->surface);
+    delete lent;
+}
+
+mfxStatus CpuDecode::GetDecodeStat(mfxDecodeStat *stat) {
+    RET_IF_FALSE(stat, MFX_ERR_NULL_PTR);
+
+    // frame threads may still hold frames of skipping packets, the count
+    //   settles once they are output
+    mfxU32 numSkipPackets = m_numSkipPackets;
+    mfxU32 numSkipFrames  = m_numSkipFrames;
+
+    std::lock_guard<std::mutex> lock(m_decFramesMutex);
+    stat->NumFrame        = m_frameOrder;
+    stat->NumSkippedFrame = (numSkipPackets > numSkipFrames) ? numSkipPackets - numSkipFrames : 0;
+    stat->NumError        = m_numError;
+    stat->NumCachedFrame  = static_cast<mfxU32>(m_decFrames.size());
+
+    return MFX_ERR_NONE;
+}
+
+// Decode up to the first frame on the calling thread to learn the stream
+//   parameters, used by DecodeHeader.
+mfxStatus CpuDecode::ProbeStream(mfxBitstream *bs) {
+    while (!HasDecodedFrame()) {
+        bool bDrain      = (bs == nullptr);
+        AVPacket *packet = nullptr;
+        RET_ERROR(ParsePacket(bs, &packet));
+        if (packet) {
+            ApplyParsedFields(GetParsedFields());
+            mfxStatus sts = DecodePacket(packet);
+            av_packet_free(&packet);
+            RET_ERROR(sts);
+        }
+
+        if (bDrain) {
+            // input used up - drain the decoder
+            RET_ERROR(DecodePacket(nullptr));
+            return HasDecodedFrame() ? MFX_ERR_NONE : MFX_ERR_MORE_DATA;
+        }
+
+        if (!bs->DataLength)
+            bs = nullptr; // flush the parser next
+    }
+
+    return MFX_ERR_NONE;
+}
+
+// Fill the decoder context from the sequence header without decoding. The
+//   parsers read the headers of each access unit they split off, JPEG
+//   frame headers are read here. MFX_ERR_MORE_DATA if no header was found.
+mfxStatus CpuDecode::ProbeHeader(mfxBitstream *bs) {
+    const uint8_t *data = bs->Data + bs->DataOffset;
+    int size            = bs->DataLength;
+
+    if (m_avDecCodec->id == AV_CODEC_ID_MJPEG)
+        return ParseJPEGHeader(data, size);
+
+    // libav only knows the DPB size once the decoder has read the SPS
+    if (m_avDecCodec->id == AV_CODEC_ID_H264 || m_avDecCodec->id == AV_CODEC_ID_HEVC)
+        m_spsDpbFrames = ParseSpsDpbFrames(data, size);
+
+    // a parser of its own, the decoder's starts at the beginning if the
+    //   first frame has to be decoded after all
+    AVCodecParserContext *parser = av_parser_init(m_avDecCodec->id);
+    RET_IF_FALSE(parser, MFX_ERR_MORE_DATA);
+
+    bool bFound   = false;
+    bool bFlushed = false;
+    while (!bFound && !bFlushed) {
+        uint8_t *out = nullptr;
+        int outSize  = 0;
+        bFlushed     = (size == 0); // the last access unit is split off on flush
+        int used     = av_parser_parse2(parser,
+                                        m_avDecContext,
+                                        &out,
+                                        &outSize,
+                                        data,
+                                        size,
+                                        AV_NOPTS_VALUE,
+                                        AV_NOPTS_VALUE,
+                                        0);
+        if (used < 0 || (used == 0 && size > 0 && outSize == 0))
+            break;
+        data += used;
+        size -= used;
+
+        bFound = parser->width > 0 && parser->height > 0 && parser->format != AV_PIX_FMT_NONE;
+    }
+
+    if (bFound) {
+        m_avDecContext->width        = parser->width;
+        m_avDecContext->height       = parser->height;
+        m_avDecContext->coded_width  = parser->coded_width;
+        m_avDecContext->coded_height = parser->coded_height;
+        m_avDecContext->pix_fmt      = static_cast<AVPixelFormat>(parser->format);
+    }
+    av_parser_close(parser);
+
+    return bFound ? MFX_ERR_NONE : MFX_ERR_MORE_DATA;
+}
+
+// frame header (SOF0 to SOF3) of a JPEG picture, the output format is the
+//   one the decoder reports for the sampling factors
+mfxStatus CpuDecode::ParseJPEGHeader(const uint8_t *data, size_t size) {
+    size_t pos = 0;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF || data[pos + 1] == 0xFF) {
+            pos++;
+            continue;
+        }
+
+        // SOI, TEM and RSTn have no length
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2;
+            continue;
+        }
+        // scan data before a frame header
+        if (marker == 0xDA || marker == 0xD9)
+            break;
+
+        size_t length = (data[pos + 2] << 8) | data[pos + 3];
+        if (marker < 0xC0 || marker > 0xC3) {
+            pos += 2 + length;
+            continue;
+        }
+
+        // precision, height, width, components with their sampling factors
+        const uint8_t *sof = data + pos + 4;
+        RET_IF_FALSE(length >= 8 && pos + 2 + length <= size, MFX_ERR_MORE_DATA);
+        int numComponents = sof[5];
+        RET_IF_FALSE(sof[0] == 8 && length >= 8 + 3 * (size_t)numComponents, MFX_ERR_MORE_DATA);
+
+        AVPixelFormat format = AV_PIX_FMT_NONE;
+        if (numComponents == 1) {
+            format = AV_PIX_FMT_GRAY8;
+        }
+        else if (numComponents == 3 && sof[10] == sof[13]) {
+            // luma sampling factors against chroma ones, checked before the
+            //   division as they come from the stream
+            int lumaH   = sof[7] >> 4;
+            int lumaV   = sof[7] & 0xF;
+            int chromaH = sof[10] >> 4;
+            int chromaV = sof[10] & 0xF;
+            RET_IF_FALSE(lumaH && lumaV && chromaH && chromaV, MFX_ERR_MORE_DATA);
+            RET_IF_FALSE(chromaH <= lumaH && chromaV <= lumaV, MFX_ERR_MORE_DATA);
+            RET_IF_FALSE(lumaH % chromaH == 0 && lumaV % chromaV == 0, MFX_ERR_MORE_DATA);
+
+            switch ((lumaH / chromaH) << 4 | (lumaV / chromaV)) {
+                case 0x22:
+                    format = AV_PIX_FMT_YUVJ420P;
+                    break;
+                case 0x21:
+                    format = AV_PIX_FMT_YUVJ422P;
+                    break;
+                case 0x11:
+                    format = AV_PIX_FMT_YUVJ444P;
+                    break;
+                default:
+                    break;
             }
-            if (surface_out) {
-                if (avframe == m_avDecFrameOut) { // copy image data
-                    m_bFrameBuffered = true;
-                    RET_ERROR(AVFrame2mfxFrameSurface(surface_work,
-                                                      m_avDecFrameOut,
-                                                      m_session->GetFrameAllocator()));
-                    surface_work->Info.FrameRateExtN = (uint16_t)m_avDecContext->framerate.num;
-                    surface_work->Info.FrameRateExtD = (uint16_t)m_avDecContext->framerate.den;
-                    m_bFrameBuffered                 = false;
-                }
-                else {
-                    if (cpu_frame) { // update MFXFrameSurface from AVFrame
-                        cpu_frame->Update();
-                        surface_work->Info.FrameRateExtN = (uint16_t)m_avDecContext->framerate.num;
-                        surface_work->Info.FrameRateExtD = (uint16_t)m_avDecContext->framerate.den;
-                    }
-                }
-                surface_work->Data.FrameOrder = m_frameOrder++;
-                *surface_out                  = surface_work;
+        }
+        RET_IF_FALSE(format != AV_PIX_FMT_NONE, MFX_ERR_MORE_DATA);
+
+        switch (marker) {
+            case 0xC0:
+                m_avDecContext->profile = FF_PROFILE_MJPEG_HUFFMAN_BASELINE_DCT;
+                break;
+            case 0xC1:
+                m_avDecContext->profile = FF_PROFILE_MJPEG_HUFFMAN_EXTENDED_SEQUENTIAL_DCT;
+                break;
+            case 0xC2:
+                m_avDecContext->profile = FF_PROFILE_MJPEG_HUFFMAN_PROGRESSIVE_DCT;
+                break;
+            default:
+                m_avDecContext->profile = FF_PROFILE_MJPEG_HUFFMAN_LOSSLESS;
+                break;
+        }
+        m_avDecContext->height  = (sof[1] << 8) | sof[2];
+        m_avDecContext->width   = (sof[3] << 8) | sof[4];
+        m_avDecContext->pix_fmt = format;
+        return (m_avDecContext->width && m_avDecContext->height) ? MFX_ERR_NONE
+                                                                 : MFX_ERR_MORE_DATA;
+    }
+
+    return MFX_ERR_MORE_DATA;
+}
+
+// Exp-Golomb reader over an SPS with the emulation prevention bytes
+//   removed. Reads past the end return zeros and mark the reader overrun.
+class SpsBitReader {
+public:
+    SpsBitReader(const uint8_t *data, size_t size) : m_rbsp(), m_pos(0), m_bOverrun(false) {
+        int zeros = 0;
+        m_rbsp.reserve(size);
+        for (size_t i = 0; i < size; i++) {
+            if (zeros >= 2 && data[i] == 3) {
+                zeros = 0;
+                continue;
             }
-            return MFX_ERR_NONE;
+            m_rbsp.push_back(data[i]);
+            zeros = data[i] ? 0 : zeros + 1;
         }
-        if (av_ret == AVERROR(EAGAIN)) {
-            if (bs && bs->DataLength) {
-                continue; // we have more input data
+    }
+
+    mfxU32 U(int n) {
+        mfxU32 value = 0;
+        for (int i = 0; i < n; i++) {
+            mfxU32 bit = 0;
+            if (m_pos < m_rbsp.size() * 8)
+                bit = (m_rbsp[m_pos / 8] >> (7 - m_pos % 8)) & 1;
+            else
+                m_bOverrun = true;
+            m_pos++;
+            value = (value << 1) | bit;
+        }
+        return value;
+    }
+
+    mfxU32 Ue() {
+        int leadingZeros = 0;
+        while (!U(1)) {
+            if (m_bOverrun || ++leadingZeros > 31) {
+                m_bOverrun = true;
+                return 0;
             }
-            else {
-                if (m_bStreamInfo && bs &&
-                    ((bs->DataFlag & MFX_BITSTREAM_EOS) == MFX_BITSTREAM_EOS)) {
-                    //send a null packet and continue
-                    avcodec_send_packet(m_avDecContext, nullptr);
-                    m_bStreamInfo = false;
-                    continue;
-                }
-                else {
-                    return MFX_ERR_MORE_DATA;
+        }
+        return ((1u << leadingZeros) - 1) + U(leadingZeros);
+    }
+
+    int Se() {
+        mfxU32 code = Ue();
+        return (code & 1) ? static_cast<int>((code + 1) / 2) : -static_cast<int>(code / 2);
+    }
+
+    void Skip(size_t n) {
+        m_pos += n;
+        if (m_pos > m_rbsp.size() * 8)
+            m_bOverrun = true;
+    }
+
+    bool IsOverrun() const {
+        return m_bOverrun;
+    }
+
+private:
+    std::vector<uint8_t> m_rbsp;
+    size_t m_pos;
+    bool m_bOverrun;
+};
+
+// scaling_list(), H.264 7.3.2.1.1.1
+static void SkipAvcScalingList(SpsBitReader &bits, int size) {
+    int last = 8;
+    int next = 8;
+    for (int j = 0; j < size; j++) {
+        if (next)
+            next = (last + bits.Se() + 256) % 256;
+        last = next ? next : last;
+    }
+}
+
+// hrd_parameters(), H.264 E.1.2
+static void SkipAvcHrd(SpsBitReader &bits) {
+    mfxU32 cpbCnt = bits.Ue() + 1;
+    bits.Skip(8); // bit_rate_scale, cpb_size_scale
+    for (mfxU32 i = 0; i < cpbCnt && i < 32; i++) {
+        bits.Ue(); // bit_rate_value_minus1
+        bits.Ue(); // cpb_size_value_minus1
+        bits.Skip(1); // cbr_flag
+    }
+    bits.Skip(20); // delay and time offset lengths
+}
+
+// max_dec_frame_buffering of the VUI, H.264 7.3.2.1.1 and E.1.1. Without it
+//   the DPB is only known to hold num_ref_frames if pictures are output in
+//   decoding order, otherwise 0 leaves it to the level.
+static mfxU16 ReadAvcDpbFrames(SpsBitReader &bits) {
+    mfxU32 profile = bits.U(8);
+    bits.Skip(16); // constraint flags, level_idc
+    bits.Ue(); // seq_parameter_set_id
+
+    switch (profile) {
+        case 44:
+        case 83:
+        case 86:
+        case 100:
+        case 110:
+        case 118:
+        case 122:
+        case 128:
+        case 134:
+        case 135:
+        case 138:
+        case 139:
+        case 244: {
+            mfxU32 chromaFormat = bits.Ue();
+            if (chromaFormat == 3)
+                bits.Skip(1); // separate_colour_plane_flag
+            bits.Ue(); // bit_depth_luma_minus8
+            bits.Ue(); // bit_depth_chroma_minus8
+            bits.Skip(1); // qpprime_y_zero_transform_bypass_flag
+            if (bits.U(1)) {
+                for (int i = 0; i < (chromaFormat == 3 ? 12 : 8); i++) {
+                    if (bits.U(1))
+                        SkipAvcScalingList(bits, i < 6 ? 16 : 64);
                 }
             }
+            break;
+        }
+        default:
+            break;
+    }
+
+    bits.Ue(); // log2_max_frame_num_minus4
+    mfxU32 pocType = bits.Ue();
+    if (pocType == 0) {
+        bits.Ue(); // log2_max_pic_order_cnt_lsb_minus4
+    }
+    else if (pocType == 1) {
+        bits.Skip(1); // delta_pic_order_always_zero_flag
+        bits.Se(); // offset_for_non_ref_pic
+        bits.Se(); // offset_for_top_to_bottom_field
+        mfxU32 cycle = bits.Ue();
+        for (mfxU32 i = 0; i < cycle && i < 256; i++)
+            bits.Se(); // offset_for_ref_frame
+    }
+
+    mfxU32 numRefFrames = bits.Ue();
+    bits.Skip(1); // gaps_in_frame_num_value_allowed_flag
+    bits.Ue(); // pic_width_in_mbs_minus1
+    bits.Ue(); // pic_height_in_map_units_minus1
+    if (!bits.U(1))
+        bits.Skip(1); // mb_adaptive_frame_field_flag
+    bits.Skip(1); // direct_8x8_inference_flag
+    if (bits.U(1)) {
+        for (int i = 0; i < 4; i++)
+            bits.Ue(); // frame_crop offsets
+    }
+
+    mfxU32 dpbFrames = (pocType == 2) ? numRefFrames : 0;
+    if (bits.U(1)) {
+        if (bits.U(1) && bits.U(8) == 255)
+            bits.Skip(32); // sar_width, sar_height
+        if (bits.U(1))
+            bits.Skip(1); // overscan_appropriate_flag
+        if (bits.U(1)) {
+            bits.Skip(4); // video_format, video_full_range_flag
+            if (bits.U(1))
+                bits.Skip(24); // colour description
         }
-        if (av_ret == AVERROR_EOF) {
-            return MFX_ERR_MORE_DATA;
+        if (bits.U(1)) {
+            bits.Ue(); // chroma_sample_loc_type_top_field
+            bits.Ue(); // chroma_sample_loc_type_bottom_field
+        }
+        if (bits.U(1))
+            bits.Skip(65); // timing info
+        bool bNalHrd = bits.U(1);
+        if (bNalHrd)
+            SkipAvcHrd(bits);
+        bool bVclHrd = bits.U(1);
+        if (bVclHrd)
+            SkipAvcHrd(bits);
+        if (bNalHrd || bVclHrd)
+            bits.Skip(1); // low_delay_hrd_flag
+        bits.Skip(1); // pic_struct_present_flag
+        if (bits.U(1)) {
+            bits.Skip(1); // motion_vectors_over_pic_boundaries_flag
+            for (int i = 0; i < 5; i++)
+                bits.Ue(); // size and reordering limits
+            dpbFrames = std::max(bits.Ue(), 1u);
         }
-        return MFX_ERR_ABORTED;
     }
+
+    if (bits.IsOverrun())
+        return 0;
+    return static_cast<mfxU16>(std::min(dpbFrames, 16u));
 }
 
-AVFrame *CpuDecode::ConvertJPEGOutputColorSpace(AVFrame *avframe, AVPixelFormat target_pixfmt) {
-    static int prev_w, prev_h;
+// sps_max_dec_pic_buffering_minus1 + 1 of the highest sub-layer, H.265
+//   7.3.2.2 and 7.3.3
+static mfxU16 ReadHevcDpbFrames(SpsBitReader &bits) {
+    bits.Skip(4); // sps_video_parameter_set_id
+    mfxU32 numSubLayers = bits.U(3) + 1;
+    bits.Skip(1); // sps_temporal_id_nesting_flag
+
+    // profile_tier_level(), general profile and level_idc
+    bits.Skip(96);
+    bool bSubProfile[8] = {};
+    bool bSubLevel[8]   = {};
+    for (mfxU32 i = 0; i + 1 < numSubLayers; i++) {
+        bSubProfile[i] = bits.U(1);
+        bSubLevel[i]   = bits.U(1);
+    }
+    if (numSubLayers > 1)
+        bits.Skip(2 * (9 - numSubLayers)); // reserved_zero_2bits
+    for (mfxU32 i = 0; i + 1 < numSubLayers; i++) {
+        if (bSubProfile[i])
+            bits.Skip(88);
+        if (bSubLevel[i])
+            bits.Skip(8);
+    }
+
+    bits.Ue(); // sps_seq_parameter_set_id
+    if (bits.Ue() == 3)
+        bits.Skip(1); // separate_colour_plane_flag
+    bits.Ue(); // pic_width_in_luma_samples
+    bits.Ue(); // pic_height_in_luma_samples
+    if (bits.U(1)) {
+        for (int i = 0; i < 4; i++)
+            bits.Ue(); // conf_win offsets
+    }
+    bits.Ue(); // bit_depth_luma_minus8
+    bits.Ue(); // bit_depth_chroma_minus8
+    bits.Ue(); // log2_max_pic_order_cnt_lsb_minus4
+
+    // given for every sub-layer or only for the highest one
+    mfxU32 dpbFrames = 0;
+    for (mfxU32 i = bits.U(1) ? 0 : numSubLayers - 1; i < numSubLayers; i++) {
+        dpbFrames = bits.Ue() + 1;
+        bits.Ue(); // sps_max_num_reorder_pics
+        bits.Ue(); // sps_max_latency_increase_plus1
+    }
+
+    if (bits.IsOverrun())
+        return 0;
+    return static_cast<mfxU16>(std::min(dpbFrames, 16u));
+}
 
-    if (!m_swsContext || (prev_w != avframe->width || prev_h != avframe->height)) {
-        if (m_swsContext)
-            sws_freeContext(m_swsContext);
-        m_swsContext = sws_getContext(m_avDecContext->width,
-                                      m_avDecContext->height,
-                                      m_avDecContext->pix_fmt,
-                                      m_avDecContext->width,
-                                      m_avDecContext->height,
-                                      target_pixfmt,
-                                      SWS_BILINEAR,
-                                      NULL,
-                                      NULL,
-                                      NULL);
-        if (!m_swsContext) {
-            return nullptr;
+// DPB size from the first SPS in an Annex B stream, 0 if there is none or
+//   it is cut short
+mfxU16 CpuDecode::ParseSpsDpbFrames(const uint8_t *data, size_t size) {
+    bool bHEVC        = (m_avDecCodec->id == AV_CODEC_ID_HEVC);
+    size_t headerSize = bHEVC ? 2 : 1;
+
+    size_t pos = 0;
+    while (pos + 3 <= size) {
+        if (data[pos] || data[pos + 1] || data[pos + 2] != 1) {
+            pos++;
+            continue;
         }
+
+        // the NAL unit runs up to the next start code or zero byte
+        size_t start = pos + 3;
+        size_t end   = start;
+        while (end + 3 <= size && (data[end] || data[end + 1] || data[end + 2] > 1))
+            end++;
+        if (end + 3 > size)
+            end = size;
+        pos = end;
+
+        if (end - start <= headerSize)
+            continue;
+        int type = bHEVC ? (data[start] >> 1) & 0x3F : data[start] & 0x1F;
+        if (type != (bHEVC ? 33 : 7))
+            continue;
+
+        SpsBitReader bits(data + start + headerSize, end - start - headerSize);
+        return bHEVC ? ReadHevcDpbFrames(bits) : ReadAvcDpbFrames(bits);
+    }
+
+    return 0;
+}
+
+// Output size requested with mfxExtDecVideoProcessing. Decoders that can
+//   reconstruct at 1/2, 1/4 or 1/8 size in the IDCT (MJPEG) get the
+//   smallest of them still covering the output, the rest of the way is
+//   scaled while copying into the output surface.
+mfxStatus CpuDecode::InitScale(mfxVideoParam *par) {
+    mfxExtDecVideoProcessing *decVpp = reinterpret_cast<mfxExtDecVideoProcessing *>(
+        FindExtBuffer(par, MFX_EXTBUFF_DEC_VIDEO_PROCESSING));
+    if (!decVpp)
+        return MFX_ERR_NONE;
+
+    mfxFrameInfo *info = &par->mfx.FrameInfo;
+    mfxU16 width       = info->CropW ? info->CropW : info->Width;
+    mfxU16 height      = info->CropH ? info->CropH : info->Height;
+
+    // the whole picture, scaled down into the output crop rectangle
+    RET_IF_FALSE(!decVpp->In.CropX && !decVpp->In.CropY, MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(!decVpp->In.CropW || decVpp->In.CropW == width, MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(!decVpp->In.CropH || decVpp->In.CropH == height, MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(decVpp->Out.CropW && decVpp->Out.CropW <= width, MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(decVpp->Out.CropH && decVpp->Out.CropH <= height, MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(decVpp->Out.CropX + decVpp->Out.CropW <= decVpp->Out.Width &&
+                     decVpp->Out.CropY + decVpp->Out.CropH <= decVpp->Out.Height,
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+
+    m_outScale = *decVpp;
+    switch (m_outScale.Out.FourCC) {
+        case 0:
+            m_outScale.Out.FourCC =
+                (info->FourCC == MFX_FOURCC_I010) ? MFX_FOURCC_I010 : MFX_FOURCC_I420;
+            break;
+        case MFX_FOURCC_I420:
+        case MFX_FOURCC_I010:
+            break;
+        default:
+            return MFX_ERR_INVALID_VIDEO_PARAM;
+    }
+
+    int lowres = 0;
+    if (m_avDecCodec->id == AV_CODEC_ID_MJPEG) {
+        while (lowres < m_avDecCodec->max_lowres && lowres < 3 &&
+               ((width + (2 << lowres) - 1) >> (lowres + 1)) >= decVpp->Out.CropW &&
+               ((height + (2 << lowres) - 1) >> (lowres + 1)) >= decVpp->Out.CropH)
+            lowres++;
     }
+    m_avDecContext->lowres = lowres;
+    m_bScale               = true;
 
-    int ret = sws_scale(m_swsContext,
+    return MFX_ERR_NONE;
+}
+
+// Scale and convert a decoded picture into the output crop rectangle of
+//   the surface, in one pass. Runs on the session worker.
+mfxStatus CpuDecode::ScaleFrame(mfxFrameSurface1 *surface, AVFrame *avframe) {
+    FrameLock locker;
+    RET_ERROR(locker.Lock(surface, MFX_MAP_WRITE, m_session->GetFrameAllocator()));
+    mfxFrameData *data = locker.GetData();
+
+    const auto &out         = m_outScale.Out;
+    bool bHighBitDepth      = (out.FourCC == MFX_FOURCC_I010);
+    AVPixelFormat dstFormat = bHighBitDepth ? AV_PIX_FMT_YUV420P10LE : AV_PIX_FMT_YUV420P;
+    if (m_avDecContext->codec_id == AV_CODEC_ID_MJPEG && !bHighBitDepth)
+        dstFormat = AV_PIX_FMT_YUVJ420P; // full range like unscaled output
+
+    m_scaleContext = sws_getCachedContext(m_scaleContext,
+                                          avframe->width,
+                                          avframe->height,
+                                          static_cast<AVPixelFormat>(avframe->format),
+                                          out.CropW,
+                                          out.CropH,
+                                          dstFormat,
+                                          SWS_BILINEAR,
+                                          NULL,
+                                          NULL,
+                                          NULL);
+    RET_IF_FALSE(m_scaleContext, MFX_ERR_MEMORY_ALLOC);
+
+    // chroma planes use half the pitch
+    int pitch        = (data->PitchHigh << 16) | data->PitchLow;
+    int bytes        = bHighBitDepth ? 2 : 1;
+    size_t luma      = out.CropY * pitch + out.CropX * bytes;
+    size_t chroma    = (out.CropY / 2) * (pitch / 2) + (out.CropX / 2) * bytes;
+    uint8_t *dst[4]  = { data->Y + luma, data->U + chroma, data->V + chroma, nullptr };
+    int dstStride[4] = { pitch, pitch / 2, pitch / 2, 0 };
+
+    int ret = sws_scale(m_scaleContext,
                         avframe->data,
                         avframe->linesize,
                         0,
                         avframe->height,
-                        avframe->data,
-                        avframe->linesize);
-    if (ret != avframe->height)
-        return nullptr;
-    else
-        avframe->format = target_pixfmt;
+                        dst,
+                        dstStride);
+    RET_IF_FALSE(ret == out.CropH, MFX_ERR_ABORTED);
+
+    mfxFrameInfo *info   = &surface->Info;
+    info->FourCC         = out.FourCC;
+    info->ChromaFormat   = MFX_CHROMAFORMAT_YUV420;
+    info->BitDepthLuma   = bHighBitDepth ? 10 : 8;
+    info->BitDepthChroma = bHighBitDepth ? 10 : 8;
+    info->CropX          = out.CropX;
+    info->CropY          = out.CropY;
+    info->CropW          = out.CropW;
+    info->CropH          = out.CropH;
+    info->PicStruct      = MFX_PICSTRUCT_PROGRESSIVE;
+
+    return MFX_ERR_NONE;
+}
+
+// MJPEG pictures are delivered as full range 4:2:0, signalled in
+//   mfxExtVideoSignalInfo and the frame's color_range. yuvj420p goes out as
+//   decoded, 4:2:2 and 4:4:4 chroma is halved in place. Grayscale gets
+//   neutral chroma, other layouts are converted with swscale, both into a
+//   new frame.
+mfxStatus CpuDecode::ConvertJPEGOutput(AVFrame **avframe) {
+    AVFrame *src = *avframe;
+    AVFrame *dst = nullptr;
+
+    bool bHalve = (src->format == AV_PIX_FMT_YUVJ422P || src->format == AV_PIX_FMT_YUVJ444P);
+
+    // the surfaces carry one pitch, halved chroma rows are placed half the
+    //   luma pitch apart, which fits in the planes the decoder allocated
+    int chromaPitch = src->linesize[0] / 2;
+    if (bHalve && chromaPitch <= src->linesize[1] && chromaPitch <= src->linesize[2] &&
+        av_frame_is_writable(src)) {
+        bool bHorizontal = (src->format == AV_PIX_FMT_YUVJ444P);
+        size_t width     = bHorizontal ? src->width : (src->width + 1) / 2;
+        for (int i = 1; i < 3; i++) {
+            CpuHalveChroma(src->data[i],
+                           src->linesize[i],
+                           chromaPitch,
+                           width,
+                           src->height,
+                           bHorizontal);
+            src->linesize[i] = chromaPitch;
+        }
+    }
+    else if (src->format != AV_PIX_FMT_YUVJ420P) {
+        dst = av_frame_alloc();
+        RET_IF_FALSE(dst, MFX_ERR_MEMORY_ALLOC);
+        dst->format = AV_PIX_FMT_YUVJ420P;
+        dst->width  = src->width;
+        dst->height = src->height;
+        if (av_frame_get_buffer(dst, 0) < 0 || av_frame_copy_props(dst, src) < 0) {
+            av_frame_free(&dst);
+            return MFX_ERR_MEMORY_ALLOC;
+        }
+    }
 
-    prev_w = avframe->width;
-    prev_h = avframe->height;
+    if (dst && src->format == AV_PIX_FMT_GRAY8) {
+        av_image_copy_plane(dst->data[0],
+                            dst->linesize[0],
+                            src->data[0],
+                            src->linesize[0],
+                            src->width,
+                            src->height);
+        for (int i = 1; i < 3; i++)
+            memset(dst->data[i], 128, (size_t)dst->linesize[i] * ((dst->height + 1) / 2));
+    }
+    else if (dst) {
+        // kept per decoder, pictures of a stream share their layout
+        m_swsContext = sws_getCachedContext(m_swsContext,
+                                            src->width,
+                                            src->height,
+                                            static_cast<AVPixelFormat>(src->format),
+                                            dst->width,
+                                            dst->height,
+                                            AV_PIX_FMT_YUVJ420P,
+                                            SWS_BILINEAR,
+                                            NULL,
+                                            NULL,
+                                            NULL);
+        if (!m_swsContext ||
+            sws_scale(m_swsContext,
+                      src->data,
+                      src->linesize,
+                      0,
+                      src->height,
+                      dst->data,
+                      dst->linesize) != dst->height) {
+            av_frame_free(&dst);
+            return MFX_ERR_ABORTED;
+        }
+    }
 
-    return avframe;
+    if (dst) {
+        av_frame_free(avframe);
+        *avframe = dst;
+    }
+
+    // the yuvj formats are deprecated, components downstream see I420
+    (*avframe)->format      = AV_PIX_FMT_YUV420P;
+    (*avframe)->color_range = AVCOL_RANGE_JPEG;
+    return MFX_ERR_NONE;
 }
 
 mfxStatus CpuDecode::DecodeQueryIOSurf(mfxVideoParam *par, mfxFrameAllocRequest *request) {
@@ -582,13 +1773,199 @@ mfxStatus CpuDecode::DecodeQueryIOSurf(mfxVideoParam *par, mfxFrameAllocRequest
         if (ValidateDecodeParams(par, false) < 0)
             return MFX_ERR_INVALID_VIDEO_PARAM;
 
-    request->NumFrameMin       = 1;
-    request->NumFrameSuggested = 3;
-    request->Type              = MFX_MEMTYPE_SYSTEM_MEMORY | MFX_MEMTYPE_FROM_DECODE;
+    // surfaces receive the scaled output
+    mfxExtDecVideoProcessing *decVpp =
+        par ? reinterpret_cast<mfxExtDecVideoProcessing *>(
+                  FindExtBuffer(par, MFX_EXTBUFF_DEC_VIDEO_PROCESSING))
+            : nullptr;
+    if (decVpp) {
+        request->Info.Width        = decVpp->Out.Width;
+        request->Info.Height       = decVpp->Out.Height;
+        request->Info.CropX        = decVpp->Out.CropX;
+        request->Info.CropY        = decVpp->Out.CropY;
+        request->Info.CropW        = decVpp->Out.CropW;
+        request->Info.CropH        = decVpp->Out.CropH;
+        request->Info.ChromaFormat = MFX_CHROMAFORMAT_YUV420;
+        if (decVpp->Out.FourCC)
+            request->Info.FourCC = decVpp->Out.FourCC;
+    }
+
+    request->Type = MFX_MEMTYPE_SYSTEM_MEMORY | MFX_MEMTYPE_FROM_DECODE;
+
+    // nothing is known about the stream before DecodeHeader, the pools grow
+    //   when more surfaces are needed
+    if (!par || (!par->mfx.MaxDecFrameBuffering &&
+                 (!par->mfx.FrameInfo.Width || !par->mfx.FrameInfo.Height))) {
+        request->NumFrameMin       = 1;
+        request->NumFrameSuggested = 3;
+        return MFX_ERR_NONE;
+    }
+
+    // DPB reported by DecodeHeader, otherwise the most the level and the
+    //   frame size allow
+    mfxU16 dpbFrames  = par->mfx.MaxDecFrameBuffering;
+    mfxU16 asyncDepth = par->AsyncDepth ? par->AsyncDepth : 1;
+    if (!dpbFrames)
+        dpbFrames = GetMaxDpbFrames(par->mfx.CodecId,
+                                    par->mfx.CodecLevel,
+                                    par->mfx.FrameInfo.Width,
+                                    par->mfx.FrameInfo.Height);
+
+    // the DPB and the frame being decoded, plus one per frame in flight
+    request->NumFrameMin       = dpbFrames + 1;
+    request->NumFrameSuggested = request->NumFrameMin + asyncDepth;
 
     return MFX_ERR_NONE;
 }
 
+// Most frames a stream of the given level and size can hold in its DPB, the
+//   highest level is assumed when the level is not known
+mfxU16 CpuDecode::GetMaxDpbFrames(mfxU32 codecId, mfxU16 level, mfxU16 width, mfxU16 height) {
+    mfxU32 frameMbs  = ((width + 15) / 16) * ((height + 15) / 16);
+    mfxU32 picSize   = static_cast<mfxU32>(width) * height;
+    mfxU32 maxDpbMbs = 0;
+    mfxU32 maxLumaPs = 0;
+
+    switch (codecId) {
+        case MFX_CODEC_AVC:
+            // MaxDpbMbs, H.264 table A-1
+            switch (level) {
+                case MFX_LEVEL_AVC_1:
+                case MFX_LEVEL_AVC_1b:
+                    maxDpbMbs = 396;
+                    break;
+                case MFX_LEVEL_AVC_11:
+                    maxDpbMbs = 900;
+                    break;
+                case MFX_LEVEL_AVC_12:
+                case MFX_LEVEL_AVC_13:
+                case MFX_LEVEL_AVC_2:
+                    maxDpbMbs = 2376;
+                    break;
+                case MFX_LEVEL_AVC_21:
+                    maxDpbMbs = 4752;
+                    break;
+                case MFX_LEVEL_AVC_22:
+                case MFX_LEVEL_AVC_3:
+                    maxDpbMbs = 8100;
+                    break;
+                case MFX_LEVEL_AVC_31:
+                    maxDpbMbs = 18000;
+                    break;
+                case MFX_LEVEL_AVC_32:
+                    maxDpbMbs = 20480;
+                    break;
+                case MFX_LEVEL_AVC_4:
+                case MFX_LEVEL_AVC_41:
+                    maxDpbMbs = 32768;
+                    break;
+                case MFX_LEVEL_AVC_42:
+                    maxDpbMbs = 34816;
+                    break;
+                case MFX_LEVEL_AVC_5:
+                    maxDpbMbs = 110400;
+                    break;
+                case MFX_LEVEL_AVC_51:
+                case MFX_LEVEL_AVC_52:
+                default:
+                    maxDpbMbs = 184320;
+                    break;
+            }
+
+            if (!frameMbs)
+                return 16;
+            return static_cast<mfxU16>(std::max(1u, std::min(maxDpbMbs / frameMbs, 16u)));
+
+        case MFX_CODEC_HEVC:
+            // MaxLumaPs, H.265 table A.8, scaled from maxDpbPicBuf = 6 (A.4.2)
+            switch (level) {
+                case MFX_LEVEL_HEVC_1:
+                    maxLumaPs = 36864;
+                    break;
+                case MFX_LEVEL_HEVC_2:
+                    maxLumaPs = 122880;
+                    break;
+                case MFX_LEVEL_HEVC_21:
+                    maxLumaPs = 245760;
+                    break;
+                case MFX_LEVEL_HEVC_3:
+                    maxLumaPs = 552960;
+                    break;
+                case MFX_LEVEL_HEVC_31:
+                    maxLumaPs = 983040;
+                    break;
+                case MFX_LEVEL_HEVC_4:
+                case MFX_LEVEL_HEVC_41:
+                    maxLumaPs = 2228224;
+                    break;
+                case MFX_LEVEL_HEVC_5:
+                case MFX_LEVEL_HEVC_51:
+                case MFX_LEVEL_HEVC_52:
+                    maxLumaPs = 8912896;
+                    break;
+                case MFX_LEVEL_HEVC_6:
+                case MFX_LEVEL_HEVC_61:
+                case MFX_LEVEL_HEVC_62:
+                default:
+                    maxLumaPs = 35651584;
+                    break;
+            }
+
+            if (picSize <= (maxLumaPs >> 2))
+                return 16;
+            if (picSize <= (maxLumaPs >> 1))
+                return 12;
+            if (picSize <= ((maxLumaPs * 3) >> 2))
+                return 8;
+            return 6;
+
+        case MFX_CODEC_AV1:
+            // reference frame slots
+            return 8;
+
+        case MFX_CODEC_MPEG2:
+            // forward and backward reference
+            return 2;
+
+        default:
+            // JPEG pictures stand alone
+            return 0;
+    }
+}
+
+// DPB of the stream being decoded, from its sequence header. The SPS read
+//   by ProbeHeader gives it exactly, otherwise it is what the level allows.
+mfxU16 CpuDecode::GetStreamDpbFrames(mfxVideoParam *par) {
+    mfxU16 width  = par->mfx.FrameInfo.Width;
+    mfxU16 height = par->mfx.FrameInfo.Height;
+
+    if (m_spsDpbFrames)
+        return m_spsDpbFrames;
+
+    switch (par->mfx.CodecId) {
+        case MFX_CODEC_AVC: {
+            mfxU16 maxFrames = GetMaxDpbFrames(MFX_CODEC_AVC, par->mfx.CodecLevel, width, height);
+
+            // reference frames of the SPS and the reordering delay found
+            //   by the decoder, once it has decoded frames
+            int frames = m_avDecContext->refs + m_avDecContext->has_b_frames;
+            if (m_avDecContext->refs > 0 && frames < maxFrames)
+                return static_cast<mfxU16>(frames);
+            return maxFrames;
+        }
+
+        case MFX_CODEC_HEVC:
+            // libav reports general_level_idc, 30 times the level
+            return GetMaxDpbFrames(MFX_CODEC_HEVC,
+                                   static_cast<mfxU16>(m_avDecContext->level / 3),
+                                   width,
+                                   height);
+
+        default:
+            return GetMaxDpbFrames(par->mfx.CodecId, 0, width, height);
+    }
+}
+
 mfxStatus CpuDecode::DecodeQuery(mfxVideoParam *in, mfxVideoParam *out) {
     mfxStatus sts = MFX_ERR_NONE;
 
@@ -637,8 +2014,33 @@ mfxStatus CpuDecode::GetDecodeSurface(mfxFrameSurface1 **surface) {
         mfxFrameAllocRequest DecRequest = { 0 };
         RET_ERROR(DecodeQueryIOSurf(&m_param, &DecRequest));
 
-        auto pool = std::make_unique<CpuFramePool>();
-        RET_ERROR(pool->Init(DecRequest.NumFrameSuggested));
+        auto pool = std::make_unique<CpuFramePool>(m_session->GetCpuSet());
+        if (m_bScale) {
+            // surfaces of the output size, the scaler writes into them
+            mfxFrameInfo info = m_param.mfx.FrameInfo;
+            info.FourCC       = m_outScale.Out.FourCC;
+            info.ChromaFormat = MFX_CHROMAFORMAT_YUV420;
+            info.Width        = m_outScale.Out.Width;
+            info.Height       = m_outScale.Out.Height;
+            info.CropX        = m_outScale.Out.CropX;
+            info.CropY        = m_outScale.Out.CropY;
+            info.CropW        = m_outScale.Out.CropW;
+            info.CropH        = m_outScale.Out.CropH;
+            RET_ERROR(pool->Init(info, DecRequest.NumFrameSuggested));
+        }
+        else if (CpuFramePool::UsesSharedMemory()) {
+            // surfaces of the picture size in shared memory, decoded
+            //   pictures are copied in so they can be exported
+            mfxFrameInfo info = m_param.mfx.FrameInfo;
+            if (info.CropW && info.CropH) {
+                info.Width  = info.CropW;
+                info.Height = info.CropH;
+            }
+            RET_ERROR(pool->Init(info, DecRequest.NumFrameSuggested));
+        }
+        else {
+            RET_ERROR(pool->Init(DecRequest.NumFrameSuggested));
+        }
         m_decSurfaces = std::move(pool);
     }
 
@@ -654,7 +2056,34 @@ mfxStatus CpuDecode::GetDecodeSurface(mfxFrameSurface1 **surface) {
     return sts;
 }
 
+void CpuDecode::AddMemoryStats(mfxCpuMemoryStats *stats) {
+    if (m_decSurfaces)
+        m_decSurfaces->AddMemoryStats(stats);
+
+    mfxFrameInfo *info = &m_param.mfx.FrameInfo;
+    size_t frameSize   = CpuFrame::GetBufferSize(info->FourCC, info->Width, info->Height);
+    mfxU16 dpb         = m_param.mfx.MaxDecFrameBuffering;
+    if (!dpb)
+        dpb = GetMaxDpbFrames(m_param.mfx.CodecId,
+                              m_param.mfx.CodecLevel,
+                              info->Width,
+                              info->Height);
+
+    // the picture being decoded, plus one more per extra frame thread
+    size_t numFrames = dpb + 1;
+    if (m_avDecContext && (m_avDecContext->active_thread_type & FF_THREAD_FRAME) &&
+        m_codecThreads > 1)
+        numFrames += m_codecThreads - 1;
+
+    stats->CodecBytes += numFrames * frameSize;
+    stats->BitstreamBytes += m_queuedBytes;
+}
+
 mfxStatus CpuDecode::GetVideoParam(mfxVideoParam *par) {
+    // stream info is updated by queued decode tasks
+    if (m_lastTask)
+        m_session->GetScheduler()->WaitAll();
+
     par->mfx       = m_param.mfx;
     par->IOPattern = m_param.IOPattern;
 
@@ -680,13 +2109,19 @@ mfxStatus CpuDecode::GetVideoParam(mfxVideoParam *par) {
     par->mfx.CodecId = AVCodecID_to_MFXCodecId(m_avDecCodec->id);
 
     // resolution
-    par->mfx.FrameInfo.Width  = (uint16_t)m_avDecContext->width;
-    par->mfx.FrameInfo.Height = (uint16_t)m_avDecContext->height;
-    par->mfx.FrameInfo.CropW  = (uint16_t)m_avDecContext->width;
-    par->mfx.FrameInfo.CropH  = (uint16_t)m_avDecContext->height;
-
-    // FourCC and chroma format
-    switch (m_avDecContext->pix_fmt) {
+    int width  = 0;
+    int height = 0;
+    GetStreamSize(&width, &height);
+    par->mfx.FrameInfo.Width  = (uint16_t)width;
+    par->mfx.FrameInfo.Height = (uint16_t)height;
+    par->mfx.FrameInfo.CropW  = (uint16_t)width;
+    par->mfx.FrameInfo.CropH  = (uint16_t)height;
+
+    // FourCC and chroma format, MJPEG output is converted to 4:2:0
+    AVPixelFormat format = m_avDecContext->pix_fmt;
+    if (m_avDecCodec->id == AV_CODEC_ID_MJPEG)
+        format = AV_PIX_FMT_YUVJ420P;
+    switch (format) {
         case AV_PIX_FMT_YUV420P10LE:
             par->mfx.FrameInfo.FourCC         = MFX_FOURCC_I010;
             par->mfx.FrameInfo.BitDepthLuma   = 10;
@@ -733,6 +2168,23 @@ mfxStatus CpuDecode::GetVideoParam(mfxVideoParam *par) {
         par->mfx.FrameInfo.AspectRatioH = (uint16_t)m_avDecContext->sample_aspect_ratio.den;
     }
 
+    // Range and colour description, MJPEG output is full range
+    mfxExtVideoSignalInfo *signal = reinterpret_cast<mfxExtVideoSignalInfo *>(
+        FindExtBuffer(par, MFX_EXTBUFF_VIDEO_SIGNAL_INFO));
+    if (signal) {
+        bool bDescribed = m_avDecContext->color_primaries != AVCOL_PRI_UNSPECIFIED ||
+                          m_avDecContext->color_trc != AVCOL_TRC_UNSPECIFIED ||
+                          m_avDecContext->colorspace != AVCOL_SPC_UNSPECIFIED;
+
+        signal->VideoFormat    = 5; // unspecified
+        signal->VideoFullRange = (m_avDecContext->color_range == AVCOL_RANGE_JPEG ||
+                                  m_avDecCodec->id == AV_CODEC_ID_MJPEG);
+        signal->ColourDescriptionPresent = bDescribed;
+        signal->ColourPrimaries          = (mfxU16)m_avDecContext->color_primaries;
+        signal->TransferCharacteristics  = (mfxU16)m_avDecContext->color_trc;
+        signal->MatrixCoefficients       = (mfxU16)m_avDecContext->colorspace;
+    }
+
     // Profile/Level
     int profile = m_avDecContext->profile;
     int level   = m_avDecContext->level;
@@ -787,6 +2239,10 @@ mfxStatus CpuDecode::GetVideoParam(mfxVideoParam *par) {
             return MFX_ERR_NONE;
     }
 
+    // surfaces the stream needs, kept if the decoder was initialized with it
+    if (!par->mfx.MaxDecFrameBuffering)
+        par->mfx.MaxDecFrameBuffering = GetStreamDpbFrames(par);
+
     par->IOPattern = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
     return MFX_ERR_NONE;
 }
@@ -807,7 +2263,7 @@ mfxStatus CpuDecode::CheckVideoParamDecoders(mfxVideoParam *in) {
     if (in->mfx.DecodedOrder)
         return MFX_ERR_UNSUPPORTED;
 
-    if (in->NumExtParam)
+    if (!HasSupportedExtBuffers(in))
         return MFX_ERR_INVALID_VIDEO_PARAM;
 
     return MFX_ERR_NONE;
@@ -7,8 +7,13 @@
 #ifndef CPU_SRC_CPU_DECODE_H_
 #define CPU_SRC_CPU_DECODE_H_
 
+#include <atomic>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
 #include "src/cpu_common.h"
+#include "src/cpu_deadline.h"
 #include "src/cpu_frame_pool.h"
 
 class CpuWorkstream;
@@ -24,31 +29,142 @@ public:
     mfxStatus InitDecode(mfxVideoParam *par, mfxBitstream *bs);
     mfxStatus DecodeFrame(mfxBitstream *bs,
                           mfxFrameSurface1 *surface_work,
-                          mfxFrameSurface1 **surface_out);
+                          mfxFrameSurface1 **surface_out,
+                          mfxSyncPoint *syncp);
     mfxStatus GetVideoParam(mfxVideoParam *par);
+    mfxStatus GetDecodeStat(mfxDecodeStat *stat);
     mfxStatus GetDecodeSurface(mfxFrameSurface1 **surface);
 
+    // steps the skip level up or down, NOSKIP goes back to level 0, takes
+    //   effect with the next queued access unit. At the highest level only
+    //   keyframes are decoded, each output surface carries the TimeStamp
+    //   of the bitstream its keyframe came from
+    mfxStatus SetSkipMode(mfxSkipMode mode);
+
+    // decoded pictures live in buffers libavcodec allocates, they are
+    //   counted as codec memory from the stream's DPB size
+    void AddMemoryStats(mfxCpuMemoryStats *stats);
+
     mfxStatus CheckVideoParamDecoders(mfxVideoParam *in);
     mfxStatus IsSameVideoParam(mfxVideoParam *newPar, mfxVideoParam *oldPar);
 
 private:
+    // decoder output waiting for a work surface, frame is null if the
+    //   access unit was corrupted
+    struct DecodedFrame {
+        AVFrame *frame;
+        bool corrupted;
+        AVRational framerate;
+    };
+
+    // stream fields the parser found, handed to the decoder context on the
+    //   worker where the decoder does not report them itself
+    struct ParsedFields {
+        AVRational framerate;
+        int profile;
+        int level;
+    };
+
+    // application surface lent to libavcodec as a picture buffer, one
+    //   reference per plane buffer
+    struct LentSurface {
+        CpuDecode *decoder;
+        mfxFrameSurface1 *surface;
+        std::atomic<int> planes;
+    };
+
     static mfxStatus ValidateDecodeParams(mfxVideoParam *par, bool canCorrect);
-    AVFrame *ConvertJPEGOutputColorSpace(AVFrame *avframe, AVPixelFormat target_pixfmt);
+    static mfxU16 GetMaxDpbFrames(mfxU32 codecId, mfxU16 level, mfxU16 width, mfxU16 height);
+    mfxU16 GetStreamDpbFrames(mfxVideoParam *par);
+    static int GetBuffer(AVCodecContext *ctx, AVFrame *frame, int flags);
+    static void ReturnBuffer(void *opaque, uint8_t *data);
+    bool FitsFrame(mfxFrameSurface1 *surface, int format, int width, int height);
+    void OfferSurface(mfxFrameSurface1 *surface);
+    mfxFrameSurface1 *LendSurface(AVFrame *frame);
+    void ReturnLentSurface(mfxFrameSurface1 *surface);
+    bool IsLent(mfxFrameSurface1 *surface);
+    void TakeBackOfferedSurfaces();
+    void UnlockReturnedSurfaces();
+    mfxFrameSurface1 *FindLentSurface(AVFrame *avframe);
+    mfxStatus ParsePacket(mfxBitstream *bs, AVPacket **packet);
+    mfxStatus QueueDecode(AVPacket *packet);
+    ParsedFields GetParsedFields();
+    void ApplyParsedFields(const ParsedFields &fields);
+    bool IsKeyPacket(bool bComplete);
+    void ApplySkipLevel(int level, bool bLate);
+    mfxStatus DecodePacket(AVPacket *packet);
+    mfxStatus UpdateStreamInfo(AVFrame *avframe);
+    mfxStatus UpdateAV1Info();
+    bool HasDecodedFrame();
+    mfxStatus OutputFrame(mfxFrameSurface1 *surface_work,
+                          mfxFrameSurface1 **surface_out,
+                          mfxSyncPoint *syncp);
+    mfxStatus ProbeStream(mfxBitstream *bs);
+    mfxStatus ProbeHeader(mfxBitstream *bs);
+    mfxStatus ParseJPEGHeader(const uint8_t *data, size_t size);
+    mfxU16 ParseSpsDpbFrames(const uint8_t *data, size_t size);
+    mfxStatus InitScale(mfxVideoParam *par);
+    mfxStatus ScaleFrame(mfxFrameSurface1 *surface, AVFrame *avframe);
+    void GetStreamSize(int *width, int *height);
+    mfxStatus ConvertJPEGOutput(AVFrame **avframe);
     const AVCodec *m_avDecCodec;
     AVCodecContext *m_avDecContext;
     AVCodecParserContext *m_avDecParser;
+    // written by the parser on the calling thread, the decoder context is
+    //   used by decode tasks on the worker at the same time
+    AVCodecContext *m_avParserContext;
+    // reads the headers of complete frames while waiting for a keyframe,
+    //   kept apart so the stream parser's state is untouched
+    AVCodecParserContext *m_avKeyParser;
+    AVCodecContext *m_avKeyParserContext;
     AVPacket *m_avDecPacket;
-    AVFrame *m_avDecFrameOut;
+    int m_codecThreads;
     struct SwsContext *m_swsContext;
 
+    // output size and layout asked for with mfxExtDecVideoProcessing
+    mfxExtDecVideoProcessing m_outScale;
+    bool m_bScale;
+    struct SwsContext *m_scaleContext;
+
     mfxVideoParam m_param;
     std::unique_ptr<CpuFramePool> m_decSurfaces;
-    bool m_bFrameBuffered;
-    bool m_bStreamInfo;
+
+    // filled by decode tasks on the session worker
+    std::deque<DecodedFrame> m_decFrames;
+    std::mutex m_decFramesMutex;
+    std::deque<mfxSyncPoint> m_decTasks;
+    mfxSyncPoint m_lastTask;
+
+    // application work surfaces offered to the decoder, locked while
+    //   offered or lent, lent ones by their plane 0 buffer. Surfaces libav
+    //   gives back wait in m_returned, Data.Locked is only changed on the
+    //   calling thread.
+    std::deque<mfxFrameSurface1 *> m_offered;
+    std::map<uint8_t *, mfxFrameSurface1 *> m_lent;
+    std::vector<mfxFrameSurface1 *> m_returned;
+    std::mutex m_lendMutex;
 
     CpuWorkstream *m_session;
 
     mfxU32 m_frameOrder;
+    mfxU32 m_numError;
+
+    // DPB size from the SPS read by ProbeHeader, 0 if there was none
+    mfxU16 m_spsDpbFrames;
+
+    // non-reference frames are skipped while late, the decoder does not
+    //   report skips so they are counted as packets without a frame
+    CpuDeadline m_deadline;
+    std::atomic<mfxU32> m_numSkipPackets;
+    std::atomic<mfxU32> m_numSkipFrames;
+
+    // level set with SetSkipMode, applied by the decode tasks, packets up
+    //   to the next keyframe are dropped while m_bWaitKey is set
+    std::atomic<int> m_skipLevel;
+    std::atomic<bool> m_bWaitKey;
+
+    // bytes of packets queued for the decode tasks
+    std::atomic<size_t> m_queuedBytes;
 
     /* copy not allowed */
     CpuDecode(const CpuDecode &);
@@ -117,12 +117,19 @@ mfxStatus CpuDecodeVPP::DecodeVPPFrame(mfxBitstream *bs,
     // m_surfOut[0]   : surface for decode out
     // m_surfOut[1] ~ : surfaces for vpp out
     for (mfxU32 i = 0; i < m_numVPPCh; i++) {
-        m_cpuVPP[i].GetVPPSurfaceOut(&m_surfOut[i + 1]);
+        mfxStatus sts = m_cpuVPP[i].GetVPPSurfaceOut(&m_surfOut[i + 1]);
+        if (sts != MFX_ERR_NONE) {
+            // a bounded pool is exhausted, give back what was taken
+            for (mfxU32 j = 0; j < i; j++)
+                m_surfOut[j + 1]->FrameInterface->Release(m_surfOut[j + 1]);
+            return sts;
+        }
     }
 
     // decode out from 0th channel
     RET_ERROR(
         MFXVideoDECODE_DecodeFrameAsync(m_mfxsession, bs, pWorkSurface, &m_surfOut[0], &syncp));
+    RET_ERROR(MFXVideoCORE_SyncOperation(m_mfxsession, syncp, MFX_INFINITE));
 
     //output DEC
     RAIISurfaceArray surfArray;
@@ -181,6 +188,14 @@ mfxU32 CpuDecodeVPP::GetVPPChannelCount(void) {
     return m_numVPPCh;
 }
 
+void CpuDecodeVPP::AddMemoryStats(mfxCpuMemoryStats *stats) {
+    if (!m_cpuVPP)
+        return;
+
+    for (mfxU32 i = 0; i < m_numVPPCh; i++)
+        m_cpuVPP[i].AddMemoryStats(stats);
+}
+
 mfxStatus CpuDecodeVPP::GetChannelParam(mfxVideoChannelParam *par, mfxU32 channel_id) {
     bool bfound = false;
 
@@ -178,6 +178,9 @@ public:
                                       mfxVideoChannelParam *oldChPar);
     mfxStatus Close();
 
+    // memory of the VPP channels, the decoder is the session's
+    void AddMemoryStats(mfxCpuMemoryStats *stats);
+
 private:
     CpuVPP *m_cpuVPP;
     mfxVideoChannelParam **m_vppChParams;
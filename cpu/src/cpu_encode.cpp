@@ -5,8 +5,10 @@
   ############################################################################*/
 
 #include "src/cpu_encode.h"
+#include <algorithm>
 #include <memory>
 #include <sstream>
+#include "src/cpu_threads.h"
 #include "src/cpu_workstream.h"
 
 // used for setting default value of mfx.BufferSizeInKB if not otherwise specified
@@ -23,7 +25,14 @@ CpuEncode::CpuEncode(CpuWorkstream *session)
           m_avEncCodec(nullptr),
           m_avEncContext(nullptr),
           m_avEncPacket(nullptr),
-          m_input_locker(),
+          m_codecThreads(0),
+          m_encPackets(),
+          m_encPacketsMutex(),
+          m_encTasks(),
+          m_deadline(),
+          m_numFramesIn(0),
+          m_numFramesOut(0),
+          m_numBits(0),
           m_param({}),
           m_bFrameEncoded(false),
           m_session(session),
@@ -33,23 +42,28 @@ CpuEncode::CpuEncode(CpuWorkstream *session)
           m_numExtSupported(0) {}
 
 CpuEncode::~CpuEncode() {
+    // queued frames reference this encoder
+    m_session->GetScheduler()->WaitAll();
+
     if (m_bFrameEncoded) {
         // drain encoder - workaround for encoder hang on avcodec_close
-        mfxBitstream bs{};
-        mfxStatus sts;
-        do {
-            sts = EncodeFrame(nullptr, nullptr, &bs);
-        } while (sts == MFX_ERR_NOT_ENOUGH_BUFFER || sts == MFX_ERR_NONE);
-
+        SendFrame(nullptr);
         m_bFrameEncoded = false;
     }
 
+    for (AVPacket *packet : m_encPackets)
+        av_packet_free(&packet);
+    m_encPackets.clear();
+
     if (m_avEncContext) {
         avcodec_close(m_avEncContext);
         avcodec_free_context(&m_avEncContext);
         m_avEncContext = nullptr;
     }
 
+    if (m_codecThreads)
+        CpuThreadBudget::Release(m_codecThreads);
+
     if (m_avEncPacket) {
         av_packet_free(&m_avEncPacket);
         m_avEncPacket = nullptr;
@@ -90,8 +104,6 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
             par->mfx.LowPower = 0; //not supported
         if (par->mfx.BRCParamMultiplier)
             par->mfx.BRCParamMultiplier = 0; //not supported
-        if (par->mfx.NumThread)
-            par->mfx.NumThread = 0; //not supported
 #ifdef ENABLE_ENCODER_OPENH264
         if (par->mfx.TargetUsage)
             par->mfx.TargetUsage = 0; // not supportd
@@ -125,8 +137,6 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
             return MFX_ERR_INVALID_VIDEO_PARAM;
         if (par->mfx.BRCParamMultiplier)
             return MFX_ERR_INVALID_VIDEO_PARAM;
-        if (par->mfx.NumThread)
-            return MFX_ERR_INVALID_VIDEO_PARAM;
 
         //only GOP_CLOSED flag is supported in the CPU reference implementation
         if (par->mfx.GopOptFlag != 0 && par->mfx.GopOptFlag != MFX_GOP_CLOSED)
@@ -721,11 +731,22 @@ mfxStatus CpuEncode::InitEncode(mfxVideoParam *par) {
     }
 
 #ifdef ENABLE_LIBAV_AUTO_THREADS
-    m_avEncContext->thread_count = 0;
+    // threads asked for by the stream or the session, otherwise a share of
+    //   the process-wide budget instead of one thread per core
+    m_codecThreads = CpuThreadBudget::Acquire(par->mfx.NumThread ? par->mfx.NumThread
+                                                                 : m_session->GetNumThread());
+    m_avEncContext->thread_count = m_codecThreads;
+
+    // each frame thread adds a frame of delay, low latency streams use slice threads
+    if (par->AsyncDepth == 1)
+        m_avEncContext->thread_type = FF_THREAD_SLICE;
 #endif
 
+    // frame threads started here stay on the session's CPUs and priority
     int err = 0;
-    err     = avcodec_open2(m_avEncContext, m_avEncCodec, NULL);
+    m_session->RunPlaced([&]() {
+        err = avcodec_open2(m_avEncContext, m_avEncCodec, NULL);
+    });
     RET_IF_FALSE(err == 0, MFX_ERR_INVALID_VIDEO_PARAM);
 
     if (!m_param.mfx.BufferSizeInKB) {
@@ -733,6 +754,8 @@ mfxStatus CpuEncode::InitEncode(mfxVideoParam *par) {
         m_param.mfx.BufferSizeInKB = DEF_BUFFER_SIZE_MULT * m_param.mfx.TargetKbps;
     }
 
+    m_deadline.Init(m_param.mfx.FrameInfo, m_param.AsyncDepth);
+
     return valSts;
 }
 
@@ -1459,9 +1482,16 @@ mfxStatus CpuEncode::GetAV1Params(mfxVideoParam *par) {
     return MFX_ERR_NONE;
 }
 
-mfxStatus CpuEncode::EncodeFrame(mfxFrameSurface1 *surface, mfxEncodeCtrl *ctrl, mfxBitstream *bs) {
+// EncodeFrame queues the frame (surface == nullptr drains the encoder)
+//   on the session worker and returns an encoded packet if one is ready.
+//   With AsyncDepth set, up to AsyncDepth frames are in flight, the
+//   bitstream returned by a call may therefore belong to an earlier frame
+//   and MFX_WRN_DEVICE_BUSY is returned while all of them are encoding.
+mfxStatus CpuEncode::EncodeFrame(mfxFrameSurface1 *surface,
+                                 mfxEncodeCtrl *ctrl,
+                                 mfxBitstream *bs,
+                                 mfxSyncPoint *syncp) {
     RET_IF_FALSE(m_avEncContext, MFX_ERR_NOT_INITIALIZED);
-    int err;
 
     // check mfxEncodeCtrl
     // none of these features are implemented so function returns invalid param
@@ -1480,10 +1510,29 @@ mfxStatus CpuEncode::EncodeFrame(mfxFrameSurface1 *surface, mfxEncodeCtrl *ctrl,
             return MFX_ERR_INVALID_VIDEO_PARAM;
     }
 
-    // encode one frame
+    CpuScheduler *scheduler = m_session->GetScheduler();
+    mfxSyncPoint taskSyncp  = nullptr;
+    bool bPipelined         = (surface && m_param.AsyncDepth);
+
+    if (bPipelined) {
+        // the frame is not taken if all AsyncDepth slots are busy
+        mfxStatus sts = scheduler->Throttle(&m_encTasks, m_param.AsyncDepth, false);
+        if (sts != MFX_ERR_NONE)
+            return sts;
+
+        // a late session gives up the frame, packets still queued are
+        //   returned by the next calls
+        if (m_deadline.ShouldDrop(m_encTasks.size()))
+            return MFX_ERR_MORE_DATA;
+    }
+
     if (surface) {
+        CpuDeadline::Clock::time_point deadline = m_deadline.Arrive();
+
+        // input stays locked until the encoder has taken its own copy
+        std::shared_ptr<FrameLock> locker = std::make_shared<FrameLock>();
         AVFrame *av_frame =
-            m_input_locker.GetAVFrame(surface, MFX_MAP_READ, m_session->GetFrameAllocator());
+            locker->GetAVFrame(surface, MFX_MAP_READ, m_session->GetFrameAllocator());
         RET_IF_FALSE(av_frame, MFX_ERR_ABORTED);
 
         if (m_param.mfx.CodecId == MFX_CODEC_JPEG) {
@@ -1494,8 +1543,66 @@ mfxStatus CpuEncode::EncodeFrame(mfxFrameSurface1 *surface, mfxEncodeCtrl *ctrl,
         if (surface->Data.TimeStamp && (surface->Data.TimeStamp != static_cast<mfxU64>(-1)))
             av_frame->pts = static_cast<int64_t>(surface->Data.TimeStamp);
 
+        HoldSurface(surface);
+        mfxStatus submitSts = m_session->Submit(
+            [this, surface, locker, av_frame, deadline]() {
+                mfxStatus sts = SendFrame(av_frame);
+                locker->Unlock();
+                ReleaseSurface(surface);
+                m_deadline.Complete(deadline);
+                return sts;
+            },
+            &taskSyncp,
+            CPU_STAGE_ENCODE,
+            surface);
+        if (submitSts != MFX_ERR_NONE) {
+            ReleaseSurface(surface);
+            return submitSts;
+        }
+        m_numFramesIn++;
+    }
+    else {
+        RET_ERROR(m_session->Submit(
+            [this]() {
+                return SendFrame(nullptr);
+            },
+            &taskSyncp,
+            CPU_STAGE_ENCODE));
+    }
+    m_encTasks.push_back(taskSyncp);
+
+    // draining waits for all frames in flight
+    if (!bPipelined)
+        RET_ERROR(scheduler->Throttle(&m_encTasks, 1, true));
+
+    // get encoded packet, if available
+    AVPacket *packet = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_encPacketsMutex);
+        if (!m_encPackets.empty())
+            packet = m_encPackets.front();
+    }
+    RET_IF_FALSE(packet, MFX_ERR_MORE_DATA);
+
+    RET_ERROR(WritePacket(packet, bs));
+
+    {
+        std::lock_guard<std::mutex> lock(m_encPacketsMutex);
+        m_encPackets.pop_front();
+    }
+    av_packet_free(&packet);
+
+    *syncp = taskSyncp;
+
+    return MFX_ERR_NONE;
+}
+
+// runs on the session worker - frame == nullptr drains the encoder
+mfxStatus CpuEncode::SendFrame(AVFrame *av_frame) {
+    int err;
+
+    if (av_frame) {
         err = avcodec_send_frame(m_avEncContext, av_frame);
-        m_input_locker.Unlock();
         RET_IF_FALSE(err >= 0, MFX_ERR_ABORTED);
     }
     else {
@@ -1504,103 +1611,113 @@ mfxStatus CpuEncode::EncodeFrame(mfxFrameSurface1 *surface, mfxEncodeCtrl *ctrl,
         RET_IF_FALSE(err == 0 || err == AVERROR_EOF, MFX_ERR_UNKNOWN);
     }
 
-    // get encoded packet, if available
+    // collect every packet the encoder has ready
+    for (;;) {
+        err = avcodec_receive_packet(m_avEncContext, m_avEncPacket);
+        if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
+            // need more data - nothing to do
+            break;
+        }
+        else if (err != 0) {
+            // other error
+            RET_ERROR(MFX_ERR_UNDEFINED_BEHAVIOR);
+        }
+
+        AVPacket *packet = av_packet_alloc();
+        if (!packet) {
+            av_packet_unref(m_avEncPacket);
+            return MFX_ERR_MEMORY_ALLOC;
+        }
+        av_packet_move_ref(packet, m_avEncPacket);
+
+        std::lock_guard<std::mutex> lock(m_encPacketsMutex);
+        m_encPackets.push_back(packet);
+        m_bFrameEncoded = true;
+    }
+
+    return MFX_ERR_NONE;
+}
+
+// copy encoded data to output buffer, the packet is left untouched on error
+mfxStatus CpuEncode::WritePacket(AVPacket *packet, mfxBitstream *bs) {
     mfxU32 nBytesOut = 0, nBytesAvail = 0;
 
-    err = avcodec_receive_packet(m_avEncContext, m_avEncPacket);
-    if (err == AVERROR(EAGAIN)) {
-        // need more data - nothing to do
-        RET_ERROR(MFX_ERR_MORE_DATA);
+    // copy encoded data to output buffer
+    if (m_bWriteIVFHeaders == true) {
+        if (m_cfgIVF.frame_count ==
+            0) // add the stream header and the frame header for the 1st frame
+            nBytesOut = IVF_STREAM_HEADER_SIZE + IVF_FRAME_HEADER_SIZE + packet->size;
+        else // add the frame header only from 2nd frame
+            nBytesOut = IVF_FRAME_HEADER_SIZE + packet->size;
     }
-    else if (err == AVERROR_EOF) {
-        RET_ERROR(MFX_ERR_MORE_DATA);
+    else {
+        nBytesOut = packet->size;
     }
-    else if (err != 0) {
-        // other error
-        RET_ERROR(MFX_ERR_UNDEFINED_BEHAVIOR);
+    nBytesAvail = bs->MaxLength - (bs->DataLength + bs->DataOffset);
+
+    if (nBytesOut > nBytesAvail) {
+        //error if encoded bytes out is larger than provided output buffer size
+        return MFX_ERR_NOT_ENOUGH_BUFFER;
     }
-    else {
-        if (!m_bFrameEncoded)
-            m_bFrameEncoded = true;
-
-        // copy encoded data to output buffer
-        if (m_bWriteIVFHeaders == true) {
-            if (m_cfgIVF.frame_count ==
-                0) // add the stream header and the frame header for the 1st frame
-                nBytesOut = IVF_STREAM_HEADER_SIZE + IVF_FRAME_HEADER_SIZE + m_avEncPacket->size;
-            else // add the frame header only from 2nd frame
-                nBytesOut = IVF_FRAME_HEADER_SIZE + m_avEncPacket->size;
-        }
-        else {
-            nBytesOut = m_avEncPacket->size;
-        }
-        nBytesAvail = bs->MaxLength - (bs->DataLength + bs->DataOffset);
 
-        if (nBytesOut > nBytesAvail) {
-            //error if encoded bytes out is larger than provided output buffer size
-            return MFX_ERR_NOT_ENOUGH_BUFFER;
+    // only available for av1, otherwise it is 0 always
+    mfxU32 nHeaderSize = 0;
+    if (m_bWriteIVFHeaders == true) {
+        ++m_cfgIVF.frame_count;
+
+        if (m_cfgIVF.frame_count == 1) {
+            m_cfgIVF.input_padded_width     = (m_param.mfx.FrameInfo.CropW)
+                                                  ? m_param.mfx.FrameInfo.CropW
+                                                  : m_param.mfx.FrameInfo.Width;
+            m_cfgIVF.input_padded_height    = (m_param.mfx.FrameInfo.CropH)
+                                                  ? m_param.mfx.FrameInfo.CropH
+                                                  : m_param.mfx.FrameInfo.Height;
+            m_cfgIVF.frame_rate_numerator   = m_param.mfx.FrameInfo.FrameRateExtN;
+            m_cfgIVF.frame_rate_denominator = m_param.mfx.FrameInfo.FrameRateExtD;
+
+            WriteIVFStreamHeader(&m_cfgIVF, bs->Data + bs->DataOffset, nBytesAvail);
+
+            nHeaderSize = IVF_STREAM_HEADER_SIZE;
+            nBytesAvail -= IVF_STREAM_HEADER_SIZE;
         }
 
-        // only available for av1, otherwise it is 0 always
-        mfxU32 nHeaderSize = 0;
-        if (m_bWriteIVFHeaders == true) {
-            ++m_cfgIVF.frame_count;
-
-            if (m_cfgIVF.frame_count == 1) {
-                m_cfgIVF.input_padded_width     = (m_param.mfx.FrameInfo.CropW)
-                                                      ? m_param.mfx.FrameInfo.CropW
-                                                      : m_param.mfx.FrameInfo.Width;
-                m_cfgIVF.input_padded_height    = (m_param.mfx.FrameInfo.CropH)
-                                                      ? m_param.mfx.FrameInfo.CropH
-                                                      : m_param.mfx.FrameInfo.Height;
-                m_cfgIVF.frame_rate_numerator   = m_param.mfx.FrameInfo.FrameRateExtN;
-                m_cfgIVF.frame_rate_denominator = m_param.mfx.FrameInfo.FrameRateExtD;
-
-                WriteIVFStreamHeader(&m_cfgIVF, bs->Data + bs->DataOffset, nBytesAvail);
-
-                nHeaderSize = IVF_STREAM_HEADER_SIZE;
-                nBytesAvail -= IVF_STREAM_HEADER_SIZE;
-            }
+        WriteIVFFrameHeader(&m_cfgIVF,
+                            bs->Data + bs->DataOffset + nHeaderSize,
+                            nBytesAvail,
+                            packet->size);
 
-            WriteIVFFrameHeader(&m_cfgIVF,
-                                bs->Data + bs->DataOffset + nHeaderSize,
-                                nBytesAvail,
-                                m_avEncPacket->size);
+        nHeaderSize += IVF_FRAME_HEADER_SIZE;
+        nBytesAvail -= IVF_FRAME_HEADER_SIZE;
+    }
 
-            nHeaderSize += IVF_FRAME_HEADER_SIZE;
-            nBytesAvail -= IVF_FRAME_HEADER_SIZE;
-        }
+    memcpy_s(bs->Data + bs->DataOffset + nHeaderSize, nBytesAvail, packet->data, packet->size);
 
-        memcpy_s(bs->Data + bs->DataOffset + nHeaderSize,
-                 nBytesAvail,
-                 m_avEncPacket->data,
-                 m_avEncPacket->size);
-
-        bs->DataLength += nBytesOut;
-        // TO DO - convert to 90khz timestamps (read m_avEncPacket->pts, ->dts)
-        // Note dts may start at < 0, should +=1 each frame
-        bs->TimeStamp       = m_avEncPacket->pts;
-        bs->DecodeTimeStamp = MFX_TIMESTAMP_UNKNOWN;
-        bs->CodecId         = m_param.mfx.CodecId;
-        bs->PicStruct       = MFX_PICSTRUCT_PROGRESSIVE;
-
-        // TO DO - verify logic across codecs - may require parsing
-        //   output packets to get correct mapping of frame types
-        bs->FrameType = MFX_FRAMETYPE_UNKNOWN;
-        if (m_avEncPacket->flags & AV_PKT_FLAG_KEY) {
-            bs->FrameType = MFX_FRAMETYPE_I;
-            bs->FrameType |= MFX_FRAMETYPE_REF;
-        }
-        else if (m_avEncPacket->flags & AV_PKT_FLAG_DISPOSABLE) {
-            bs->FrameType = MFX_FRAMETYPE_B;
-        }
-        else {
-            bs->FrameType = MFX_FRAMETYPE_P;
-            bs->FrameType |= MFX_FRAMETYPE_REF;
-        }
-    }
+    bs->DataLength += nBytesOut;
+
+    m_numFramesOut++;
+    m_numBits += static_cast<mfxU64>(nBytesOut) * 8;
 
-    av_packet_unref(m_avEncPacket);
+    // TO DO - convert to 90khz timestamps (read packet->pts, ->dts)
+    // Note dts may start at < 0, should +=1 each frame
+    bs->TimeStamp       = packet->pts;
+    bs->DecodeTimeStamp = MFX_TIMESTAMP_UNKNOWN;
+    bs->CodecId         = m_param.mfx.CodecId;
+    bs->PicStruct       = MFX_PICSTRUCT_PROGRESSIVE;
+
+    // TO DO - verify logic across codecs - may require parsing
+    //   output packets to get correct mapping of frame types
+    bs->FrameType = MFX_FRAMETYPE_UNKNOWN;
+    if (packet->flags & AV_PKT_FLAG_KEY) {
+        bs->FrameType = MFX_FRAMETYPE_I;
+        bs->FrameType |= MFX_FRAMETYPE_REF;
+    }
+    else if (packet->flags & AV_PKT_FLAG_DISPOSABLE) {
+        bs->FrameType = MFX_FRAMETYPE_B;
+    }
+    else {
+        bs->FrameType = MFX_FRAMETYPE_P;
+        bs->FrameType |= MFX_FRAMETYPE_REF;
+    }
 
     return MFX_ERR_NONE;
 }
@@ -1619,15 +1736,30 @@ mfxStatus CpuEncode::EncodeQueryIOSurf(mfxVideoParam *par, mfxFrameAllocRequest
     //  if (sts < 0) return MFX_ERR_INVALID_VIDEO_PARAM;
     //}
 
-    request->NumFrameMin       = 4; // TO DO - calculate correctly from libav
-    request->NumFrameSuggested = 4;
-
+    // Input surfaces are held by the encode tasks in flight and by encoders
+    //   that keep referencing their input. x264, openh264 and the SVT
+    //   encoders copy every picture into their own lookahead and reorder
+    //   queues, so B-frames and lookahead cost no surfaces. The libav JPEG
+    //   encoder keeps one picture per frame thread.
+    mfxU16 heldFrames = 0;
+    mfxU16 asyncDepth = 1;
     if (par) {
-        request->NumFrameMin = request->NumFrameSuggested =
-            request->NumFrameSuggested + par->AsyncDepth;
+#ifdef ENABLE_LIBAV_AUTO_THREADS
+        // frame threads unless low latency, see InitEncode
+        if (par->mfx.CodecId == MFX_CODEC_JPEG && par->AsyncDepth != 1)
+            heldFrames = par->mfx.NumThread
+                             ? par->mfx.NumThread
+                             : static_cast<mfxU16>(CpuThreadBudget::GetMaxThreads());
+#endif
+        if (par->AsyncDepth)
+            asyncDepth = par->AsyncDepth;
     }
 
-    request->Type = MFX_MEMTYPE_SYSTEM_MEMORY | MFX_MEMTYPE_FROM_ENCODE;
+    // the surface being filled, the pictures the encoder holds, plus one
+    //   per frame in flight
+    request->NumFrameMin       = heldFrames + 1;
+    request->NumFrameSuggested = request->NumFrameMin + asyncDepth;
+    request->Type              = MFX_MEMTYPE_SYSTEM_MEMORY | MFX_MEMTYPE_FROM_ENCODE;
 
     return MFX_ERR_NONE;
 }
@@ -1693,7 +1825,7 @@ mfxStatus CpuEncode::GetEncodeSurface(mfxFrameSurface1 **surface) {
         mfxFrameAllocRequest EncRequest = { 0 };
         RET_ERROR(EncodeQueryIOSurf(&m_param, &EncRequest));
 
-        auto pool = std::make_unique<CpuFramePool>();
+        auto pool = std::make_unique<CpuFramePool>(m_session->GetCpuSet());
         RET_ERROR(pool->Init(m_param.mfx.FrameInfo, EncRequest.NumFrameSuggested));
         m_encSurfaces = std::move(pool);
     }
@@ -1711,6 +1843,46 @@ mfxStatus CpuEncode::GetEncodeSurface(mfxFrameSurface1 **surface) {
     return sts;
 }
 
+void CpuEncode::AddMemoryStats(mfxCpuMemoryStats *stats) {
+    if (m_encSurfaces)
+        m_encSurfaces->AddMemoryStats(stats);
+
+    if (m_avEncContext) {
+        size_t numFrames = std::max(1, m_avEncContext->refs) + m_avEncContext->max_b_frames;
+
+        // lookahead depth of the encoders that have one
+        int64_t lookahead = 0;
+        if (!av_opt_get_int(m_avEncContext->priv_data, "la_depth", 0, &lookahead) ||
+            !av_opt_get_int(m_avEncContext->priv_data, "rc-lookahead", 0, &lookahead)) {
+            if (lookahead > 0)
+                numFrames += static_cast<size_t>(lookahead);
+        }
+
+        if ((m_avEncContext->active_thread_type & FF_THREAD_FRAME) && m_codecThreads > 1)
+            numFrames += m_codecThreads - 1;
+
+        mfxFrameInfo *info = &m_param.mfx.FrameInfo;
+        stats->CodecBytes +=
+            numFrames * CpuFrame::GetBufferSize(info->FourCC, info->Width, info->Height);
+    }
+
+    std::lock_guard<std::mutex> lock(m_encPacketsMutex);
+    for (AVPacket *packet : m_encPackets)
+        stats->BitstreamBytes += packet->size;
+}
+
+mfxStatus CpuEncode::GetEncodeStat(mfxEncodeStat *stat) {
+    RET_IF_FALSE(stat, MFX_ERR_NULL_PTR);
+
+    stat->NumFrame = m_numFramesOut;
+    stat->NumBit   = m_numBits;
+
+    // frames sent but not yet written to a bitstream
+    stat->NumCachedFrame = m_numFramesIn - m_numFramesOut;
+
+    return MFX_ERR_NONE;
+}
+
 mfxStatus CpuEncode::GetVideoParam(mfxVideoParam *par) {
     *par = m_param;
     //*par = { 0 };
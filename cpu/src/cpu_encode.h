@@ -7,10 +7,13 @@
 #ifndef CPU_SRC_CPU_ENCODE_H_
 #define CPU_SRC_CPU_ENCODE_H_
 
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include "src/cpu_common.h"
+#include "src/cpu_deadline.h"
 #include "src/cpu_frame_pool.h"
 #include "src/frame_lock.h"
 
@@ -42,11 +45,19 @@ public:
     static mfxStatus EncodeQueryIOSurf(mfxVideoParam *par, mfxFrameAllocRequest *request);
 
     mfxStatus InitEncode(mfxVideoParam *par);
-    mfxStatus EncodeFrame(mfxFrameSurface1 *surface, mfxEncodeCtrl *ctrl, mfxBitstream *bs);
+    mfxStatus EncodeFrame(mfxFrameSurface1 *surface,
+                          mfxEncodeCtrl *ctrl,
+                          mfxBitstream *bs,
+                          mfxSyncPoint *syncp);
     mfxStatus GetVideoParam(mfxVideoParam *par);
+    mfxStatus GetEncodeStat(mfxEncodeStat *stat);
     mfxStatus GetEncodeSurface(mfxFrameSurface1 **surface);
     mfxStatus IsSameVideoParam(mfxVideoParam *newPar, mfxVideoParam *oldPar);
 
+    // the pictures encoders keep (references, reorder and lookahead
+    //   queues) are counted as codec memory from the encoder setup
+    void AddMemoryStats(mfxCpuMemoryStats *stats);
+
 private:
     static mfxStatus ValidateEncodeParams(mfxVideoParam *par, bool canCorrect);
     int convertTargetUsageVal(int val, int minIn, int maxIn, int minOut, int maxOut);
@@ -60,6 +71,8 @@ private:
     mfxStatus GetJPEGParams(mfxVideoParam *par);
 
     AVFrame *CreateAVFrame(mfxFrameSurface1 *surface);
+    mfxStatus SendFrame(AVFrame *av_frame);
+    mfxStatus WritePacket(AVPacket *packet, mfxBitstream *bs);
 
     inline void mem_put_le32(void *vmem, int32_t val) {
         uint8_t *mem = (uint8_t *)vmem;
@@ -89,7 +102,19 @@ private:
     const AVCodec *m_avEncCodec;
     AVCodecContext *m_avEncContext;
     AVPacket *m_avEncPacket;
-    FrameLock m_input_locker;
+    int m_codecThreads;
+
+    // packets produced on the session worker, waiting for a bitstream
+    std::deque<AVPacket *> m_encPackets;
+    std::mutex m_encPacketsMutex;
+    // sync points of frames queued to the encoder and not yet waited for
+    std::deque<mfxSyncPoint> m_encTasks;
+
+    // frames are dropped while late and are not counted as input
+    CpuDeadline m_deadline;
+    mfxU32 m_numFramesIn;
+    mfxU32 m_numFramesOut;
+    mfxU64 m_numBits;
 
     mfxVideoParam m_param;
     bool m_bFrameEncoded;
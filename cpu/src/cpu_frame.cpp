@@ -5,6 +5,7 @@
   ############################################################################*/
 
 #include "src/cpu_frame.h"
+#include "src/cpu_frame_pool.h"
 
 // increase refCount on surface (+1)
 mfxStatus CpuFrame::AddRef(mfxFrameSurface1 *surface) {
@@ -26,14 +27,33 @@ mfxStatus CpuFrame::Release(mfxFrameSurface1 *surface) {
     CpuFrame *cpu_frame = TryCast(surface);
     RET_IF_FALSE(cpu_frame, MFX_ERR_INVALID_HANDLE);
 
-    if (cpu_frame->m_refCount == 0)
-        return MFX_ERR_UNDEFINED_BEHAVIOR;
+    mfxU32 refCount = cpu_frame->m_refCount;
+    do {
+        if (refCount == 0)
+            return MFX_ERR_UNDEFINED_BEHAVIOR;
+    } while (!cpu_frame->m_refCount.compare_exchange_weak(refCount, refCount - 1));
 
-    cpu_frame->m_refCount--;
+    // last reference gone, surface can be handed out by its pool again
+    if (refCount == 1 && cpu_frame->m_poolIndex != POOL_INDEX_NONE) {
+        CpuFramePool *pool = (CpuFramePool *)cpu_frame->m_parentPoolInterface->GetParentPool();
+        pool->PushFreeSurface(cpu_frame);
+    }
 
     return MFX_ERR_NONE;
 }
 
+mfxStatus CpuFrame::TakeOver(AVFrame *avframe) {
+    av_frame_unref(m_avframe);
+    av_frame_move_ref(m_avframe, avframe);
+
+    if (m_poolIndex != POOL_INDEX_NONE) {
+        CpuFramePool *pool = (CpuFramePool *)m_parentPoolInterface->GetParentPool();
+        pool->AdoptFrameData(this);
+    }
+
+    return Update();
+}
+
 // return current refCount on surface
 mfxStatus CpuFrame::GetRefCounter(mfxFrameSurface1 *surface, mfxU32 *counter) {
     RET_IF_FALSE(surface, MFX_ERR_NULL_PTR);
@@ -105,7 +125,30 @@ mfxStatus CpuFrame::GetNativeHandle(mfxFrameSurface1 *surface,
     *resource      = nullptr;
     *resource_type = MFX_RESOURCE_SYSTEM_SURFACE;
 
-    return MFX_ERR_UNSUPPORTED;
+    // only frames in shared memory have a handle another process can use
+    if (!cpu_frame->IsShared())
+        return MFX_ERR_UNSUPPORTED;
+
+    AVFrame *avframe         = cpu_frame->m_avframe;
+    AVBufferRef *buffer      = avframe->buf[0];
+    mfxCpuSharedSurface desc = {};
+    desc.Fd                  = cpu_frame->m_sharedArena->GetFd();
+    desc.FourCC              = cpu_frame->Info.FourCC;
+    desc.Width               = cpu_frame->Info.Width;
+    desc.Height              = cpu_frame->Info.Height;
+    desc.Offset              = cpu_frame->m_sharedArena->GetOffset(buffer->data);
+    desc.Size                = buffer->size;
+    for (int i = 0; i < 4 && avframe->data[i]; i++) {
+        desc.Pitch[i]       = avframe->linesize[i];
+        desc.PlaneOffset[i] = avframe->data[i] - buffer->data;
+        desc.NumPlanes++;
+    }
+
+    cpu_frame->m_sharedDesc = desc;
+    *resource               = &cpu_frame->m_sharedDesc;
+    *resource_type          = MFX_RESOURCE_CPU_SHARED;
+
+    return MFX_ERR_NONE;
 }
 
 // return device handle and type
@@ -125,26 +168,59 @@ mfxStatus CpuFrame::GetDeviceHandle(mfxFrameSurface1 *surface,
 }
 
 // synchronize on surface after calling DecodeFrameAsync or VPP
-// alternative to calling MFXCore_SyncOperation
+// alternative to calling MFXCore_SyncOperation, waits only for the task
+//   writing this surface
 mfxStatus CpuFrame::Synchronize(mfxFrameSurface1 *surface, mfxU32 wait) {
     RET_IF_FALSE(surface, MFX_ERR_NULL_PTR);
 
     CpuFrame *cpu_frame = TryCast(surface);
     RET_IF_FALSE(cpu_frame, MFX_ERR_INVALID_HANDLE);
 
-    // TO DO - VPL CPU ref is currently synchronous (Sync does nothing)
-    // need to align sync behavior between legacy SyncOperation()
-    //   and new sync on surfaces
-    // probably need to track mapping of unique sync points to associated
-    //   mfxFrameSurface1 surfaces, and sync here
+    std::unique_lock<std::mutex> lock(cpu_frame->m_syncMutex);
+    auto isDone = [cpu_frame] {
+        return cpu_frame->m_pendingWrites == 0;
+    };
 
-    return MFX_ERR_NONE;
+    if (wait == MFX_INFINITE) {
+        cpu_frame->m_syncDone.wait(lock, isDone);
+    }
+    else if (!cpu_frame->m_syncDone.wait_for(lock, std::chrono::milliseconds(wait), isDone)) {
+        return MFX_WRN_IN_EXECUTION;
+    }
+
+    return cpu_frame->m_syncStatus;
 }
 
+// default callback, applications may replace it to be notified when
+//   queued work writing a surface completes
 void CpuFrame::OnComplete(mfxStatus sts) {
     return;
 }
 
+void CpuFrame::BeginWrite() {
+    std::lock_guard<std::mutex> lock(m_syncMutex);
+
+    // status describes the most recent batch of writes only
+    if (m_pendingWrites++ == 0)
+        m_syncStatus = MFX_ERR_NONE;
+}
+
+void CpuFrame::EndWrite(mfxStatus sts) {
+    bool bDone = false;
+    {
+        std::lock_guard<std::mutex> lock(m_syncMutex);
+        if (sts < MFX_ERR_NONE)
+            m_syncStatus = sts;
+        bDone = (--m_pendingWrites == 0);
+    }
+
+    if (bDone) {
+        m_syncDone.notify_all();
+        if (m_interface.OnComplete)
+            m_interface.OnComplete(sts);
+    }
+}
+
 mfxStatus CpuFrame::QueryInterface(mfxFrameSurface1 *surface, mfxGUID guid, mfxHDL *interface) {
     RET_IF_FALSE(surface, MFX_ERR_NULL_PTR);
     RET_IF_FALSE(interface, MFX_ERR_NULL_PTR);
@@ -7,7 +7,11 @@
 #ifndef CPU_SRC_CPU_FRAME_H_
 #define CPU_SRC_CPU_FRAME_H_
 
+#include <condition_variable>
+#include <mutex>
 #include "src/cpu_common.h"
+#include "src/cpu_frame_arena.h"
+#include "vplcpu/mfxcpushared.h"
 
 // interface for MFX_GUID_SURFACE_POOL
 struct CpuFramePoolInterface {
@@ -51,6 +55,15 @@ private:
     static mfxStatus GetCurrentPoolSize(struct mfxSurfacePoolInterface *pool, mfxU32 *size);
 };
 
+// frames carved from an arena pad their width to this many pixels, so every
+//   plane pitch is a multiple of 64 bytes and chroma pitches stay Pitch / 2
+#define FRAME_WIDTH_ALIGN 128
+// room past the last plane for vector loads reading over the end
+#define FRAME_PADDING 64
+
+// index of no surface in a pool's free list
+#define POOL_INDEX_NONE 0xFFFFFFFF
+
 // Implemented via AVFrame
 class CpuFrame : public mfxFrameSurface1 {
 public:
@@ -58,7 +71,16 @@ public:
             : m_refCount(0),
               m_mappedFlags(0),
               m_interface(),
-              m_parentPoolInterface(parentPoolInterface) {
+              m_parentPoolInterface(parentPoolInterface),
+              m_syncMutex(),
+              m_syncDone(),
+              m_pendingWrites(0),
+              m_syncStatus(MFX_ERR_NONE),
+              m_poolIndex(POOL_INDEX_NONE),
+              m_nextFree(POOL_INDEX_NONE),
+              m_heapBytes(0),
+              m_sharedArena(nullptr),
+              m_sharedDesc() {
         m_avframe = av_frame_alloc();
 
         *(mfxFrameSurface1 *)this   = {};
@@ -108,6 +130,52 @@ public:
         return Update();
     }
 
+    // size of the buffer for the Allocate() overload below, 0 if unsupported
+    static size_t GetBufferSize(mfxU32 FourCC, mfxU32 width, mfxU32 height) {
+        AVPixelFormat format = MFXFourCC2AVPixelFormat(FourCC);
+        if (format == AV_PIX_FMT_NONE)
+            return 0;
+
+        int size = av_image_get_buffer_size(format, FFALIGN(width, FRAME_WIDTH_ALIGN), height, 1);
+        return (size > 0) ? size + FRAME_PADDING : 0;
+    }
+
+    // luma pitch of the padded layout, 0 if unsupported
+    static mfxU32 GetPitch(mfxU32 FourCC, mfxU32 width) {
+        AVPixelFormat format = MFXFourCC2AVPixelFormat(FourCC);
+        int linesize[4]      = {};
+        if (format == AV_PIX_FMT_NONE ||
+            av_image_fill_linesizes(linesize, format, FFALIGN(width, FRAME_WIDTH_ALIGN)) < 0)
+            return 0;
+        return linesize[0];
+    }
+
+    // lay the frame out in buffer with padded pitches, the frame takes over
+    //   the reference
+    mfxStatus Allocate(mfxU32 FourCC, mfxU32 width, mfxU32 height, AVBufferRef *buffer) {
+        m_avframe->width  = width;
+        m_avframe->height = height;
+        m_avframe->format = MFXFourCC2AVPixelFormat(FourCC);
+
+        int size = -1;
+        if (m_avframe->format != AV_PIX_FMT_NONE) {
+            size = av_image_fill_arrays(m_avframe->data,
+                                        m_avframe->linesize,
+                                        buffer->data,
+                                        (AVPixelFormat)m_avframe->format,
+                                        FFALIGN(width, FRAME_WIDTH_ALIGN),
+                                        height,
+                                        1);
+        }
+        if (size < 0 || size + FRAME_PADDING > (int)buffer->size) {
+            av_buffer_unref(&buffer);
+            av_frame_unref(m_avframe);
+            return MFX_ERR_MEMORY_ALLOC;
+        }
+        m_avframe->buf[0] = buffer;
+        return Update();
+    }
+
     mfxStatus ImportAVFrame(AVFrame *avframe) {
         RET_IF_FALSE(avframe, MFX_ERR_NULL_PTR);
         RET_IF_FALSE(m_avframe == nullptr || avframe == m_avframe, MFX_ERR_UNDEFINED_BEHAVIOR);
@@ -181,6 +249,46 @@ public:
         return ImportAVFrame(m_avframe);
     }
 
+    // take over the picture in avframe, its data is counted and trimmed by
+    //   the parent pool like frames the pool allocated one by one
+    mfxStatus TakeOver(AVFrame *avframe);
+
+    // position in the parent pool and link in its free list
+    mfxU32 GetPoolIndex() const {
+        return m_poolIndex;
+    }
+    void SetPoolIndex(mfxU32 index) {
+        m_poolIndex = index;
+    }
+    mfxU32 GetNextFree() const {
+        return m_nextFree;
+    }
+    void SetNextFree(mfxU32 index) {
+        m_nextFree = index;
+    }
+
+    // data the parent pool allocated for this frame outside its arena
+    size_t GetHeapBytes() const {
+        return m_heapBytes;
+    }
+    void SetHeapBytes(size_t bytes) {
+        m_heapBytes = bytes;
+    }
+
+    // shared arena the parent pool carved this frame from, the frame can
+    //   be exported while its data is still that slot
+    void SetSharedArena(CpuFrameArena *arena) {
+        m_sharedArena = arena;
+    }
+    bool IsShared() const {
+        return CpuFrameArena::IsSlotOf(m_avframe->buf[0], m_sharedArena);
+    }
+
+    // Called by the scheduler when a task writing this frame is queued and
+    //   when it finishes. Synchronize() waits until no write is pending.
+    void BeginWrite();
+    void EndWrite(mfxStatus sts);
+
 private:
     std::atomic<mfxU32> m_refCount; // TODO(we have C++11, correct?)
     mfxU32 m_mappedFlags;
@@ -188,6 +296,18 @@ private:
     mfxFrameSurfaceInterface m_interface;
     CpuFramePoolInterface *m_parentPoolInterface;
 
+    // completion state of queued work producing this frame
+    std::mutex m_syncMutex;
+    std::condition_variable m_syncDone;
+    mfxU32 m_pendingWrites;
+    mfxStatus m_syncStatus;
+
+    mfxU32 m_poolIndex;
+    std::atomic<mfxU32> m_nextFree;
+    size_t m_heapBytes;
+    CpuFrameArena *m_sharedArena;
+    mfxCpuSharedSurface m_sharedDesc; // returned by GetNativeHandle
+
     static mfxStatus AddRef(mfxFrameSurface1 *surface);
     static mfxStatus Release(mfxFrameSurface1 *surface);
     static mfxStatus GetRefCounter(mfxFrameSurface1 *surface, mfxU32 *counter);
@@ -0,0 +1,229 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_frame_arena.h"
+#include <new>
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#define ARENA_ALIGN     64
+#define ARENA_HUGE_PAGE (2 * 1024 * 1024)
+
+static size_t AlignUp(size_t size, size_t align) {
+    return (size + align - 1) / align * align;
+}
+
+CpuFrameArena::CpuFrameArena()
+        : m_refCount(1),
+          m_slotMutex(),
+          m_freeSlots(),
+          m_base(nullptr),
+          m_slotSize(0),
+          m_numSlots(0),
+          m_memory(nullptr),
+          m_memorySize(0),
+          m_bMapped(false),
+          m_fd(-1) {}
+
+CpuFrameArena::~CpuFrameArena() {
+#if defined(__linux__)
+    if (m_fd >= 0)
+        close(m_fd);
+    if (m_bMapped) {
+        munmap(m_memory, m_memorySize);
+        return;
+    }
+#endif
+    av_free(m_memory);
+}
+
+// back the arena with a memfd, the file starts at m_base
+bool CpuFrameArena::MapFile(size_t size) {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    m_fd = memfd_create("vplcpu-frames", MFD_CLOEXEC);
+    if (m_fd < 0)
+        return false;
+
+    void *memory = MAP_FAILED;
+    if (ftruncate(m_fd, static_cast<off_t>(size)) == 0)
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (memory == MAP_FAILED)
+        return false;
+
+    m_memory     = memory;
+    m_memorySize = size;
+    m_base       = static_cast<uint8_t *>(memory);
+    m_bMapped    = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+CpuFrameArena *CpuFrameArena::Create(size_t slotSize, mfxU32 numSlots, bool bShared) {
+    if (!slotSize || !numSlots)
+        return nullptr;
+
+    CpuFrameArena *arena = new (std::nothrow) CpuFrameArena;
+    if (!arena)
+        return nullptr;
+
+    arena->m_slotSize = AlignUp(slotSize, ARENA_ALIGN);
+    arena->m_numSlots = numSlots;
+    size_t size       = arena->m_slotSize * numSlots;
+
+    if (bShared) {
+        if (!arena->MapFile(size)) {
+            delete arena;
+            return nullptr;
+        }
+    }
+
+#if defined(__linux__)
+    // reserved huge pages first, then ordinary pages which the kernel may
+    //   back with transparent huge pages once the range is huge page aligned
+    if (!bShared && size >= ARENA_HUGE_PAGE) {
+        size_t mapSize = AlignUp(size, ARENA_HUGE_PAGE);
+        void *memory   = MAP_FAILED;
+    #if defined(MAP_HUGETLB)
+        memory = mmap(nullptr,
+                      mapSize,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                      -1,
+                      0);
+    #endif
+        if (memory != MAP_FAILED) {
+            arena->m_memory     = memory;
+            arena->m_memorySize = mapSize;
+            arena->m_base       = static_cast<uint8_t *>(memory);
+        }
+        else {
+            mapSize = AlignUp(size, ARENA_HUGE_PAGE) + ARENA_HUGE_PAGE;
+            memory =
+                mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory != MAP_FAILED) {
+                uint8_t *base = reinterpret_cast<uint8_t *>(
+                    AlignUp(reinterpret_cast<uintptr_t>(memory), ARENA_HUGE_PAGE));
+    #if defined(MADV_HUGEPAGE)
+                madvise(base, AlignUp(size, ARENA_HUGE_PAGE), MADV_HUGEPAGE);
+    #endif
+                arena->m_memory     = memory;
+                arena->m_memorySize = mapSize;
+                arena->m_base       = base;
+            }
+        }
+        arena->m_bMapped = (arena->m_base != nullptr);
+    }
+#endif
+
+    if (!arena->m_base) {
+        arena->m_memory = av_malloc(size + ARENA_ALIGN);
+        if (!arena->m_memory) {
+            delete arena;
+            return nullptr;
+        }
+        arena->m_base = reinterpret_cast<uint8_t *>(
+            AlignUp(reinterpret_cast<uintptr_t>(arena->m_memory), ARENA_ALIGN));
+    }
+
+    // hand out slots from the start of the arena first
+    arena->m_freeSlots.reserve(numSlots);
+    for (mfxU32 i = numSlots; i > 0; i--)
+        arena->m_freeSlots.push_back(i - 1);
+
+    return arena;
+}
+
+AVBufferRef *CpuFrameArena::GetBuffer() {
+    mfxU32 slot;
+    {
+        std::lock_guard<std::mutex> lock(m_slotMutex);
+        if (m_freeSlots.empty())
+            return nullptr;
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    }
+
+    // the buffer holds a reference on the arena until FreeSlot()
+    AddRef();
+    AVBufferRef *buffer =
+        av_buffer_create(m_base + slot * m_slotSize, m_slotSize, FreeSlot, this, 0);
+    if (!buffer)
+        FreeSlot(this, m_base + slot * m_slotSize);
+
+    return buffer;
+}
+
+mfxU32 CpuFrameArena::GetNumFreeSlots() {
+    std::lock_guard<std::mutex> lock(m_slotMutex);
+    return static_cast<mfxU32>(m_freeSlots.size());
+}
+
+void CpuFrameArena::Release() {
+    if (--m_refCount == 0)
+        delete this;
+}
+
+AVBufferRef *CpuFrameArena::MapShared(int fd, mfxU64 offset, size_t size) {
+#if defined(__linux__)
+    // touching pages past the end of the file raises SIGBUS, the range has
+    //   to lie inside the file as it is now
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < 0 || !size)
+        return nullptr;
+    mfxU64 fileSize = static_cast<mfxU64>(st.st_size);
+    if (offset > fileSize || size > fileSize - offset)
+        return nullptr;
+
+    // the mapping starts on a page, the buffer at offset inside it
+    mfxU64 page    = static_cast<mfxU64>(sysconf(_SC_PAGESIZE));
+    mfxU64 start   = offset / page * page;
+    size_t mapSize = size + static_cast<size_t>(offset - start);
+
+    void *memory = mmap(nullptr,
+                        mapSize,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED,
+                        fd,
+                        static_cast<off_t>(start));
+    if (memory == MAP_FAILED)
+        return nullptr;
+
+    uint8_t *data = static_cast<uint8_t *>(memory) + (offset - start);
+    AVBufferRef *buffer =
+        av_buffer_create(data, size, UnmapShared, reinterpret_cast<void *>(mapSize), 0);
+    if (!buffer)
+        munmap(memory, mapSize);
+
+    return buffer;
+#else
+    return nullptr;
+#endif
+}
+
+void CpuFrameArena::UnmapShared(void *opaque, uint8_t *data) {
+#if defined(__linux__)
+    // the mapping started on the page holding data
+    uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uint8_t *start = data - (reinterpret_cast<uintptr_t>(data) % page);
+    munmap(start, reinterpret_cast<size_t>(opaque));
+#endif
+}
+
+void CpuFrameArena::FreeSlot(void *opaque, uint8_t *data) {
+    CpuFrameArena *arena = static_cast<CpuFrameArena *>(opaque);
+    {
+        std::lock_guard<std::mutex> lock(arena->m_slotMutex);
+        mfxU32 slot = static_cast<mfxU32>((data - arena->m_base) / arena->m_slotSize);
+        arena->m_freeSlots.push_back(slot);
+    }
+    arena->Release();
+}
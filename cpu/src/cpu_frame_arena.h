@@ -0,0 +1,88 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_FRAME_ARENA_H_
+#define CPU_SRC_CPU_FRAME_ARENA_H_
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "src/cpu_common.h"
+
+// One allocation holding the frame buffers of a pool
+// The arena is cut into equal, 64-byte aligned slots. On Linux it is mapped
+//   with huge pages when the system has them reserved, otherwise transparent
+//   huge pages are requested for it. Each slot handed out is wrapped in an
+//   AVBufferRef, the slot is free again once its last reference is gone.
+//   Buffers keep the arena alive, so frames may outlive the pool.
+// Shared arenas (Linux only) are a memfd mapped MAP_SHARED, so their frames
+//   can be handed to another process as the fd and an offset.
+class CpuFrameArena {
+public:
+    // returns nullptr if the memory cannot be allocated, the caller owns
+    //   one reference
+    static CpuFrameArena *Create(size_t slotSize, mfxU32 numSlots, bool bShared = false);
+
+    // map size bytes at offset of a shared arena file received from
+    //   another process, unmapped with the last reference
+    // nullptr if the range does not lie inside the file
+    static AVBufferRef *MapShared(int fd, mfxU64 offset, size_t size);
+
+    // true if buffer is a slot of arena, arena is only compared
+    static bool IsSlotOf(const AVBufferRef *buffer, const CpuFrameArena *arena) {
+        return buffer && arena && av_buffer_get_opaque(buffer) == arena;
+    }
+
+    // free slot, or nullptr when all are in use
+    AVBufferRef *GetBuffer();
+
+    // file of a shared arena, -1 otherwise
+    int GetFd() const {
+        return m_fd;
+    }
+    // position of data in the arena, and so in its file
+    mfxU64 GetOffset(const uint8_t *data) const {
+        return static_cast<mfxU64>(data - m_base);
+    }
+
+    mfxU32 GetNumFreeSlots();
+    size_t GetSize() const {
+        return m_slotSize * m_numSlots;
+    }
+
+    void AddRef() {
+        m_refCount++;
+    }
+    void Release();
+
+private:
+    CpuFrameArena();
+    ~CpuFrameArena();
+
+    static void FreeSlot(void *opaque, uint8_t *data);
+    static void UnmapShared(void *opaque, uint8_t *data);
+    bool MapFile(size_t size);
+
+    std::atomic<mfxU32> m_refCount;
+    std::mutex m_slotMutex;
+    std::vector<mfxU32> m_freeSlots;
+
+    uint8_t *m_base;
+    size_t m_slotSize;
+    mfxU32 m_numSlots;
+
+    // whole allocation, m_base is aligned inside it
+    void *m_memory;
+    size_t m_memorySize;
+    bool m_bMapped;
+    int m_fd;
+
+    /* copy not allowed */
+    CpuFrameArena(const CpuFrameArena &);
+    CpuFrameArena &operator=(const CpuFrameArena &);
+};
+
+#endif // CPU_SRC_CPU_FRAME_ARENA_H_
@@ -0,0 +1,97 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_frame_cache.h"
+#include <stdlib.h>
+#include <iterator>
+#include <list>
+#include <mutex>
+
+#define FRAME_CACHE_ENV        "VPL_CPU_FRAME_CACHE"
+#define FRAME_CACHE_DEFAULT_MB 256
+
+struct CacheEntry {
+    CpuFrameCacheKey key;
+    CpuFrameArena *arena;
+};
+
+// most recently cached first
+struct CacheList {
+    std::mutex mutex;
+    std::list<CacheEntry> entries;
+    size_t size = 0;
+};
+
+// Never destroyed, pools owned by other static objects may still hand
+//   their arenas over during exit. Arenas cached at exit go with the process.
+static CacheList &GetCache() {
+    static CacheList *cache = new CacheList;
+    return *cache;
+}
+
+static size_t ReadCacheLimit() {
+    size_t limitMB = FRAME_CACHE_DEFAULT_MB;
+
+    const char *env = getenv(FRAME_CACHE_ENV);
+    if (env && atoi(env) >= 0)
+        limitMB = atoi(env);
+
+    return limitMB * 1024 * 1024;
+}
+
+static bool operator==(const CpuFrameCacheKey &l, const CpuFrameCacheKey &r) {
+    return l.fourcc == r.fourcc && l.width == r.width && l.height == r.height &&
+           l.pitch == r.pitch && l.cpuSet == r.cpuSet && l.shared == r.shared;
+}
+
+CpuFrameArena *CpuFrameCache::Take(const CpuFrameCacheKey &key, mfxU32 numSlots) {
+    CacheList &cache = GetCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    for (auto it = cache.entries.begin(); it != cache.entries.end(); ++it) {
+        if (it->key == key && it->arena->GetNumFreeSlots() >= numSlots) {
+            CpuFrameArena *arena = it->arena;
+            cache.size -= arena->GetSize();
+            cache.entries.erase(it);
+            return arena;
+        }
+    }
+
+    return nullptr;
+}
+
+void CpuFrameCache::Put(const CpuFrameCacheKey &key, CpuFrameArena *arena) {
+    static const size_t limit = ReadCacheLimit();
+
+    if (arena->GetSize() > limit) {
+        arena->Release();
+        return;
+    }
+
+    // release outside the lock, the last release unmaps the arena
+    CacheList &cache = GetCache();
+    std::list<CacheEntry> trimmed;
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+
+        cache.entries.push_front({ key, arena });
+        cache.size += arena->GetSize();
+
+        while (cache.size > limit) {
+            cache.size -= cache.entries.back().arena->GetSize();
+            trimmed.splice(trimmed.end(), cache.entries, std::prev(cache.entries.end()));
+        }
+    }
+
+    for (CacheEntry &entry : trimmed)
+        entry.arena->Release();
+}
+
+size_t CpuFrameCache::GetCachedSize() {
+    CacheList &cache = GetCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    return cache.size;
+}
@@ -0,0 +1,46 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_FRAME_CACHE_H_
+#define CPU_SRC_CPU_FRAME_CACHE_H_
+
+#include "src/cpu_common.h"
+#include "src/cpu_frame_arena.h"
+
+// frame layout and placement an arena was made for
+struct CpuFrameCacheKey {
+    mfxU32 fourcc;
+    mfxU32 width;
+    mfxU32 height;
+    mfxU32 pitch;
+    int cpuSet;
+    bool shared;
+};
+
+// Process-wide cache of frame arenas
+// Pools hand their arena over when they are destroyed, a new pool with the
+//   same frame layout takes it back instead of mapping and faulting in
+//   fresh memory. Arenas still holding frames can be cached, they are only
+//   reused once enough slots are free. The least recently cached arenas are
+//   freed when the total exceeds VPL_CPU_FRAME_CACHE megabytes, the default
+//   is 256, 0 disables the cache.
+class CpuFrameCache {
+public:
+    // cached arena with at least numSlots free slots, the caller owns the
+    //   returned reference, nullptr if there is none
+    static CpuFrameArena *Take(const CpuFrameCacheKey &key, mfxU32 numSlots);
+
+    // cache the caller's reference to an arena it no longer uses
+    static void Put(const CpuFrameCacheKey &key, CpuFrameArena *arena);
+
+    // bytes held by cached arenas
+    static size_t GetCachedSize();
+
+private:
+    CpuFrameCache();
+};
+
+#endif // CPU_SRC_CPU_FRAME_CACHE_H_
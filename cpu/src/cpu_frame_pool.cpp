@@ -5,60 +5,480 @@
   ############################################################################*/
 
 #include "src/cpu_frame_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include <memory>
+#include <new>
 #include <utility>
 
-mfxStatus CpuFramePool::Init(mfxU32 nPoolSize) {
-    for (mfxU32 i = 0; i < nPoolSize; i++) {
-        auto cpu_frame = std::make_unique<CpuFrame>(&m_framePoolInterface);
-        RET_IF_FALSE(cpu_frame->GetAVFrame(), MFX_ERR_MEMORY_ALLOC);
-        m_surfaces.push_back(std::move(cpu_frame));
+#define POOL_POLICY_ENV "VPL_CPU_POOL_POLICY"
+#define POOL_DELTA_ENV  "VPL_CPU_POOL_DELTA"
+#define POOL_WAIT_ENV       "VPL_CPU_POOL_WAIT"
+#define POOL_TRIM_ENV       "VPL_CPU_POOL_TRIM"
+#define POOL_TRIM_COUNT_ENV "VPL_CPU_POOL_TRIM_COUNT"
+#define POOL_SHARED_ENV     "VPL_CPU_POOL_SHARED"
+
+struct CpuPoolConfig {
+    mfxPoolAllocationPolicy policy;
+    mfxU32 delta;
+    mfxU32 waitMs;
+    mfxU32 trimMs;
+    mfxU32 trimCount;
+    bool bShared;
+};
+
+static CpuPoolConfig ReadPoolConfig() {
+    CpuPoolConfig config = { MFX_ALLOCATION_UNLIMITED, 0, 0, 0, 0, false };
+
+    const char *env = getenv(POOL_POLICY_ENV);
+    if (env && !strcmp(env, "limited"))
+        config.policy = MFX_ALLOCATION_LIMITED;
+    else if (env && !strcmp(env, "optimal"))
+        config.policy = MFX_ALLOCATION_OPTIMAL;
+
+    env = getenv(POOL_DELTA_ENV);
+    if (env && atoi(env) > 0)
+        config.delta = atoi(env);
+
+    env = getenv(POOL_WAIT_ENV);
+    if (env && atoi(env) > 0)
+        config.waitMs = atoi(env);
+
+    env = getenv(POOL_TRIM_ENV);
+    if (env && atoi(env) > 0)
+        config.trimMs = atoi(env);
+
+    env = getenv(POOL_TRIM_COUNT_ENV);
+    if (env && atoi(env) > 0)
+        config.trimCount = atoi(env);
+
+#if defined(__linux__)
+    env = getenv(POOL_SHARED_ENV);
+    if (env && atoi(env) > 0)
+        config.bShared = true;
+#endif
+
+    return config;
+}
+
+static const CpuPoolConfig &GetPoolConfig() {
+    static const CpuPoolConfig config = ReadPoolConfig();
+    return config;
+}
+
+bool CpuFramePool::UsesSharedMemory() {
+    return GetPoolConfig().bShared;
+}
+
+void CpuFramePool::SetPolicy(mfxU32 nPoolSize) {
+    const CpuPoolConfig &config = GetPoolConfig();
+
+    m_policy       = config.policy;
+    m_wait         = std::chrono::milliseconds(config.waitMs);
+    m_minSurfaces  = nPoolSize;
+    m_trimWindow   = std::chrono::milliseconds(config.trimMs);
+    m_trimCount    = config.trimCount;
+    m_trimDeadline = (Clock::now() + m_trimWindow).time_since_epoch().count();
+    switch (m_policy) {
+        case MFX_ALLOCATION_LIMITED:
+            m_maxSurfaces = static_cast<mfxU32>(
+                std::min<mfxU64>(static_cast<mfxU64>(nPoolSize) + config.delta, POOL_MAX_SURFACES));
+            break;
+        case MFX_ALLOCATION_OPTIMAL:
+            m_maxSurfaces = std::min<mfxU32>(nPoolSize, POOL_MAX_SURFACES);
+            break;
+        default:
+            m_maxSurfaces = 0xFFFFFFFF;
+            break;
     }
+}
 
-    return MFX_ERR_NONE;
+mfxStatus CpuFramePool::Init(mfxU32 nPoolSize) {
+    SetPolicy(nPoolSize);
+
+    return Preallocate(nPoolSize);
 }
 
 mfxStatus CpuFramePool::Init(mfxFrameInfo info, mfxU32 nPoolSize) {
     memcpy_s(&m_info, sizeof(mfxFrameInfo), &info, sizeof(mfxFrameInfo));
+    SetPolicy(nPoolSize);
+    m_bShared = UsesSharedMemory();
+
+    // without an arena every frame is allocated on its own
+    size_t frameSize = CpuFrame::GetBufferSize(m_info.FourCC, m_info.Width, m_info.Height);
+    mfxU32 maxFrames = m_maxSurfaces;
+    mfxU32 numFrames = (maxFrames < POOL_MAX_SURFACES) ? maxFrames : nPoolSize;
+    if (frameSize && numFrames) {
+        m_arena      = CpuFrameCache::Take(GetCacheKey(), numFrames);
+        m_bWarmArena = (m_arena != nullptr);
+        if (!m_arena)
+            m_arena = CpuFrameArena::Create(frameSize, numFrames, m_bShared);
+    }
+
+    return Preallocate(nPoolSize);
+}
 
+CpuFrameCacheKey CpuFramePool::GetCacheKey() const {
+    CpuFrameCacheKey key = { m_info.FourCC,
+                             m_info.Width,
+                             m_info.Height,
+                             CpuFrame::GetPitch(m_info.FourCC, m_info.Width),
+                             m_cpuSet,
+                             m_bShared };
+    return key;
+}
+
+mfxStatus CpuFramePool::Preallocate(mfxU32 nPoolSize) {
     for (mfxU32 i = 0; i < nPoolSize; i++) {
-        auto cpu_frame = std::make_unique<CpuFrame>(&m_framePoolInterface);
-        RET_ERROR(cpu_frame->Allocate(m_info.FourCC, m_info.Width, m_info.Height));
-        m_surfaces.push_back(std::move(cpu_frame));
+        CpuFrame *cpu_frame = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_growMutex);
+            RET_ERROR(AddSurface(&cpu_frame));
+        }
+        // never handed out, so it is not counted as in use
+        LinkFreeSurface(cpu_frame);
     }
 
     return MFX_ERR_NONE;
 }
 
-// return free surface and set refCount to 1
-mfxStatus CpuFramePool::GetFreeSurface(mfxFrameSurface1 **surface) {
-    RET_IF_FALSE(surface, MFX_ERR_NULL_PTR);
-    *surface = nullptr;
+mfxStatus CpuFramePool::AllocateFrame(CpuFrame *frame) {
+    CpuPlacementScope placement(m_cpuSet);
+    CpuFrameArena *arena = m_arena;
+    AVBufferRef *buffer  = arena ? arena->GetBuffer() : nullptr;
+    if (!buffer && m_bShared) {
+        // an arena of its own, the buffer keeps it alive
+        size_t frameSize = CpuFrame::GetBufferSize(m_info.FourCC, m_info.Width, m_info.Height);
+        arena            = CpuFrameArena::Create(frameSize, 1, true);
+        RET_IF_FALSE(arena, MFX_ERR_MEMORY_ALLOC);
+        buffer = arena->GetBuffer();
+        arena->Release();
+        RET_IF_FALSE(buffer, MFX_ERR_MEMORY_ALLOC);
+    }
 
-    for (std::unique_ptr<CpuFrame> &surf : m_surfaces) {
-        mfxU32 counter = 0xFFFFFFFF;
-        surf->FrameInterface->GetRefCounter(surf.get(), &counter);
+    if (buffer) {
+        RET_ERROR(frame->Allocate(m_info.FourCC, m_info.Width, m_info.Height, buffer));
+    }
+    else {
+        RET_ERROR(frame->Allocate(m_info.FourCC, m_info.Width, m_info.Height));
+    }
+    frame->SetSharedArena(m_bShared ? arena : nullptr);
+
+    // data outside the pool arena is freed frame by frame
+    bool bPoolArena = buffer && arena == m_arena;
+    if (!bPoolArena) {
+        size_t heapBytes = 0;
+        AVFrame *avframe = frame->GetAVFrame();
+        for (int i = 0; i < AV_NUM_DATA_POINTERS && avframe->buf[i]; i++)
+            heapBytes += avframe->buf[i]->size;
+        frame->SetHeapBytes(heapBytes);
+        m_heapBytes += heapBytes;
+    }
 
-        if (!counter && !surf->Data.Locked) {
-            *surface = surf.get();
-            (*surface)->FrameInterface->AddRef(*surface);
-            return MFX_ERR_NONE;
+    // pages are placed on first write, do it from the session's CPUs
+    if (m_cpuSet != CPU_SET_ANY && !(bPoolArena && m_bWarmArena)) {
+        AVFrame *avframe = frame->GetAVFrame();
+        for (int i = 0; i < AV_NUM_DATA_POINTERS && avframe->buf[i]; i++)
+            memset(avframe->buf[i]->data, 0, avframe->buf[i]->size);
+    }
+
+    return MFX_ERR_NONE;
+}
+
+// The frame holds data allocated elsewhere, e.g. a decoded picture, count
+//   it so the frame is reported and trimmed like one allocated on its own.
+//   The frame is in use, trimming does not look at it meanwhile.
+void CpuFramePool::AdoptFrameData(CpuFrame *frame) {
+    size_t heapBytes = 0;
+    AVFrame *avframe = frame->GetAVFrame();
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && avframe->buf[i]; i++)
+        heapBytes += avframe->buf[i]->size;
+
+    m_heapBytes -= frame->GetHeapBytes();
+    m_heapBytes += heapBytes;
+    frame->SetHeapBytes(heapBytes);
+}
+
+// drop the data of a frame, the frame itself stays
+void CpuFramePool::FreeFrameData(CpuFrame *frame) {
+    av_frame_unref(frame->GetAVFrame());
+    m_heapBytes -= frame->GetHeapBytes();
+    frame->SetHeapBytes(0);
+}
+
+// create a new surface with refCount 0, it is not on the free list
+// caller holds m_growMutex, returns MFX_WRN_ALLOC_TIMEOUT_EXPIRED at the limit
+mfxStatus CpuFramePool::AddSurface(CpuFrame **frame) {
+    if (m_numLive >= m_maxSurfaces)
+        return MFX_WRN_ALLOC_TIMEOUT_EXPIRED;
+
+    // reuse the slot of a revoked surface first
+    if (!m_retired.empty()) {
+        CpuFrame *cpu_frame = GetSurface(m_retired.back());
+        if (m_info.FourCC) {
+            RET_ERROR(AllocateFrame(cpu_frame));
         }
+        m_retired.pop_back();
+        m_numLive++;
+
+        *frame = cpu_frame;
+        return MFX_ERR_NONE;
+    }
+
+    mfxU32 index = m_numSurfaces;
+    RET_IF_FALSE(index < POOL_MAX_SURFACES, MFX_ERR_MEMORY_ALLOC);
+
+    std::unique_ptr<std::unique_ptr<CpuFrame>[]> &chunk = m_chunks[index / POOL_CHUNK_SIZE];
+    if (!chunk) {
+        chunk.reset(new (std::nothrow) std::unique_ptr<CpuFrame>[POOL_CHUNK_SIZE]);
+        RET_IF_FALSE(chunk, MFX_ERR_MEMORY_ALLOC);
     }
 
-    // no free surface found in pool, create new one
     auto cpu_frame = std::make_unique<CpuFrame>(&m_framePoolInterface);
     RET_IF_FALSE(cpu_frame && cpu_frame->GetAVFrame(), MFX_ERR_MEMORY_ALLOC);
     if (m_info.FourCC) {
-        RET_ERROR(cpu_frame->Allocate(m_info.FourCC, m_info.Width, m_info.Height));
+        RET_ERROR(AllocateFrame(cpu_frame.get()));
+    }
+    cpu_frame->SetPoolIndex(index);
+
+    *frame = cpu_frame.get();
+    chunk[index % POOL_CHUNK_SIZE] = std::move(cpu_frame);
+
+    // publish only after the slot is filled, readers index below the count
+    m_numSurfaces = index + 1;
+    m_numLive++;
+
+    return MFX_ERR_NONE;
+}
+
+// free the data of a surface above the limit, the slot stays for reuse
+// caller holds m_growMutex
+void CpuFramePool::RetireSurface(CpuFrame *frame) {
+    FreeFrameData(frame);
+    frame->Update();
+
+    m_retired.push_back(frame->GetPoolIndex());
+    m_numLive--;
+}
+
+void CpuFramePool::PushFreeSurface(CpuFrame *frame) {
+    m_numInUse--;
+
+    // the pool shrinks as revoked surfaces are released
+    if (m_numLive > m_maxSurfaces) {
+        std::lock_guard<std::mutex> lock(m_growMutex);
+        if (m_numLive > m_maxSurfaces) {
+            RetireSurface(frame);
+            return;
+        }
+    }
+
+    LinkFreeSurface(frame);
+
+    if (m_numWaiters) {
+        std::lock_guard<std::mutex> lock(m_growMutex);
+        m_freeCond.notify_all();
+    }
+}
+
+void CpuFramePool::LinkFreeSurface(CpuFrame *frame) {
+    mfxU64 head = m_freeHead;
+    mfxU64 newHead;
+    do {
+        frame->SetNextFree(static_cast<mfxU32>(head));
+        newHead = MakeHead(frame->GetPoolIndex(), static_cast<mfxU32>(head >> 32) + 1);
+    } while (!m_freeHead.compare_exchange_weak(head, newHead));
+}
+
+CpuFrame *CpuFramePool::PopFreeSurface() {
+    mfxU64 head = m_freeHead;
+    mfxU64 newHead;
+    CpuFrame *frame;
+    do {
+        mfxU32 index = static_cast<mfxU32>(head);
+        if (index == POOL_INDEX_NONE)
+            return nullptr;
+
+        // surfaces are never removed, so reading the link of a surface
+        //   another thread just popped is harmless, the tag fails the CAS
+        frame   = GetSurface(index);
+        newHead = MakeHead(frame->GetNextFree(), static_cast<mfxU32>(head >> 32) + 1);
+    } while (!m_freeHead.compare_exchange_weak(head, newHead));
+
+    return frame;
+}
+
+// pop a free surface, surfaces still locked by the application are put back
+CpuFrame *CpuFramePool::TakeFreeSurface() {
+    CpuFrame *locked = nullptr;
+    CpuFrame *cpu_frame;
+    while ((cpu_frame = PopFreeSurface()) != nullptr && cpu_frame->Data.Locked) {
+        cpu_frame->SetNextFree(locked ? locked->GetPoolIndex() : POOL_INDEX_NONE);
+        locked = cpu_frame;
     }
-    *surface = cpu_frame.get();
+    while (locked) {
+        mfxU32 next = locked->GetNextFree();
+        LinkFreeSurface(locked);
+        locked = (next != POOL_INDEX_NONE) ? GetSurface(next) : nullptr;
+    }
+
+    return cpu_frame;
+}
+
+// grow the pool, or wait for a surface to be released while it is at its limit
+mfxStatus CpuFramePool::WaitFreeSurface(CpuFrame **frame) {
+    std::unique_lock<std::mutex> lock(m_growMutex);
+
+    auto deadline = std::chrono::steady_clock::now() + m_wait;
+    mfxStatus sts = MFX_WRN_ALLOC_TIMEOUT_EXPIRED;
+    m_numWaiters++;
+    do {
+        // waiters are counted before looking, so a surface pushed from
+        //   now on notifies us
+        *frame = TakeFreeSurface();
+        if (*frame) {
+            sts = MFX_ERR_NONE;
+            break;
+        }
+        sts = AddSurface(frame);
+        if (sts != MFX_WRN_ALLOC_TIMEOUT_EXPIRED)
+            break;
+    } while (m_freeCond.wait_until(lock, deadline) != std::cv_status::timeout);
+    m_numWaiters--;
+
+    return sts;
+}
+
+// return free surface and set refCount to 1
+mfxStatus CpuFramePool::GetFreeSurface(mfxFrameSurface1 **surface) {
+    RET_IF_FALSE(surface, MFX_ERR_NULL_PTR);
+    *surface = nullptr;
+
+    CpuFrame *cpu_frame = TakeFreeSurface();
+    if (!cpu_frame) {
+        mfxStatus sts = WaitFreeSurface(&cpu_frame);
+        if (sts != MFX_ERR_NONE)
+            return sts;
+    }
+
+    CountInUse();
+
+    // drop data still referenced elsewhere (e.g. decoder reference
+    //   frames), then give the surface its own buffers again
+    AVFrame *avframe = cpu_frame->GetAVFrame();
+    if (avframe->data[0] && !av_frame_is_writable(avframe)) {
+        FreeFrameData(cpu_frame);
+        mfxStatus sts = m_info.FourCC ? AllocateFrame(cpu_frame) : cpu_frame->Update();
+        if (sts < MFX_ERR_NONE) {
+            PushFreeSurface(cpu_frame);
+            return sts;
+        }
+    }
+
+    *surface = cpu_frame;
     (*surface)->FrameInterface->AddRef(*surface);
-    m_surfaces.push_back(std::move(cpu_frame));
+
+    if (IsTrimDue())
+        TrimIdle();
 
     return MFX_ERR_NONE;
 }
 
+// count a surface handed out and raise the high-water mark
+void CpuFramePool::CountInUse() {
+    mfxU32 numInUse  = ++m_numInUse;
+    mfxU32 highWater = m_highWater;
+    while (numInUse > highWater && !m_highWater.compare_exchange_weak(highWater, numInUse)) {
+    }
+}
+
+bool CpuFramePool::IsTrimDue() {
+    if (m_trimCount && m_numRequests.fetch_add(1) + 1 >= m_trimCount)
+        return true;
+    if (m_trimWindow.count() && Clock::now().time_since_epoch().count() >= m_trimDeadline)
+        return true;
+    return false;
+}
+
+// Free the surfaces allocated one by one that were not needed during the
+//   last window, that is all above the high-water mark, and start a new
+//   window. Arena frames are kept, they are part of the preallocated pool.
+void CpuFramePool::TrimIdle() {
+    std::lock_guard<std::mutex> lock(m_growMutex);
+
+    // another thread trimmed while this one waited for the lock
+    Clock::time_point now = Clock::now();
+    if (!(m_trimCount && m_numRequests >= m_trimCount) &&
+        !(m_trimWindow.count() && now.time_since_epoch().count() >= m_trimDeadline))
+        return;
+
+    mfxU32 keep = std::max<mfxU32>(m_highWater, m_minSurfaces);
+
+    CpuFrame *kept = nullptr;
+    CpuFrame *cpu_frame;
+    while (m_numLive > keep && (cpu_frame = TakeFreeSurface()) != nullptr) {
+        if (cpu_frame->GetHeapBytes()) {
+            RetireSurface(cpu_frame);
+            continue;
+        }
+        cpu_frame->SetNextFree(kept ? kept->GetPoolIndex() : POOL_INDEX_NONE);
+        kept = cpu_frame;
+    }
+    while (kept) {
+        mfxU32 next = kept->GetNextFree();
+        LinkFreeSurface(kept);
+        kept = (next != POOL_INDEX_NONE) ? GetSurface(next) : nullptr;
+    }
+
+    m_highWater    = m_numInUse.load();
+    m_numRequests  = 0;
+    m_trimDeadline = (now + m_trimWindow).time_since_epoch().count();
+}
+
+void CpuFramePool::AddMemoryStats(mfxCpuMemoryStats *stats) {
+    stats->FrameBytes += m_heapBytes;
+    if (m_arena)
+        stats->FrameBytes += m_arena->GetSize();
+    stats->NumFrames += m_numLive;
+}
+
+mfxStatus CpuFramePool::SetNumSurfaces(mfxU32 numSurfaces) {
+    RET_IF_FALSE(m_policy == MFX_ALLOCATION_OPTIMAL, MFX_WRN_INCOMPATIBLE_VIDEO_PARAM);
+
+    std::lock_guard<std::mutex> lock(m_growMutex);
+    RET_IF_FALSE(numSurfaces <= POOL_MAX_SURFACES - m_maxSurfaces, MFX_ERR_MEMORY_ALLOC);
+
+    // surfaces are allocated when they are first needed
+    m_maxSurfaces += numSurfaces;
+    m_freeCond.notify_all();
+
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuFramePool::RevokeSurfaces(mfxU32 numSurfaces) {
+    RET_IF_FALSE(m_policy == MFX_ALLOCATION_OPTIMAL, MFX_WRN_INCOMPATIBLE_VIDEO_PARAM);
+
+    std::lock_guard<std::mutex> lock(m_growMutex);
+    mfxStatus sts = MFX_ERR_NONE;
+    if (numSurfaces > m_maxSurfaces) {
+        numSurfaces = m_maxSurfaces;
+        sts         = MFX_WRN_OUT_OF_RANGE;
+    }
+    m_maxSurfaces -= numSurfaces;
+
+    // free surfaces are released now, the others when the application
+    //   releases them
+    while (m_numLive > m_maxSurfaces) {
+        CpuFrame *cpu_frame = TakeFreeSurface();
+        if (!cpu_frame)
+            break;
+        RetireSurface(cpu_frame);
+    }
+
+    return sts;
+}
+
 mfxStatus CpuFramePoolInterface::AddRef(struct mfxSurfacePoolInterface *pool) {
     RET_IF_FALSE(pool, MFX_ERR_NULL_PTR);
 
@@ -110,8 +530,10 @@ mfxStatus CpuFramePoolInterface::SetNumSurfaces(struct mfxSurfacePoolInterface *
     CpuFramePoolInterface *framePoolInterface = (CpuFramePoolInterface *)(pool->Context);
     RET_IF_FALSE(framePoolInterface, MFX_ERR_INVALID_HANDLE);
 
-    // CpuFramePool only supports MFX_ALLOCATION_UNLIMITED policy
-    return MFX_WRN_INCOMPATIBLE_VIDEO_PARAM;
+    CpuFramePool *framePool = (CpuFramePool *)framePoolInterface->GetParentPool();
+    RET_IF_FALSE(framePool, MFX_ERR_INVALID_HANDLE);
+
+    return framePool->SetNumSurfaces(num_surfaces);
 }
 
 mfxStatus CpuFramePoolInterface::RevokeSurfaces(struct mfxSurfacePoolInterface *pool,
@@ -121,8 +543,10 @@ mfxStatus CpuFramePoolInterface::RevokeSurfaces(struct mfxSurfacePoolInterface *
     CpuFramePoolInterface *framePoolInterface = (CpuFramePoolInterface *)(pool->Context);
     RET_IF_FALSE(framePoolInterface, MFX_ERR_INVALID_HANDLE);
 
-    // CpuFramePool only supports MFX_ALLOCATION_UNLIMITED policy
-    return MFX_WRN_INCOMPATIBLE_VIDEO_PARAM;
+    CpuFramePool *framePool = (CpuFramePool *)framePoolInterface->GetParentPool();
+    RET_IF_FALSE(framePool, MFX_ERR_INVALID_HANDLE);
+
+    return framePool->RevokeSurfaces(num_surfaces);
 }
 
 mfxStatus CpuFramePoolInterface::GetAllocationPolicy(struct mfxSurfacePoolInterface *pool,
@@ -133,8 +557,10 @@ mfxStatus CpuFramePoolInterface::GetAllocationPolicy(struct mfxSurfacePoolInterf
     CpuFramePoolInterface *framePoolInterface = (CpuFramePoolInterface *)(pool->Context);
     RET_IF_FALSE(framePoolInterface, MFX_ERR_INVALID_HANDLE);
 
-    // CpuFramePool only supports MFX_ALLOCATION_UNLIMITED policy
-    *policy = MFX_ALLOCATION_UNLIMITED;
+    CpuFramePool *framePool = (CpuFramePool *)framePoolInterface->GetParentPool();
+    RET_IF_FALSE(framePool, MFX_ERR_INVALID_HANDLE);
+
+    *policy = framePool->GetAllocationPolicy();
 
     return MFX_ERR_NONE;
 }
@@ -147,8 +573,11 @@ mfxStatus CpuFramePoolInterface::GetMaximumPoolSize(struct mfxSurfacePoolInterfa
     CpuFramePoolInterface *framePoolInterface = (CpuFramePoolInterface *)(pool->Context);
     RET_IF_FALSE(framePoolInterface, MFX_ERR_INVALID_HANDLE);
 
-    // CpuFramePool only supports MFX_ALLOCATION_UNLIMITED policy
-    *size = 0xFFFFFFFF;
+    CpuFramePool *framePool = (CpuFramePool *)framePoolInterface->GetParentPool();
+    RET_IF_FALSE(framePool, MFX_ERR_INVALID_HANDLE);
+
+    // 0xFFFFFFFF for MFX_ALLOCATION_UNLIMITED
+    *size = framePool->GetMaximumPoolSize();
 
     return MFX_ERR_NONE;
 }
@@ -162,7 +591,7 @@ mfxStatus CpuFramePoolInterface::GetCurrentPoolSize(struct mfxSurfacePoolInterfa
     RET_IF_FALSE(framePoolInterface, MFX_ERR_INVALID_HANDLE);
 
     CpuFramePool *framePool = (CpuFramePool *)framePoolInterface->GetParentPool();
-    RET_IF_FALSE(framePoolInterface, MFX_ERR_INVALID_HANDLE);
+    RET_IF_FALSE(framePool, MFX_ERR_INVALID_HANDLE);
 
     *size = framePool->GetCurrentPoolSize();
 
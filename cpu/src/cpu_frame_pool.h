@@ -7,31 +7,191 @@
 #ifndef CPU_SRC_CPU_FRAME_POOL_H_
 #define CPU_SRC_CPU_FRAME_POOL_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include "src/cpu_common.h"
 #include "src/cpu_frame.h"
+#include "src/cpu_frame_arena.h"
+#include "src/cpu_frame_cache.h"
+#include "src/cpu_threads.h"
+#include "vplcpu/mfxcpumemory.h"
 
+// surfaces are stored in chunks which never move, so a surface index
+//   stays valid while the pool grows
+#define POOL_CHUNK_SIZE   64
+#define POOL_MAX_CHUNKS   1024
+#define POOL_MAX_SURFACES (POOL_CHUNK_SIZE * POOL_MAX_CHUNKS)
+
+// Surfaces released by the application go back on a lock-free free list,
+//   GetFreeSurface() pops from it in O(1) from any thread. The list is
+//   linked by surface index, the head packs the top index with a tag that
+//   changes on every update so a surface popped and pushed again between a
+//   load and the compare-exchange is noticed.
+//
+// Pools are unlimited unless VPL_CPU_POOL_POLICY selects a bounded policy:
+//   "limited" - at most the component's preallocated surfaces plus
+//               VPL_CPU_POOL_DELTA more allocated on the fly
+//   "optimal" - at most the surfaces requested with SetNumSurfaces(),
+//               starting with the component's own request
+// An exhausted bounded pool waits up to VPL_CPU_POOL_WAIT milliseconds
+//   for a surface to be released, then returns MFX_WRN_ALLOC_TIMEOUT_EXPIRED.
+//
+// Pools with a frame format carve their preallocated frames (all of them
+//   for a bounded pool) from one CpuFrameArena, further frames are allocated
+//   one by one. The arena comes from and goes back to CpuFrameCache.
+//
+// Pools keep the high-water mark of surfaces in use. With VPL_CPU_POOL_TRIM
+//   set to a number of milliseconds, or VPL_CPU_POOL_TRIM_COUNT to a number
+//   of surface requests, the frames allocated one by one that stayed above
+//   the mark for that long are freed when the next surface is requested.
+//   The preallocated surfaces are always kept. Trimming is off by default.
+//
+// With VPL_CPU_POOL_SHARED=1 (Linux only) frames are allocated in shared
+//   arenas, those allocated one by one in an arena each, so every frame
+//   can be exported to another process, see vplcpu/mfxcpushared.h.
 class CpuFramePool {
 public:
-    CpuFramePool() : m_surfaces(), m_info({}), m_framePoolInterface() {
+    // frames are allocated on the NUMA node of cpuSet, see CpuPlacement
+    explicit CpuFramePool(int cpuSet = CPU_SET_ANY)
+            : m_chunks(),
+              m_numSurfaces(0),
+              m_numLive(0),
+              m_retired(),
+              m_growMutex(),
+              m_freeHead(MakeHead(POOL_INDEX_NONE, 0)),
+              m_freeCond(),
+              m_numWaiters(0),
+              m_policy(MFX_ALLOCATION_UNLIMITED),
+              m_maxSurfaces(0xFFFFFFFF),
+              m_wait(0),
+              m_info({}),
+              m_arena(nullptr),
+              m_bWarmArena(false),
+              m_bShared(false),
+              m_heapBytes(0),
+              m_minSurfaces(0),
+              m_numInUse(0),
+              m_highWater(0),
+              m_trimWindow(0),
+              m_trimCount(0),
+              m_trimDeadline(0),
+              m_numRequests(0),
+              m_framePoolInterface(),
+              m_cpuSet(cpuSet) {
         // pass handle to this pool for use in external interface functions
         m_framePoolInterface.SetParentPool(this);
     }
 
+    ~CpuFramePool() {
+        // frames still referencing arena buffers keep it alive
+        if (m_arena)
+            CpuFrameCache::Put(GetCacheKey(), m_arena);
+    }
+
+    // pools with a frame format allocate frames in shared memory
+    static bool UsesSharedMemory();
+
     mfxStatus Init(mfxU32 nPoolSize);
     mfxStatus Init(mfxFrameInfo info, mfxU32 nPoolSize);
     mfxStatus GetFreeSurface(mfxFrameSurface1 **surface);
 
-    mfxU32 GetCurrentPoolSize() {
-        return (mfxU32)m_surfaces.size();
+    // called by CpuFrame when its last reference is released
+    void PushFreeSurface(CpuFrame *frame);
+
+    // called by CpuFrame when it took over data from outside the pool
+    void AdoptFrameData(CpuFrame *frame);
+
+    // MFX_ALLOCATION_OPTIMAL only, raise or lower the maximum pool size
+    mfxStatus SetNumSurfaces(mfxU32 numSurfaces);
+    mfxStatus RevokeSurfaces(mfxU32 numSurfaces);
+
+    mfxPoolAllocationPolicy GetAllocationPolicy() const {
+        return m_policy;
+    }
+
+    mfxU32 GetMaximumPoolSize() const {
+        return m_maxSurfaces;
     }
 
+    mfxU32 GetCurrentPoolSize() const {
+        return m_numLive;
+    }
+
+    // add the memory of this pool to the session's statistics
+    void AddMemoryStats(mfxCpuMemoryStats *stats);
+
 private:
-    std::vector<std::unique_ptr<CpuFrame>> m_surfaces;
+    typedef std::chrono::steady_clock Clock;
+
+    void SetPolicy(mfxU32 nPoolSize);
+    CpuFrameCacheKey GetCacheKey() const;
+    mfxStatus Preallocate(mfxU32 nPoolSize);
+    mfxStatus AllocateFrame(CpuFrame *frame);
+    void FreeFrameData(CpuFrame *frame);
+    mfxStatus AddSurface(CpuFrame **frame);
+    void RetireSurface(CpuFrame *frame);
+    void CountInUse();
+    bool IsTrimDue();
+    void TrimIdle();
+    mfxStatus WaitFreeSurface(CpuFrame **frame);
+    CpuFrame *TakeFreeSurface();
+    void LinkFreeSurface(CpuFrame *frame);
+    CpuFrame *PopFreeSurface();
+
+    CpuFrame *GetSurface(mfxU32 index) {
+        return m_chunks[index / POOL_CHUNK_SIZE][index % POOL_CHUNK_SIZE].get();
+    }
+
+    // The tag only repeats after 2^32 updates of the head. A stale
+    //   compare-exchange goes through only if the thread holding the old
+    //   head was stalled for exactly a multiple of that many pushes and
+    //   pops, and the same surface is on top again. At tens of nanoseconds
+    //   per update that is a stall of minutes between two adjacent
+    //   instructions, which is accepted rather than paying for a 128-bit
+    //   compare-exchange or hazard pointers.
+    static mfxU64 MakeHead(mfxU32 index, mfxU32 tag) {
+        return (static_cast<mfxU64>(tag) << 32) | index;
+    }
+
+    std::unique_ptr<std::unique_ptr<CpuFrame>[]> m_chunks[POOL_MAX_CHUNKS];
+    std::atomic<mfxU32> m_numSurfaces; // slots ever created
+    std::atomic<mfxU32> m_numLive; // slots not retired
+    std::vector<mfxU32> m_retired; // slots whose surface was revoked
+    std::mutex m_growMutex; // guards growing, retiring and the limit
+    std::atomic<mfxU64> m_freeHead;
+
+    std::condition_variable m_freeCond;
+    std::atomic<mfxU32> m_numWaiters;
+
+    mfxPoolAllocationPolicy m_policy;
+    std::atomic<mfxU32> m_maxSurfaces;
+    std::chrono::milliseconds m_wait;
+
     mfxFrameInfo m_info;
+    CpuFrameArena *m_arena;
+    bool m_bWarmArena; // taken from the cache, pages already placed
+    bool m_bShared;
+    std::atomic<size_t> m_heapBytes; // frame data allocated outside the arena
+
+    // idle trimming, the high-water mark covers the current window
+    mfxU32 m_minSurfaces;
+    std::atomic<mfxU32> m_numInUse;
+    std::atomic<mfxU32> m_highWater;
+    std::chrono::milliseconds m_trimWindow;
+    mfxU32 m_trimCount;
+    std::atomic<Clock::rep> m_trimDeadline;
+    std::atomic<mfxU32> m_numRequests;
 
     CpuFramePoolInterface m_framePoolInterface;
+    int m_cpuSet;
+
+    /* copy not allowed */
+    CpuFramePool(const CpuFramePool &);
+    CpuFramePool &operator=(const CpuFramePool &);
 };
 
 #endif // CPU_SRC_CPU_FRAME_POOL_H_
@@ -0,0 +1,333 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_scheduler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include "src/cpu_frame.h"
+#include "src/cpu_threads.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <pthread.h>
+    #include <sched.h>
+    #include <sys/resource.h>
+#endif
+
+// statuses of failed tasks which were never synced are dropped past this
+#define MAX_UNSYNCED_FAILURES 1024
+
+#define PIPELINE_ENV "VPL_CPU_PIPELINE"
+
+static inline mfxSyncPoint TaskIdToSyncPoint(mfxU64 id) {
+    return reinterpret_cast<mfxSyncPoint>(static_cast<uintptr_t>(id));
+}
+
+static inline mfxU64 SyncPointToTaskId(mfxSyncPoint syncp) {
+    return static_cast<mfxU64>(reinterpret_cast<uintptr_t>(syncp));
+}
+
+// nice is per thread on Linux, 'who' 0 is the calling thread
+static void SetCurrentThreadBackground(bool bBackground) {
+#if defined(__linux__)
+    setpriority(PRIO_PROCESS, 0, bBackground ? CPU_BACKGROUND_NICE : 0);
+#endif
+}
+
+static bool IsPipelineEnabled() {
+    const char *env = getenv(PIPELINE_ENV);
+    return env && !strcmp(env, "1");
+}
+
+std::atomic<mfxU64> CpuScheduler::s_nextId(1);
+
+CpuScheduler::CpuScheduler()
+        : m_mutex(),
+          m_cvSubmit(),
+          m_cvDone(),
+          m_queues(),
+          m_numQueues(IsPipelineEnabled() ? CPU_NUM_STAGES : 1),
+          m_pending(),
+          m_failed(),
+          m_producers(),
+          m_bStop(false),
+          m_policy(0),
+          m_priority(0),
+          m_cpuSet(CPU_SET_ANY),
+          m_bBackground(false) {}
+
+CpuScheduler::~CpuScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_cvSubmit.notify_all();
+
+    for (size_t i = 0; i < m_numQueues; i++) {
+        if (m_queues[i].worker.joinable())
+            m_queues[i].worker.join();
+    }
+}
+
+mfxStatus CpuScheduler::Submit(Task task,
+                               mfxSyncPoint *syncp,
+                               CpuStage stage,
+                               mfxFrameSurface1 *input,
+                               mfxFrameSurface1 *output,
+                               const void *owner,
+                               mfxPriority priority) {
+    RET_IF_FALSE(task && syncp, MFX_ERR_NULL_PTR);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        RET_IF_FALSE(!m_bStop, MFX_ERR_ABORTED);
+
+        TaskQueue *queue = &m_queues[(m_numQueues > 1) ? stage : 0];
+
+        // sessions which never queue work do not pay for a thread
+        if (!queue->worker.joinable()) {
+            queue->worker = std::thread(&CpuScheduler::WorkerThread, this, queue);
+            ApplyThreadScheduling(queue);
+        }
+
+        TaskEntry entry = { s_nextId++, std::move(task), 0, output, owner, priority };
+
+        // input may still be written by a task on another stage
+        if (input) {
+            auto it = m_producers.find(input);
+            if (it != m_producers.end())
+                entry.dependency = it->second;
+        }
+        if (output) {
+            m_producers[output] = entry.id;
+
+            // surface Synchronize() waits for this task
+            CpuFrame *frame = CpuFrame::TryCast(output);
+            if (frame)
+                frame->BeginWrite();
+        }
+
+        *syncp = TaskIdToSyncPoint(entry.id);
+        m_pending.insert(entry.id);
+        queue->tasks.push_back(std::move(entry));
+    }
+    m_cvSubmit.notify_all();
+
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuScheduler::Sync(mfxSyncPoint syncp, mfxU32 wait) {
+    // nothing was queued for a null sync point
+    if (!syncp)
+        return MFX_ERR_NONE;
+
+    mfxU64 id = SyncPointToTaskId(syncp);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    RET_IF_FALSE(id < s_nextId, MFX_ERR_NULL_PTR);
+
+    if (wait == MFX_INFINITE) {
+        m_cvDone.wait(lock, [&] {
+            return IsDone(id);
+        });
+    }
+    else if (!m_cvDone.wait_for(lock, std::chrono::milliseconds(wait), [&] {
+                 return IsDone(id);
+             })) {
+        return MFX_WRN_IN_EXECUTION;
+    }
+
+    auto it = m_failed.find(id);
+    if (it == m_failed.end())
+        return MFX_ERR_NONE;
+
+    mfxStatus sts = it->second.sts;
+    m_failed.erase(it);
+    return sts;
+}
+
+void CpuScheduler::WaitAll() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cvDone.wait(lock, [&] {
+        return m_pending.empty();
+    });
+}
+
+void CpuScheduler::TakeFailedTasks(CpuScheduler *other, const void *owner) {
+    std::lock(m_mutex, other->m_mutex);
+    std::lock_guard<std::mutex> lock(m_mutex, std::adopt_lock);
+    std::lock_guard<std::mutex> otherLock(other->m_mutex, std::adopt_lock);
+
+    for (auto it = other->m_failed.begin(); it != other->m_failed.end();) {
+        if (owner && it->second.owner != owner) {
+            ++it;
+            continue;
+        }
+        m_failed.insert(*it);
+        it = other->m_failed.erase(it);
+    }
+}
+
+mfxStatus CpuScheduler::Throttle(std::deque<mfxSyncPoint> *tasks, size_t limit, bool bWait) {
+    while (!tasks->empty()) {
+        bool bFull    = tasks->size() >= limit;
+        mfxStatus sts = Sync(tasks->front(), (bFull && bWait) ? MFX_INFINITE : 0);
+        if (sts == MFX_WRN_IN_EXECUTION)
+            return bFull ? MFX_WRN_DEVICE_BUSY : MFX_ERR_NONE;
+
+        tasks->pop_front();
+        RET_ERROR(sts);
+    }
+
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuScheduler::SetThreadScheduling(mfxI32 policy, mfxI32 priority) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    int minPriority = sched_get_priority_min(policy);
+    int maxPriority = sched_get_priority_max(policy);
+    RET_IF_FALSE(minPriority >= 0 && maxPriority >= 0, MFX_ERR_UNSUPPORTED);
+    RET_IF_FALSE(priority >= minPriority && priority <= maxPriority, MFX_ERR_UNSUPPORTED);
+#else
+    // POSIX scheduling policies do not apply
+    RET_IF_FALSE(policy == 0 && priority == 0, MFX_ERR_UNSUPPORTED);
+#endif
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_policy   = policy;
+    m_priority = priority;
+    for (size_t i = 0; i < m_numQueues; i++) {
+        if (m_queues[i].worker.joinable())
+            ApplyThreadScheduling(&m_queues[i]);
+    }
+
+    return MFX_ERR_NONE;
+}
+
+void CpuScheduler::SetCpuSet(int cpuSet) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cpuSet = cpuSet;
+    for (size_t i = 0; i < m_numQueues; i++) {
+        if (m_queues[i].worker.joinable())
+            ApplyThreadScheduling(&m_queues[i]);
+    }
+}
+
+void CpuScheduler::SetBackground(bool bBackground) {
+    // workers pick the change up before their next task
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bBackground = bBackground;
+}
+
+// called with m_mutex held
+void CpuScheduler::ApplyThreadScheduling(TaskQueue *queue) {
+    CpuPlacement::PinThread(&queue->worker, m_cpuSet);
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (m_policy == SCHED_OTHER && m_priority == 0)
+        return;
+
+    // best effort, real-time policies need privileges the process may not have
+    sched_param param    = {};
+    param.sched_priority = m_priority;
+    pthread_setschedparam(queue->worker.native_handle(), m_policy, &param);
+#endif
+}
+
+// called with m_mutex held
+// The front task can always start, a task of another session may go first
+//   if its priority is higher, it is the oldest one of its session and it
+//   does not wait for a task still in this queue.
+std::deque<CpuScheduler::TaskEntry>::iterator CpuScheduler::NextTask(TaskQueue *queue) {
+    auto next = queue->tasks.begin();
+
+    std::set<const void *> owners;
+    for (auto it = queue->tasks.begin(); it != queue->tasks.end(); ++it) {
+        // only the oldest task of each session is a candidate
+        if (!owners.insert(it->owner).second || it->priority <= next->priority)
+            continue;
+
+        if (it->dependency && !IsDone(it->dependency)) {
+            auto producer = std::find_if(queue->tasks.begin(),
+                                         queue->tasks.end(),
+                                         [&](const TaskEntry &queued) {
+                                             return queued.id == it->dependency;
+                                         });
+            if (producer != queue->tasks.end())
+                continue;
+        }
+
+        next = it;
+    }
+
+    return next;
+}
+
+void CpuScheduler::WorkerThread(TaskQueue *queue) {
+    bool bBackground = false;
+
+    for (;;) {
+        TaskEntry entry;
+        bool bSetBackground = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cvSubmit.wait(lock, [&] {
+                return m_bStop || !queue->tasks.empty();
+            });
+
+            // queued work is always finished before the worker exits
+            if (queue->tasks.empty())
+                return;
+
+            auto next = NextTask(queue);
+            entry     = std::move(*next);
+            queue->tasks.erase(next);
+
+            if (bBackground != m_bBackground) {
+                bBackground    = m_bBackground;
+                bSetBackground = true;
+            }
+
+            // tasks of earlier stages are always queued first, and NextTask
+            //   skips tasks waiting in the same queue, so this cannot wait
+            //   on a task behind it
+            if (entry.dependency) {
+                m_cvDone.wait(lock, [&] {
+                    return IsDone(entry.dependency);
+                });
+            }
+        }
+
+        if (bSetBackground)
+            SetCurrentThreadBackground(bBackground);
+
+        mfxStatus sts = entry.task();
+
+        // before the task is retired, components free their frame pools
+        //   once all their tasks are done
+        CpuFrame *frame = CpuFrame::TryCast(entry.output);
+        if (frame)
+            frame->EndWrite(sts);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (sts != MFX_ERR_NONE) {
+                if (m_failed.size() >= MAX_UNSYNCED_FAILURES)
+                    m_failed.erase(m_failed.begin());
+                m_failed[entry.id] = { sts, entry.owner };
+            }
+
+            if (entry.output) {
+                auto it = m_producers.find(entry.output);
+                if (it != m_producers.end() && it->second == entry.id)
+                    m_producers.erase(it);
+            }
+            m_pending.erase(entry.id);
+        }
+        m_cvDone.notify_all();
+    }
+}
@@ -0,0 +1,137 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_SCHEDULER_H_
+#define CPU_SRC_CPU_SCHEDULER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include "src/cpu_common.h"
+
+// Components queueing work, each one is a separate pipeline stage
+//   when the scheduler runs pipelined
+enum CpuStage { CPU_STAGE_DECODE = 0, CPU_STAGE_VPP, CPU_STAGE_ENCODE, CPU_NUM_STAGES };
+
+// Per-session task queue
+// Work submitted by the *Async() entry points runs here in submission
+//   order on a worker thread owned by the session. The mfxSyncPoint handed
+//   back to the application identifies the task, so SyncOperation() can
+//   wait for it. Joined sessions share one scheduler, task ids are unique
+//   across all schedulers so sync points stay valid after a join.
+// With VPL_CPU_PIPELINE=1 in the environment every stage gets its own
+//   queue and worker, so decode, VPP and encode of consecutive frames
+//   overlap. A task reading a surface then waits for the task that
+//   writes it, whichever stage that runs on. Internal frames written by a
+//   task are marked pending until it finishes, see CpuFrame::Synchronize().
+// Tasks carry the priority of the session queueing them. A worker runs
+//   the highest priority task it can start, tasks of one session still run
+//   in submission order.
+class CpuScheduler {
+public:
+    typedef std::function<mfxStatus()> Task;
+
+    CpuScheduler();
+    ~CpuScheduler();
+
+    // queue a task of session 'owner' and return its sync point, input is
+    //   a surface the task reads and output one it writes
+    mfxStatus Submit(Task task,
+                     mfxSyncPoint *syncp,
+                     CpuStage stage,
+                     mfxFrameSurface1 *input,
+                     mfxFrameSurface1 *output,
+                     const void *owner,
+                     mfxPriority priority);
+
+    // wait up to 'wait' ms for the task, returns MFX_WRN_IN_EXECUTION on
+    //   timeout, otherwise the status of the task
+    mfxStatus Sync(mfxSyncPoint syncp, mfxU32 wait);
+
+    // wait for every queued task to complete
+    void WaitAll();
+
+    // Retire completed tasks from the front of a component's in-flight
+    //   list until fewer than 'limit' remain. If the list is still full,
+    //   waits for the oldest task when bWait is set, otherwise returns
+    //   MFX_WRN_DEVICE_BUSY. Errors of retired tasks are returned.
+    mfxStatus Throttle(std::deque<mfxSyncPoint> *tasks, size_t limit, bool bWait);
+
+    // scheduling policy (SCHED_*) and priority of the worker threads,
+    //   returns MFX_ERR_UNSUPPORTED for values the platform does not accept
+    mfxStatus SetThreadScheduling(mfxI32 policy, mfxI32 priority);
+
+    // CPU set of the worker threads, see CpuPlacement
+    void SetCpuSet(int cpuSet);
+
+    // lower OS priority of the worker threads, best effort since raising it
+    //   again may need privileges
+    void SetBackground(bool bBackground);
+
+    // keep the statuses of failed tasks from another scheduler that is
+    //   being replaced by this one, only those of owner if not nullptr
+    void TakeFailedTasks(CpuScheduler *other, const void *owner = nullptr);
+
+private:
+    struct TaskEntry {
+        mfxU64 id;
+        Task task;
+        mfxU64 dependency;
+        mfxFrameSurface1 *output;
+        const void *owner;
+        mfxPriority priority;
+    };
+
+    struct FailedTask {
+        mfxStatus sts;
+        const void *owner;
+    };
+
+    struct TaskQueue {
+        std::deque<TaskEntry> tasks;
+        std::thread worker;
+    };
+
+    void WorkerThread(TaskQueue *queue);
+    void ApplyThreadScheduling(TaskQueue *queue);
+    std::deque<TaskEntry>::iterator NextTask(TaskQueue *queue);
+    bool IsDone(mfxU64 id) const {
+        return m_pending.find(id) == m_pending.end();
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cvSubmit;
+    std::condition_variable m_cvDone;
+    TaskQueue m_queues[CPU_NUM_STAGES];
+    size_t m_numQueues;
+
+    // ids of queued and running tasks - failed tasks keep their status
+    //   until synced
+    std::set<mfxU64> m_pending;
+    std::map<mfxU64, FailedTask> m_failed;
+
+    // last task writing each surface, until it completes
+    std::map<mfxFrameSurface1 *, mfxU64> m_producers;
+
+    bool m_bStop;
+    mfxI32 m_policy;
+    mfxI32 m_priority;
+    int m_cpuSet;
+    bool m_bBackground;
+
+    static std::atomic<mfxU64> s_nextId;
+
+    /* copy not allowed */
+    CpuScheduler(const CpuScheduler &);
+    CpuScheduler &operator=(const CpuScheduler &);
+};
+
+#endif // CPU_SRC_CPU_SCHEDULER_H_
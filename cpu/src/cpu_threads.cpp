@@ -0,0 +1,227 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_threads.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+    #include <pthread.h>
+    #include <sys/resource.h>
+#endif
+
+#define MAX_THREADS_ENV       "VPL_CPU_MAX_THREADS"
+#define EXPECTED_CONTEXTS_ENV "VPL_CPU_EXPECTED_CONTEXTS"
+#define AFFINITY_ENV          "VPL_CPU_AFFINITY"
+
+#define DEFAULT_EXPECTED_CONTEXTS 2
+
+static std::mutex g_budgetMutex;
+static int g_threadsInUse = 0;
+static int g_numContexts  = 0;
+static int g_peakContexts = 0;
+
+static int ReadPositiveEnv(const char *name, int defaultValue) {
+    const char *env = getenv(name);
+    if (env) {
+        int value = atoi(env);
+        if (value > 0)
+            return value;
+    }
+    return defaultValue;
+}
+
+static int ReadMaxThreads() {
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    return ReadPositiveEnv(MAX_THREADS_ENV, (threads > 0) ? threads : 1);
+}
+
+int CpuThreadBudget::GetMaxThreads() {
+    static const int maxThreads = ReadMaxThreads();
+    return maxThreads;
+}
+
+static int GetExpectedContexts() {
+    static const int expectedContexts =
+        ReadPositiveEnv(EXPECTED_CONTEXTS_ENV, DEFAULT_EXPECTED_CONTEXTS);
+    return expectedContexts;
+}
+
+int CpuThreadBudget::Acquire(int requested) {
+    int maxThreads = GetMaxThreads();
+
+    std::lock_guard<std::mutex> lock(g_budgetMutex);
+
+    g_numContexts++;
+    g_peakContexts = std::max(g_peakContexts, g_numContexts);
+
+    int threads = requested;
+    if (threads <= 0) {
+        // leave room for the contexts expected to open after this one
+        int contexts = std::max(GetExpectedContexts(), g_peakContexts);
+        threads      = std::max(1, maxThreads / contexts);
+    }
+
+    // limited to what is left, a context always gets one thread
+    threads = std::max(1, std::min(threads, maxThreads - g_threadsInUse));
+    g_threadsInUse += threads;
+
+    return threads;
+}
+
+void CpuThreadBudget::Release(int threads) {
+    std::lock_guard<std::mutex> lock(g_budgetMutex);
+
+    g_threadsInUse -= threads;
+    g_numContexts--;
+}
+
+int CpuThreadBudget::AcquireSpare(int requested) {
+    int maxThreads = GetMaxThreads();
+
+    std::lock_guard<std::mutex> lock(g_budgetMutex);
+
+    int threads = std::max(0, std::min(requested, maxThreads - g_threadsInUse));
+    g_threadsInUse += threads;
+
+    return threads;
+}
+
+void CpuThreadBudget::ReleaseSpare(int threads) {
+    std::lock_guard<std::mutex> lock(g_budgetMutex);
+
+    g_threadsInUse -= threads;
+}
+
+#if defined(__linux__)
+// parse one set in taskset list format ("0-3,8,10-11"), false if malformed
+static bool ParseCpuSet(const std::string &list, cpu_set_t *cpuSet) {
+    CPU_ZERO(cpuSet);
+
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+
+        std::string range = list.substr(pos, end - pos);
+        size_t dash       = range.find('-');
+        char *rest        = nullptr;
+
+        long first = strtol(range.c_str(), &rest, 10);
+        long last  = first;
+        if (rest == range.c_str())
+            return false;
+        if (dash != std::string::npos) {
+            const char *lastStr = range.c_str() + dash + 1;
+            last                = strtol(lastStr, &rest, 10);
+            if (rest == lastStr)
+                return false;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+            return false;
+
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, cpuSet);
+
+        pos = end + 1;
+    }
+
+    return CPU_COUNT(cpuSet) > 0;
+}
+
+static std::vector<cpu_set_t> ReadCpuSets() {
+    std::vector<cpu_set_t> cpuSets;
+
+    const char *env = getenv(AFFINITY_ENV);
+    if (!env)
+        return cpuSets;
+
+    std::string sets(env);
+    size_t pos = 0;
+    while (pos <= sets.size()) {
+        size_t end = sets.find(';', pos);
+        if (end == std::string::npos)
+            end = sets.size();
+
+        cpu_set_t cpuSet;
+        if (end > pos && ParseCpuSet(sets.substr(pos, end - pos), &cpuSet))
+            cpuSets.push_back(cpuSet);
+
+        pos = end + 1;
+    }
+
+    return cpuSets;
+}
+
+static const std::vector<cpu_set_t> &GetCpuSets() {
+    static const std::vector<cpu_set_t> cpuSets = ReadCpuSets();
+    return cpuSets;
+}
+#endif
+
+int CpuPlacement::AssignCpuSet() {
+#if defined(__linux__)
+    static std::atomic<int> nextSet(0);
+
+    int numSets = static_cast<int>(GetCpuSets().size());
+    if (numSets)
+        return nextSet++ % numSets;
+#endif
+    return CPU_SET_ANY;
+}
+
+void CpuPlacement::PinThread(std::thread *thread, int cpuSet) {
+#if defined(__linux__)
+    if (cpuSet == CPU_SET_ANY || !thread->joinable())
+        return;
+
+    const cpu_set_t &mask = GetCpuSets()[cpuSet];
+    pthread_setaffinity_np(thread->native_handle(), sizeof(cpu_set_t), &mask);
+#endif
+}
+
+void CpuPlacement::Run(int cpuSet, bool bBackground, const std::function<void()> &fn) {
+#if defined(__linux__)
+    if (bBackground) {
+        // nice is per thread on Linux and inherited by the threads it starts
+        std::thread helper([&]() {
+            setpriority(PRIO_PROCESS, 0, CPU_BACKGROUND_NICE);
+            CpuPlacementScope placement(cpuSet);
+            fn();
+        });
+        helper.join();
+        return;
+    }
+#endif
+    CpuPlacementScope placement(cpuSet);
+    fn();
+}
+
+CpuPlacementScope::CpuPlacementScope(int cpuSet) : m_bPinned(false) {
+#if defined(__linux__)
+    if (cpuSet == CPU_SET_ANY)
+        return;
+
+    pthread_t self = pthread_self();
+    if (pthread_getaffinity_np(self, sizeof(cpu_set_t), &m_prevMask))
+        return;
+
+    const cpu_set_t &mask = GetCpuSets()[cpuSet];
+    m_bPinned             = (pthread_setaffinity_np(self, sizeof(cpu_set_t), &mask) == 0);
+#endif
+}
+
+CpuPlacementScope::~CpuPlacementScope() {
+#if defined(__linux__)
+    if (m_bPinned)
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &m_prevMask);
+#endif
+}
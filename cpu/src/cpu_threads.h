@@ -0,0 +1,96 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_THREADS_H_
+#define CPU_SRC_CPU_THREADS_H_
+
+#include <functional>
+#include <thread>
+
+#if defined(__linux__)
+    #include <sched.h>
+#endif
+
+// no placement configured, threads run on any CPU
+#define CPU_SET_ANY -1
+
+// nice value of the worker and codec threads of background sessions
+#define CPU_BACKGROUND_NICE 10
+
+// Process-wide codec thread budget
+// Every codec context asks for its threads here instead of letting libav
+//   start one thread per core, so the total across all sessions stays near
+//   the budget. Set VPL_CPU_MAX_THREADS to change it, the default is the
+//   number of hardware threads.
+// A context's share is the budget split across the contexts expected to be
+//   open at once: VPL_CPU_EXPECTED_CONTEXTS (default 2, the decoder and
+//   encoder of a transcode), or more once more were seen open together.
+//   libav fixes the thread count at open, so threads released by a closed
+//   context go to the contexts opened after it.
+class CpuThreadBudget {
+public:
+    // threads for a new codec context, always at least 1
+    // a non-zero request is clamped to what is left of the budget
+    static int Acquire(int requested = 0);
+
+    // return the threads of a closed codec context
+    static void Release(int threads);
+
+    // threads for short work on helper threads, e.g. striped copies, only
+    //   what is left of the budget (may be 0), not counted as a context
+    static int AcquireSpare(int requested);
+    static void ReleaseSpare(int threads);
+
+    static int GetMaxThreads();
+
+private:
+    CpuThreadBudget();
+};
+
+// Session placement on CPU sets
+// VPL_CPU_AFFINITY lists CPU sets separated by ';', each one in taskset
+//   list format, e.g. "0-15;16-31" for the two sockets of a dual-socket
+//   host. New sessions take the sets in turn. A session's worker and codec
+//   threads run on its set, and its internal frames are first touched
+//   there so their pages land on the matching NUMA node.
+class CpuPlacement {
+public:
+    // set for a new session, CPU_SET_ANY when VPL_CPU_AFFINITY is not set
+    static int AssignCpuSet();
+
+    // best effort, does nothing for CPU_SET_ANY
+    static void PinThread(std::thread *thread, int cpuSet);
+
+    // Run fn so that threads it starts are on cpuSet and, for background
+    //   sessions, at CPU_BACKGROUND_NICE (Linux). The nice value is set on a
+    //   helper thread fn runs on, as the calling thread could not lower its
+    //   own again without privileges.
+    static void Run(int cpuSet, bool bBackground, const std::function<void()> &fn);
+
+private:
+    CpuPlacement();
+};
+
+// Pins the calling thread to a CPU set until the end of the scope
+// Threads libav starts inside the scope inherit the set, and memory first
+//   written inside it is placed on the local node.
+class CpuPlacementScope {
+public:
+    explicit CpuPlacementScope(int cpuSet);
+    ~CpuPlacementScope();
+
+private:
+    bool m_bPinned;
+#if defined(__linux__)
+    cpu_set_t m_prevMask;
+#endif
+
+    /* copy not allowed */
+    CpuPlacementScope(const CpuPlacementScope &);
+    CpuPlacementScope &operator=(const CpuPlacementScope &);
+};
+
+#endif // CPU_SRC_CPU_THREADS_H_
@@ -9,6 +9,7 @@
 #include <string>
 #include <utility>
 #include <vector>
+#include "src/cpu_threads.h"
 #include "src/cpu_workstream.h"
 
 // vpp in/out type
@@ -18,8 +19,13 @@ CpuVPP::CpuVPP()
         : m_vpp_graph(nullptr),
           m_buffersrc_ctx(nullptr),
           m_buffersink_ctx(nullptr),
+          m_filterThreads(0),
           m_input_locker(),
           m_avVppFrameOut(nullptr),
+          m_outScaler(nullptr),
+          m_vppTasks(),
+          m_deadline(),
+          m_numFrames(0),
           m_vppFunc(0),
           m_param(),
           m_vppSurfacesIn(),
@@ -49,6 +55,10 @@ bool CpuVPP::InitFilters(void) {
         return false;
     }
 
+    // threads asked for by the session, otherwise a share of the process-wide budget
+    m_filterThreads         = CpuThreadBudget::Acquire(m_session->GetNumThread());
+    m_vpp_graph->nb_threads = m_filterThreads;
+
     snprintf(buffersrc_fmt,
              sizeof(buffersrc_fmt),
              "video_size=%ux%u:pix_fmt=%d:time_base=%u/%u", //:pixel_aspect=1/1",
@@ -83,41 +93,24 @@ bool CpuVPP::InitFilters(void) {
         return false;
     }
 
-    // scale
-    if (m_vppFunc & VPL_VPP_SCALE) {
-        snprintf(m_vpp_filter_desc,
-                 sizeof(m_vpp_filter_desc),
-                 "scale=%u:%u",
-                 (unsigned int)m_param.vpp.Out.Width,
-                 (unsigned int)m_param.vpp.Out.Height);
-    }
+    // Without a background to compose, scaling and color conversion are
+    //   left out of the graph, m_outScaler writes them straight into the
+    //   output surface in its own pitch.
+    bool bComposite = (m_vppFunc & VPL_VPP_CROP) &&
+                      (m_param.vpp.Out.Width != m_param.vpp.Out.CropW ||
+                       m_param.vpp.Out.Height != m_param.vpp.Out.CropH);
 
     // crop - do crop and scale to match msdk feature
     if (m_vppFunc & VPL_VPP_CROP) {
         // no need background
-        if (m_param.vpp.Out.Width == m_param.vpp.Out.CropW &&
-            m_param.vpp.Out.Height == m_param.vpp.Out.CropH) {
-            if (m_param.vpp.In.CropW == m_param.vpp.Out.CropW &&
-                m_param.vpp.In.CropH == m_param.vpp.Out.CropH) {
-                snprintf(m_vpp_filter_desc,
-                         sizeof(m_vpp_filter_desc),
-                         "crop=%u:%u:%u:%u",
-                         (unsigned int)m_param.vpp.In.CropW,
-                         (unsigned int)m_param.vpp.In.CropH,
-                         (unsigned int)m_param.vpp.In.CropX,
-                         (unsigned int)m_param.vpp.In.CropY);
-            }
-            else {
-                snprintf(m_vpp_filter_desc,
-                         sizeof(m_vpp_filter_desc),
-                         "crop=%u:%u:%u:%u,scale=%u:%u",
-                         (unsigned int)m_param.vpp.In.CropW,
-                         (unsigned int)m_param.vpp.In.CropH,
-                         (unsigned int)m_param.vpp.In.CropX,
-                         (unsigned int)m_param.vpp.In.CropY,
-                         (unsigned int)m_param.vpp.Out.CropW,
-                         (unsigned int)m_param.vpp.Out.CropH);
-            }
+        if (!bComposite) {
+            snprintf(m_vpp_filter_desc,
+                     sizeof(m_vpp_filter_desc),
+                     "crop=%u:%u:%u:%u",
+                     (unsigned int)m_param.vpp.In.CropW,
+                     (unsigned int)m_param.vpp.In.CropH,
+                     (unsigned int)m_param.vpp.In.CropX,
+                     (unsigned int)m_param.vpp.In.CropY);
         }
         else {
             std::string f_split     = "split=2[bg][main];";
@@ -158,8 +151,14 @@ bool CpuVPP::InitFilters(void) {
         m_vppFunc |= VPL_VPP_CSC;
     }
 
+    if (!bComposite && !InitOutScaler()) {
+        printf("cannot create output scaler\n");
+        CloseFilterPads(buffersrc_out_pad, buffersink_in_pad);
+        return false;
+    }
+
     // csc - set pixel format of buffersink
-    if (m_vppFunc & VPL_VPP_CSC) {
+    if ((m_vppFunc & VPL_VPP_CSC) && bComposite) {
         AVPixelFormat csc_dst_fmt     = MFXFourCC2AVPixelFormat(m_param.vpp.Out.FourCC);
         enum AVPixelFormat pix_fmts[] = { csc_dst_fmt, AV_PIX_FMT_NONE };
 
@@ -232,6 +231,33 @@ bool CpuVPP::InitFilters(void) {
     }
 }
 
+// scaler from the graph output to the output surfaces, none when the graph
+//   output already has the size and format of the output
+bool CpuVPP::InitOutScaler() {
+    bool bCrop           = (m_vppFunc & VPL_VPP_CROP) != 0;
+    int srcWidth         = bCrop ? m_param.vpp.In.CropW : m_param.vpp.In.Width;
+    int srcHeight        = bCrop ? m_param.vpp.In.CropH : m_param.vpp.In.Height;
+    AVPixelFormat srcFmt = MFXFourCC2AVPixelFormat(m_param.vpp.In.FourCC);
+    AVPixelFormat dstFmt = MFXFourCC2AVPixelFormat(m_param.vpp.Out.FourCC);
+
+    if (srcWidth == m_param.vpp.Out.Width && srcHeight == m_param.vpp.Out.Height &&
+        srcFmt == dstFmt)
+        return true;
+
+    // same filter as the scale filter's default
+    m_outScaler = sws_getContext(srcWidth,
+                                 srcHeight,
+                                 srcFmt,
+                                 m_param.vpp.Out.Width,
+                                 m_param.vpp.Out.Height,
+                                 dstFmt,
+                                 SWS_BICUBIC,
+                                 nullptr,
+                                 nullptr,
+                                 nullptr);
+    return m_outScaler != nullptr;
+}
+
 void CpuVPP::CloseFilterPads(AVFilterInOut *src_out, AVFilterInOut *sink_in) {
     if (src_out)
         avfilter_inout_free(&src_out);
@@ -440,25 +466,44 @@ mfxStatus CpuVPP::InitVPP(mfxVideoParam *par) {
         m_vppFunc |= VPL_VPP_SCALE;
     }
 
-    if (InitFilters() == false)
+    // filter graph threads started here stay on the session's CPUs and priority
+    bool bFilters = false;
+    m_session->RunPlaced([&]() {
+        bFilters = InitFilters();
+    });
+    if (bFilters == false)
         return MFX_ERR_NOT_INITIALIZED;
 
     m_avVppFrameOut = av_frame_alloc();
     if (!m_avVppFrameOut)
         return MFX_ERR_NOT_INITIALIZED;
 
+    m_deadline.Init(m_param.vpp.In, m_param.AsyncDepth);
+
     return valSts;
 }
 
 CpuVPP::~CpuVPP() {
+    // queued frames reference this instance
+    if (!m_vppTasks.empty())
+        m_session->GetScheduler()->WaitAll();
+
     if (m_avVppFrameOut) {
         av_frame_free(&m_avVppFrameOut);
     }
 
+    if (m_outScaler) {
+        sws_freeContext(m_outScaler);
+        m_outScaler = nullptr;
+    }
+
     if (m_vpp_graph) {
         avfilter_graph_free(&m_vpp_graph);
         m_vpp_graph = nullptr;
     }
+
+    if (m_filterThreads)
+        CpuThreadBudget::Release(m_filterThreads);
 }
 
 mfxStatus CpuVPP::ProcessFrame(mfxFrameSurface1 *surface_in,
@@ -466,9 +511,9 @@ mfxStatus CpuVPP::ProcessFrame(mfxFrameSurface1 *surface_in,
                                mfxExtVppAuxData *aux) {
     bool bWA_alignment = false;
 
-    // Try get AVFrame from surface_out
+    // Try get AVFrame from surface_out, the scaler writes into it instead
     AVFrame *dst_avframe = nullptr;
-    CpuFrame *dst_frame  = CpuFrame::TryCast(surface_out);
+    CpuFrame *dst_frame  = m_outScaler ? nullptr : CpuFrame::TryCast(surface_out);
     if (dst_frame) {
         dst_avframe = dst_frame->GetAVFrame();
 
@@ -478,6 +523,7 @@ mfxStatus CpuVPP::ProcessFrame(mfxFrameSurface1 *surface_in,
         // So, there's data misalignment when app processes data.
         // We copy avframe data to mfx data to meet expecting pitch size instead of
         // delievering memory pointer
+        // Scaled and converted output never gets here, see ScaleToSurface().
         bWA_alignment = NeedWAForAlignment(&surface_out->Info, (int *)dst_avframe->linesize);
 
         // Do not unref because we do copy
@@ -506,7 +552,12 @@ mfxStatus CpuVPP::ProcessFrame(mfxFrameSurface1 *surface_in,
     }
     RET_IF_FALSE(ret >= 0, MFX_ERR_ABORTED);
 
-    if (dst_avframe == m_avVppFrameOut) { // copy image data
+    if (m_outScaler) { // scale into the surface memory
+        mfxStatus sts = ScaleToSurface(m_avVppFrameOut, surface_out);
+        av_frame_unref(m_avVppFrameOut);
+        RET_ERROR(sts);
+    }
+    else if (dst_avframe == m_avVppFrameOut) { // copy image data
         RET_ERROR(
             AVFrame2mfxFrameSurface(surface_out, m_avVppFrameOut, m_session->GetFrameAllocator()));
         av_frame_unref(m_avVppFrameOut);
@@ -522,6 +573,117 @@ mfxStatus CpuVPP::ProcessFrame(mfxFrameSurface1 *surface_in,
         }
     }
 
+    UpdateOutputInfo(surface_in, surface_out);
+    return MFX_ERR_NONE;
+}
+
+// Scale and convert the graph output into surface_out, in the pitch of
+//   the surface. Internal frames get a buffer of their own if they share
+//   one with an earlier output.
+mfxStatus CpuVPP::ScaleToSurface(AVFrame *src, mfxFrameSurface1 *surface_out) {
+    CpuFrame *dst_frame = CpuFrame::TryCast(surface_out);
+    if (dst_frame) {
+        AVFrame *avframe = dst_frame->GetAVFrame();
+        RET_IF_FALSE(avframe, MFX_ERR_NULL_PTR);
+        if (!avframe->buf[0] || !av_frame_is_writable(avframe)) {
+            av_frame_unref(avframe);
+            RET_ERROR(dst_frame->Allocate(m_param.vpp.Out.FourCC,
+                                          m_param.vpp.Out.Width,
+                                          m_param.vpp.Out.Height));
+        }
+    }
+
+    FrameLock locker;
+    AVFrame *dst = locker.GetAVFrame(surface_out, MFX_MAP_WRITE, m_session->GetFrameAllocator());
+    RET_IF_FALSE(dst, MFX_ERR_LOCK_MEMORY);
+
+    int ret = sws_scale(m_outScaler,
+                        src->data,
+                        src->linesize,
+                        0,
+                        src->height,
+                        dst->data,
+                        dst->linesize);
+    RET_IF_FALSE(ret > 0, MFX_ERR_ABORTED);
+
+    if (dst_frame) {
+        RET_ERROR(dst_frame->Update());
+    }
+    else {
+        surface_out->Info.CropX = 0;
+        surface_out->Info.CropY = 0;
+    }
+
+    if (src->pts) {
+        surface_out->Data.TimeStamp = src->pts;
+        surface_out->Data.DataFlag  = MFX_FRAMEDATA_ORIGINAL_TIMESTAMP;
+    }
+
+    return MFX_ERR_NONE;
+}
+
+// Queues the frame on the session worker. The filter graph returns one
+//   frame per input, so the status is known without waiting: a queued frame
+//   always produces output, draining (surface_in == nullptr) never does.
+//   With AsyncDepth set, MFX_WRN_DEVICE_BUSY is returned while AsyncDepth
+//   frames are in flight, otherwise the call waits for a free slot.
+mfxStatus CpuVPP::ProcessFrame(mfxFrameSurface1 *surface_in,
+                               mfxFrameSurface1 *surface_out,
+                               mfxExtVppAuxData *aux,
+                               mfxSyncPoint *syncp) {
+    CpuScheduler *scheduler = m_session->GetScheduler();
+
+    if (surface_in && m_param.AsyncDepth) {
+        mfxStatus sts = scheduler->Throttle(&m_vppTasks, m_param.AsyncDepth, false);
+        if (sts != MFX_ERR_NONE)
+            return sts;
+    }
+    else {
+        // one frame at a time, draining waits for it as well
+        RET_ERROR(scheduler->Throttle(&m_vppTasks, 1, true));
+    }
+
+    if (!surface_in)
+        return ProcessFrame(nullptr, surface_out, aux);
+
+    // a late session gives up the frame, the application sends the next one
+    if (m_deadline.ShouldDrop(m_vppTasks.size()))
+        return MFX_ERR_MORE_DATA;
+
+    CpuDeadline::Clock::time_point deadline = m_deadline.Arrive();
+
+    // timestamp and crop do not depend on the frame contents
+    UpdateOutputInfo(surface_in, surface_out);
+
+    mfxSyncPoint taskSyncp = nullptr;
+    HoldSurface(surface_in);
+    HoldSurface(surface_out);
+    mfxStatus submitSts = m_session->Submit(
+        [this, surface_in, surface_out, aux, deadline]() {
+            mfxStatus sts = ProcessFrame(surface_in, surface_out, aux);
+            ReleaseSurface(surface_in);
+            ReleaseSurface(surface_out);
+            m_deadline.Complete(deadline);
+            return sts;
+        },
+        &taskSyncp,
+        CPU_STAGE_VPP,
+        surface_in,
+        surface_out);
+    if (submitSts != MFX_ERR_NONE) {
+        ReleaseSurface(surface_in);
+        ReleaseSurface(surface_out);
+        return submitSts;
+    }
+
+    m_vppTasks.push_back(taskSyncp);
+    m_numFrames++;
+    *syncp = taskSyncp;
+
+    return MFX_ERR_NONE;
+}
+
+void CpuVPP::UpdateOutputInfo(mfxFrameSurface1 *surface_in, mfxFrameSurface1 *surface_out) {
     // fix cropW, cropH
     if (surface_out) {
         surface_out->Info.CropW = (m_param.vpp.Out.CropW > m_param.vpp.Out.Width)
@@ -540,7 +702,6 @@ mfxStatus CpuVPP::ProcessFrame(mfxFrameSurface1 *surface_in,
             }
         }
     }
-    return MFX_ERR_NONE;
 }
 
 mfxStatus CpuVPP::VPPQuery(mfxVideoParam *in, mfxVideoParam *out) {
@@ -602,13 +763,17 @@ mfxStatus CpuVPP::VPPQuery(mfxVideoParam *in, mfxVideoParam *out) {
 mfxStatus CpuVPP::VPPQueryIOSurf(mfxVideoParam *par, mfxFrameAllocRequest request[2]) {
     mfxStatus sts;
 
+    // every frame in flight holds one input and one output surface, the
+    //   filter graph returns a frame per input and keeps none
+    mfxU16 asyncDepth = par ? par->AsyncDepth : 0;
+
     // VPP_IN
     request[VPP_IN].NumFrameMin       = 1;
-    request[VPP_IN].NumFrameSuggested = 1;
+    request[VPP_IN].NumFrameSuggested = 1 + asyncDepth;
 
     //VPP_OUT
     request[VPP_OUT].NumFrameMin       = 1;
-    request[VPP_OUT].NumFrameSuggested = 1;
+    request[VPP_OUT].NumFrameSuggested = 1 + asyncDepth;
 
     // may be null for internal use
     if (par) {
@@ -693,12 +858,34 @@ mfxStatus CpuVPP::GetVideoParam(mfxVideoParam *par) {
     return MFX_ERR_NONE;
 }
 
+mfxStatus CpuVPP::GetVPPStat(mfxVPPStat *stat) {
+    RET_IF_FALSE(stat, MFX_ERR_NULL_PTR);
+
+    stat->NumFrame       = m_numFrames;
+    stat->NumCachedFrame = static_cast<mfxU32>(m_vppTasks.size());
+
+    return MFX_ERR_NONE;
+}
+
+void CpuVPP::AddMemoryStats(mfxCpuMemoryStats *stats) {
+    if (m_vppSurfacesIn)
+        m_vppSurfacesIn->AddMemoryStats(stats);
+    if (m_vppSurfacesOut)
+        m_vppSurfacesOut->AddMemoryStats(stats);
+
+    // the filter graph allocates one output picture per frame
+    if (m_vpp_graph) {
+        mfxFrameInfo *info = &m_param.vpp.Out;
+        stats->CodecBytes += CpuFrame::GetBufferSize(info->FourCC, info->Width, info->Height);
+    }
+}
+
 mfxStatus CpuVPP::GetVPPSurface(mfxFrameSurface1 **surface) {
     if (!m_vppSurfacesIn) {
         mfxFrameAllocRequest VPPRequest[2] = { 0 };
-        VPPQueryIOSurf(nullptr, VPPRequest);
+        RET_ERROR(VPPQueryIOSurf(&m_param, VPPRequest));
 
-        auto pool = std::make_unique<CpuFramePool>();
+        auto pool = std::make_unique<CpuFramePool>(m_session->GetCpuSet());
         RET_ERROR(pool->Init(m_param.vpp.In, VPPRequest[0].NumFrameSuggested));
         m_vppSurfacesIn = std::move(pool);
     }
@@ -719,9 +906,9 @@ mfxStatus CpuVPP::GetVPPSurface(mfxFrameSurface1 **surface) {
 mfxStatus CpuVPP::GetVPPSurfaceOut(mfxFrameSurface1 **surface) {
     if (!m_vppSurfacesOut) {
         mfxFrameAllocRequest VPPRequest[2] = { 0 };
-        VPPQueryIOSurf(nullptr, VPPRequest);
+        RET_ERROR(VPPQueryIOSurf(&m_param, VPPRequest));
 
-        auto pool = std::make_unique<CpuFramePool>();
+        auto pool = std::make_unique<CpuFramePool>(m_session->GetCpuSet());
         RET_ERROR(pool->Init(m_param.vpp.Out, VPPRequest[1].NumFrameSuggested));
         m_vppSurfacesOut = std::move(pool);
     }
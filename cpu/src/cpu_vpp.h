@@ -7,9 +7,11 @@
 #ifndef CPU_SRC_CPU_VPP_H_
 #define CPU_SRC_CPU_VPP_H_
 
+#include <deque>
 #include <memory>
 #include <vector>
 #include "src/cpu_common.h"
+#include "src/cpu_deadline.h"
 #include "src/cpu_frame_pool.h"
 #include "src/frame_lock.h"
 
@@ -65,19 +67,34 @@ public:
     mfxStatus ProcessFrame(mfxFrameSurface1 *surface_in,
                            mfxFrameSurface1 *surface_out,
                            mfxExtVppAuxData *aux);
+    mfxStatus ProcessFrame(mfxFrameSurface1 *surface_in,
+                           mfxFrameSurface1 *surface_out,
+                           mfxExtVppAuxData *aux,
+                           mfxSyncPoint *syncp);
     mfxStatus GetVideoParam(mfxVideoParam *par);
+    mfxStatus GetVPPStat(mfxVPPStat *stat);
     mfxStatus GetVPPSurface(mfxFrameSurface1 **surface);
     mfxStatus GetVPPSurfaceOut(mfxFrameSurface1 **surface);
     mfxStatus IsSameVideoParam(mfxVideoParam *newPar, mfxVideoParam *oldPar);
     void SetSession(CpuWorkstream *session);
+    void AddMemoryStats(mfxCpuMemoryStats *stats);
 
 private:
     char m_vpp_filter_desc[1024];
     AVFilterGraph *m_vpp_graph;
     AVFilterContext *m_buffersrc_ctx;
     AVFilterContext *m_buffersink_ctx;
+    int m_filterThreads;
     FrameLock m_input_locker;
     AVFrame *m_avVppFrameOut;
+    // scaling and color conversion into the output surfaces, nullptr when
+    //   the graph output is passed on as is
+    SwsContext *m_outScaler;
+    // sync points of frames queued on the session worker, not yet waited for
+    std::deque<mfxSyncPoint> m_vppTasks;
+    // frames are dropped while late, NumFrame counts only queued ones
+    CpuDeadline m_deadline;
+    mfxU32 m_numFrames;
 
     mfxU32 m_vppFunc;
     mfxVideoParam m_param;
@@ -85,6 +102,8 @@ private:
     std::unique_ptr<CpuFramePool> m_vppSurfacesOut;
 
     bool InitFilters(void);
+    bool InitOutScaler();
+    mfxStatus ScaleToSurface(AVFrame *src, mfxFrameSurface1 *surface_out);
     void CloseFilterPads(AVFilterInOut *src_out, AVFilterInOut *sink_in);
     static mfxStatus CheckIOPattern_AndSetIOMemTypes(mfxU16 IOPattern,
                                                      mfxU16 *pInMemType,
@@ -115,6 +134,7 @@ private:
     bool CheckFilterList(mfxU32 *pList, mfxU32 count, bool bDoUseTable);
     mfxStatus CheckExtParam(mfxExtBuffer **ppExtParam, mfxU16 count);
     bool NeedWAForAlignment(mfxFrameInfo *fi, int *linesize);
+    void UpdateOutputInfo(mfxFrameSurface1 *surface_in, mfxFrameSurface1 *surface_out);
 
     CpuWorkstream *m_session;
 
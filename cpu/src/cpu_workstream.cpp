@@ -6,19 +6,210 @@
 
 #include "src/cpu_workstream.h"
 #include "src/cpu_common.h"
+#include "src/cpu_threads.h"
 
-CpuWorkstream::CpuWorkstream()
-        : m_decode(),
+CpuWorkstream::CpuWorkstream() : CpuWorkstream(CpuPlacement::AssignCpuSet()) {}
+
+CpuWorkstream::CpuWorkstream(int cpuSet)
+        : m_scheduler(std::make_shared<CpuScheduler>()),
+          m_bJoined(false),
+          m_decode(),
           m_encode(),
           m_vpp(),
           m_decvpp(),
+          m_importSurfaces(),
           m_allocator(),
-          m_handles() {
+          m_handles(),
+          m_memoryStats(),
+          m_sharedInterface(),
+          m_threadsParam(),
+          m_cpuSet(cpuSet),
+          m_priority(MFX_PRIORITY_NORMAL) {
     av_log_set_level(AV_LOG_QUIET);
+    m_scheduler->SetCpuSet(m_cpuSet);
+
+    m_sharedInterface.Context       = this;
+    m_sharedInterface.ImportSurface = ImportSurface;
 }
 
-CpuWorkstream::~CpuWorkstream() {}
+CpuWorkstream::~CpuWorkstream() {
+    // finish queued work before any component goes away
+    m_scheduler->WaitAll();
+}
 
 mfxStatus CpuWorkstream::Sync(mfxSyncPoint &syncp, mfxU32 wait) {
+    return m_scheduler->Sync(syncp, wait);
+}
+
+void CpuWorkstream::UpdateMemoryStats() {
+    mfxCpuMemoryStats stats = {};
+
+    if (m_decode)
+        m_decode->AddMemoryStats(&stats);
+    if (m_encode)
+        m_encode->AddMemoryStats(&stats);
+    if (m_vpp)
+        m_vpp->AddMemoryStats(&stats);
+    if (m_decvpp)
+        m_decvpp->AddMemoryStats(&stats);
+
+    m_memoryStats = stats;
+}
+
+mfxStatus CpuWorkstream::ImportSurface(mfxCpuSharedInterface *shared,
+                                       const mfxCpuSharedSurface *desc,
+                                       mfxFrameSurface1 **surface) {
+    RET_IF_FALSE(shared, MFX_ERR_NULL_PTR);
+
+    CpuWorkstream *ws = static_cast<CpuWorkstream *>(shared->Context);
+    RET_IF_FALSE(ws, MFX_ERR_INVALID_HANDLE);
+
+    return ws->ImportSharedSurface(desc, surface);
+}
+
+mfxStatus CpuWorkstream::ImportSharedSurface(const mfxCpuSharedSurface *desc,
+                                             mfxFrameSurface1 **surface) {
+    RET_IF_FALSE(desc && surface, MFX_ERR_NULL_PTR);
+    *surface = nullptr;
+
+    AVPixelFormat format = MFXFourCC2AVPixelFormat(desc->FourCC);
+    RET_IF_FALSE(format != AV_PIX_FMT_NONE, MFX_ERR_UNSUPPORTED);
+    RET_IF_FALSE(desc->Fd >= 0 && desc->Width && desc->Height && desc->Size,
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(desc->NumPlanes == (mfxU32)av_pix_fmt_count_planes(format),
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+
+    // the frame comes from another process, every plane has to lie inside
+    //   the mapping
+    const AVPixFmtDescriptor *fmtDesc = av_pix_fmt_desc_get(format);
+    int minPitch[4]                   = {};
+    RET_IF_FALSE(av_image_fill_linesizes(minPitch, format, desc->Width) >= 0,
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+    for (mfxU32 i = 0; i < desc->NumPlanes; i++) {
+        mfxU64 rows = desc->Height;
+        if (i == 1 || i == 2)
+            rows = (rows + (1ULL << fmtDesc->log2_chroma_h) - 1) >> fmtDesc->log2_chroma_h;
+        RET_IF_FALSE(desc->Pitch[i] >= (mfxU32)minPitch[i] &&
+                         desc->PlaneOffset[i] + desc->Pitch[i] * rows <= desc->Size,
+                     MFX_ERR_INVALID_VIDEO_PARAM);
+    }
+
+    // imported surfaces come from a pool of their own, without frame memory
+    if (!m_importSurfaces) {
+        auto pool = std::make_unique<CpuFramePool>(m_cpuSet);
+        RET_ERROR(pool->Init(0));
+        m_importSurfaces = std::move(pool);
+    }
+
+    AVBufferRef *buffer = CpuFrameArena::MapShared(desc->Fd, desc->Offset, desc->Size);
+    RET_IF_FALSE(buffer, MFX_ERR_INVALID_HANDLE);
+
+    mfxFrameSurface1 *imported = nullptr;
+    mfxStatus sts              = m_importSurfaces->GetFreeSurface(&imported);
+    if (sts != MFX_ERR_NONE) {
+        av_buffer_unref(&buffer);
+        return sts;
+    }
+
+    // the surface takes over the mapping, it is unmapped when the surface
+    //   is reused or freed
+    CpuFrame *cpu_frame = CpuFrame::TryCast(imported);
+    AVFrame *avframe    = cpu_frame->GetAVFrame();
+    av_frame_unref(avframe);
+    avframe->format = format;
+    avframe->width  = desc->Width;
+    avframe->height = desc->Height;
+    for (mfxU32 i = 0; i < desc->NumPlanes; i++) {
+        avframe->data[i]     = buffer->data + desc->PlaneOffset[i];
+        avframe->linesize[i] = desc->Pitch[i];
+    }
+    avframe->buf[0] = buffer;
+    cpu_frame->Update();
+
+    *surface = imported;
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuWorkstream::SetInitExtParams(mfxExtBuffer **extParam, mfxU16 numExtParam) {
+    RET_IF_FALSE(extParam || !numExtParam, MFX_ERR_NULL_PTR);
+
+    for (mfxU16 i = 0; i < numExtParam; i++) {
+        RET_IF_FALSE(extParam[i], MFX_ERR_NULL_PTR);
+
+        // other buffers are ignored
+        if (extParam[i]->BufferId != MFX_EXTBUFF_THREADS_PARAM)
+            continue;
+
+        RET_IF_FALSE(extParam[i]->BufferSz == sizeof(mfxExtThreadsParam), MFX_ERR_UNSUPPORTED);
+        mfxExtThreadsParam *threadsParam = reinterpret_cast<mfxExtThreadsParam *>(extParam[i]);
+
+        RET_ERROR(m_scheduler->SetThreadScheduling(threadsParam->SchedulingType,
+                                                  threadsParam->Priority));
+        m_threadsParam = *threadsParam;
+    }
+
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuWorkstream::SetPriority(mfxPriority priority) {
+    RET_IF_FALSE(priority == MFX_PRIORITY_LOW || priority == MFX_PRIORITY_NORMAL ||
+                     priority == MFX_PRIORITY_HIGH,
+                 MFX_ERR_UNSUPPORTED);
+
+    // already queued tasks keep the priority they were submitted with
+    m_priority = priority;
+
+    // workers of a joined session belong to the parent session
+    if (!m_bJoined)
+        m_scheduler->SetBackground(priority == MFX_PRIORITY_LOW);
+
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuWorkstream::Join(CpuWorkstream *child) {
+    RET_IF_FALSE(child != this, MFX_ERR_UNDEFINED_BEHAVIOR);
+    RET_IF_FALSE(!child->m_bJoined && child->m_scheduler != m_scheduler,
+                 MFX_ERR_UNDEFINED_BEHAVIOR);
+
+    // work queued before the join finishes on the child's own worker
+    child->m_scheduler->WaitAll();
+    m_scheduler->TakeFailedTasks(child->m_scheduler.get());
+
+    child->m_scheduler = m_scheduler;
+    child->m_bJoined   = true;
+
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuWorkstream::Disjoin() {
+    RET_IF_FALSE(m_bJoined, MFX_ERR_UNDEFINED_BEHAVIOR);
+
+    std::shared_ptr<CpuScheduler> scheduler = std::make_shared<CpuScheduler>();
+    RET_ERROR(scheduler->SetThreadScheduling(m_threadsParam.SchedulingType,
+                                             m_threadsParam.Priority));
+    scheduler->SetCpuSet(m_cpuSet);
+    scheduler->SetBackground(m_priority == MFX_PRIORITY_LOW);
+
+    // work queued while joined finishes on the shared worker, statuses of
+    //   this session's failed tasks move along to be synced
+    m_scheduler->WaitAll();
+    scheduler->TakeFailedTasks(m_scheduler.get(), this);
+
+    m_scheduler = scheduler;
+    m_bJoined   = false;
+
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuWorkstream::Clone(CpuWorkstream **clone) {
+    // a clone does not take a turn in the CPU set rotation
+    std::unique_ptr<CpuWorkstream> ws(new CpuWorkstream(m_cpuSet));
+    RET_IF_FALSE(ws, MFX_ERR_MEMORY_ALLOC);
+
+    ws->m_threadsParam = m_threadsParam;
+    ws->m_priority     = m_priority;
+    RET_ERROR(Join(ws.get()));
+
+    *clone = ws.release();
     return MFX_ERR_NONE;
 }
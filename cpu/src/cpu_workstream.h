@@ -9,17 +9,23 @@
 
 #include <map>
 #include <memory>
+#include <utility>
 #include "src/cpu_common.h"
 #include "src/cpu_decode.h"
 #include "src/cpu_decodevpp.h"
 #include "src/cpu_encode.h"
 #include "src/cpu_frame.h"
 #include "src/cpu_frame_pool.h"
+#include "src/cpu_scheduler.h"
 #include "src/cpu_vpp.h"
+#include "vplcpu/mfxcpumemory.h"
+#include "vplcpu/mfxcpushared.h"
 
 class CpuWorkstream {
 public:
     CpuWorkstream();
+    // session placed on a given CPU set instead of the next one in turn
+    explicit CpuWorkstream(int cpuSet);
     ~CpuWorkstream();
 
     void SetDecoder(CpuDecode *decode) {
@@ -50,6 +56,53 @@ public:
 
     mfxStatus Sync(mfxSyncPoint &syncp, mfxU32 wait);
 
+    // apply ext buffers passed at session init (mfxExtThreadsParam)
+    mfxStatus SetInitExtParams(mfxExtBuffer **extParam, mfxU16 numExtParam);
+
+    // codec threads requested for this session, 0 if not set
+    mfxU16 GetNumThread() const {
+        return m_threadsParam.NumThread;
+    }
+
+    // CPU set the session's threads and frames are placed on
+    int GetCpuSet() const {
+        return m_cpuSet;
+    }
+
+    // run fn, the codec threads it starts take the session's CPU set and
+    //   priority, see CpuPlacement::Run
+    void RunPlaced(const std::function<void()> &fn) {
+        CpuPlacement::Run(m_cpuSet, m_priority == MFX_PRIORITY_LOW, fn);
+    }
+
+    // queue a task on the session's scheduler at the session's priority
+    mfxStatus Submit(CpuScheduler::Task task,
+                     mfxSyncPoint *syncp,
+                     CpuStage stage,
+                     mfxFrameSurface1 *input  = nullptr,
+                     mfxFrameSurface1 *output = nullptr) {
+        return m_scheduler->Submit(std::move(task), syncp, stage, input, output, this, m_priority);
+    }
+
+    // HIGH sessions are served first on a shared scheduler, LOW sessions
+    //   also lower the OS priority of their worker threads and of the codec
+    //   threads of components initialized while LOW
+    mfxStatus SetPriority(mfxPriority priority);
+    mfxPriority GetPriority() const {
+        return m_priority;
+    }
+
+    CpuScheduler *GetScheduler() {
+        return m_scheduler.get();
+    }
+
+    // child runs its work on this session's scheduler until disjoined
+    mfxStatus Join(CpuWorkstream *child);
+    mfxStatus Disjoin();
+
+    // new session with the same settings, joined to this one
+    mfxStatus Clone(CpuWorkstream **clone);
+
     mfxStatus SetFrameAllocator(mfxFrameAllocator *allocator) {
         RET_IF_FALSE(allocator, MFX_ERR_NULL_PTR);
         m_allocator = *allocator;
@@ -65,6 +118,19 @@ public:
     }
 
     mfxStatus GetHandle(mfxHandleType ht, mfxHDL *hdl) {
+        // gathered on every call, not a handle the application can set
+        if (ht == MFX_HANDLE_CPU_MEMORY_STATS) {
+            UpdateMemoryStats();
+            *hdl = &m_memoryStats;
+            return MFX_ERR_NONE;
+        }
+#if defined(__linux__)
+        if (ht == MFX_HANDLE_CPU_SHARED_INTERFACE) {
+            *hdl = &m_sharedInterface;
+            return MFX_ERR_NONE;
+        }
+#endif
+
         if (m_handles.find(ht) == m_handles.end()) {
             *hdl = nullptr;
             return MFX_ERR_NOT_FOUND;
@@ -75,14 +141,34 @@ public:
         }
     }
 
+    // surface referencing a frame in shared memory of another process
+    mfxStatus ImportSharedSurface(const mfxCpuSharedSurface *desc, mfxFrameSurface1 **surface);
+
 private:
+    void UpdateMemoryStats();
+    static mfxStatus ImportSurface(mfxCpuSharedInterface *shared,
+                                   const mfxCpuSharedSurface *desc,
+                                   mfxFrameSurface1 **surface);
+
+    // declared first so that it outlives the components queueing work on it,
+    //   shared with the parent session while joined
+    std::shared_ptr<CpuScheduler> m_scheduler;
+    bool m_bJoined;
+
     std::unique_ptr<CpuDecode> m_decode;
     std::unique_ptr<CpuEncode> m_encode;
     std::unique_ptr<CpuVPP> m_vpp;
     std::unique_ptr<CpuDecodeVPP> m_decvpp;
+    std::unique_ptr<CpuFramePool> m_importSurfaces;
 
     mfxFrameAllocator m_allocator;
     std::map<mfxHandleType, mfxHDL> m_handles;
+    mfxCpuMemoryStats m_memoryStats;
+    mfxCpuSharedInterface m_sharedInterface;
+
+    mfxExtThreadsParam m_threadsParam;
+    int m_cpuSet;
+    mfxPriority m_priority;
 
     /* copy not allowed */
     CpuWorkstream(const CpuWorkstream &);
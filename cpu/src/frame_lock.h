@@ -34,4 +34,15 @@ private:
     AVFrame *m_avframe;
 };
 
+// Keep a FrameInterface surface alive while queued work still references it
+inline void HoldSurface(mfxFrameSurface1 *surface) {
+    if (surface && surface->FrameInterface)
+        surface->FrameInterface->AddRef(surface);
+}
+
+inline void ReleaseSurface(mfxFrameSurface1 *surface) {
+    if (surface && surface->FrameInterface)
+        surface->FrameInterface->Release(surface);
+}
+
 #endif // CPU_SRC_FRAME_LOCK_H_
@@ -69,6 +69,12 @@ mfxStatus MFXInitEx(mfxInitParam par, mfxSession *session) {
         return MFX_ERR_UNSUPPORTED;
     }
 
+    mfxStatus sts = ws->SetInitExtParams(par.ExtParam, par.NumExtParam);
+    if (sts != MFX_ERR_NONE) {
+        delete ws;
+        return sts;
+    }
+
     // save the handle
     *session = (mfxSession)(ws);
 
@@ -116,22 +122,52 @@ mfxStatus MFXQueryVersion(mfxSession session, mfxVersion *pVersion) {
     return MFX_ERR_NONE;
 }
 
-// These functions are optional and not implemented in this
-// reference implementation.
 mfxStatus MFXJoinSession(mfxSession session, mfxSession child) {
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session && child, MFX_ERR_INVALID_HANDLE);
+
+    CpuWorkstream *ws      = reinterpret_cast<CpuWorkstream *>(session);
+    CpuWorkstream *childWs = reinterpret_cast<CpuWorkstream *>(child);
+
+    return ws->Join(childWs);
 }
+
 mfxStatus MFXDisjoinSession(mfxSession session) {
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+
+    CpuWorkstream *ws = reinterpret_cast<CpuWorkstream *>(session);
+
+    return ws->Disjoin();
 }
+
 mfxStatus MFXCloneSession(mfxSession session, mfxSession *clone) {
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+    RET_IF_FALSE(clone, MFX_ERR_NULL_PTR);
+
+    CpuWorkstream *ws      = reinterpret_cast<CpuWorkstream *>(session);
+    CpuWorkstream *cloneWs = nullptr;
+    RET_ERROR(ws->Clone(&cloneWs));
+
+    *clone = (mfxSession)(cloneWs);
+
+    return MFX_ERR_NONE;
 }
+
 mfxStatus MFXSetPriority(mfxSession session, mfxPriority priority) {
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+
+    CpuWorkstream *ws = reinterpret_cast<CpuWorkstream *>(session);
+
+    return ws->SetPriority(priority);
 }
+
 mfxStatus MFXGetPriority(mfxSession session, mfxPriority *priority) {
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+    RET_IF_FALSE(priority, MFX_ERR_NULL_PTR);
+
+    CpuWorkstream *ws = reinterpret_cast<CpuWorkstream *>(session);
+    *priority         = ws->GetPriority();
+
+    return MFX_ERR_NONE;
 }
 
 // DLL entry point
@@ -35,7 +35,8 @@ mfxStatus MFXVideoCORE_SetHandle(mfxSession session, mfxHandleType type, mfxHDL
     }
 }
 
-// Return handle set by SetHandle
+// Return handle set by SetHandle, or the session's memory statistics
+//   for MFX_HANDLE_CPU_MEMORY_STATS
 mfxStatus MFXVideoCORE_GetHandle(mfxSession session, mfxHandleType type, mfxHDL *hdl) {
     if (0 == session) {
         return MFX_ERR_INVALID_HANDLE;
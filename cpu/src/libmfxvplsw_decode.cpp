@@ -7,11 +7,11 @@
 #include "./cpu_workstream.h"
 #include "vpl/mfxvideo.h"
 
-// NOTES - for now, just do init, decode the first frame, get params, close codec
+// NOTES - parses the sequence header, or JPEG frame header, without opening the
+//   codec. Streams the header is not enough for still decode the first frame.
 //
 // Differences vs. MSDK 1.0 spec
-// - codec init does not happen here, just header parsing
-// - should not decode a frame
+// - decodes a frame when the parameters cannot be read from the header
 // - may be called at any time before or after initialization
 // - should search for sequence header and move mfxBitstream to first byte
 // - optionally returns header in mfxExtCodingOptionSPSPPS struct
@@ -47,7 +47,9 @@ mfxStatus MFXVideoDECODE_Query(mfxSession session, mfxVideoParam *in, mfxVideoPa
     return CpuDecode::DecodeQuery(in, out);
 }
 
-// NOTES - fixed at 1 frame for now
+// NOTES - sized from MaxDecFrameBuffering as set by DecodeHeader, otherwise
+//   from the largest DPB the level and frame size allow, a fixed small
+//   request without either
 //
 // Differences vs. MSDK 1.0 spec
 // - only supports system memory, SW impl
@@ -137,15 +139,16 @@ mfxStatus MFXVideoDECODE_DecodeFrameAsync(mfxSession session,
         // get a ref-counted surface for decoding into
         // behavior is equivalent to the application calling this and then
         //   passing the surface into DecodeFrameAsync()
-        RET_ERROR(MFXMemory_GetSurfaceForDecode(session, &surface_work));
+        // a bounded pool may be exhausted, returns MFX_WRN_ALLOC_TIMEOUT_EXPIRED
+        mfxStatus allocSts = MFXMemory_GetSurfaceForDecode(session, &surface_work);
+        if (allocSts != MFX_ERR_NONE)
+            return allocSts;
         bInternalMem = true;
     }
 
-    mfxStatus sts = decoder->DecodeFrame(bs, surface_work, surface_out);
-
-    if (surface_work->FrameInterface) {
-        surface_work->FrameInterface->OnComplete(sts);
-    }
+    // FrameInterface->OnComplete() is called once the queued work
+    //   writing surface_work finishes
+    mfxStatus sts = decoder->DecodeFrame(bs, surface_work, surface_out, syncp);
 
     // application will not know to release surface (e.g. if we
     //   need more data) so need to release it here
@@ -153,8 +156,6 @@ mfxStatus MFXVideoDECODE_DecodeFrameAsync(mfxSession session,
         surface_work->FrameInterface->Release(surface_work);
     }
 
-    *syncp = (mfxSyncPoint)(0x12345678);
-
     return sts;
 }
 
@@ -188,15 +189,32 @@ mfxStatus MFXVideoDECODE_Reset(mfxSession session, mfxVideoParam *par) {
     return MFXVideoDECODE_Init(session, par);
 }
 
-// stubs
 mfxStatus MFXVideoDECODE_GetDecodeStat(mfxSession session, mfxDecodeStat *stat) {
     VPL_TRACE_FUNC;
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+    RET_IF_FALSE(stat, MFX_ERR_NULL_PTR);
+
+    CpuWorkstream *ws  = reinterpret_cast<CpuWorkstream *>(session);
+    CpuDecode *decoder = ws->GetDecoder();
+    RET_IF_FALSE(decoder, MFX_ERR_NOT_INITIALIZED);
+
+    return decoder->GetDecodeStat(stat);
 }
+
+// NOTES - MORE and LESS step through the levels of CpuDecode::SetSkipMode,
+//   the change applies to access units queued afterwards
 mfxStatus MFXVideoDECODE_SetSkipMode(mfxSession session, mfxSkipMode mode) {
     VPL_TRACE_FUNC;
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+
+    CpuWorkstream *ws  = reinterpret_cast<CpuWorkstream *>(session);
+    CpuDecode *decoder = ws->GetDecoder();
+    RET_IF_FALSE(decoder, MFX_ERR_NOT_INITIALIZED);
+
+    return decoder->SetSkipMode(mode);
 }
+
+// stubs
 mfxStatus MFXVideoDECODE_GetPayload(mfxSession session, mfxU64 *ts, mfxPayload *payload) {
     VPL_TRACE_FUNC;
     return MFX_ERR_NOT_IMPLEMENTED;
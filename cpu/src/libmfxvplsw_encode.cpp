@@ -72,9 +72,7 @@ mfxStatus MFXVideoENCODE_EncodeFrameAsync(mfxSession session,
     CpuEncode *encoder = ws->GetEncoder();
     RET_IF_FALSE(encoder, MFX_ERR_NOT_INITIALIZED);
 
-    *syncp = (mfxSyncPoint)(0x12345678);
-
-    mfxStatus sts = encoder->EncodeFrame(surface, ctrl, bs);
+    mfxStatus sts = encoder->EncodeFrame(surface, ctrl, bs, syncp);
     RET_ERROR(sts);
     return sts;
 }
@@ -114,5 +112,12 @@ mfxStatus MFXVideoENCODE_GetVideoParam(mfxSession session, mfxVideoParam *par) {
 
 mfxStatus MFXVideoENCODE_GetEncodeStat(mfxSession session, mfxEncodeStat *stat) {
     VPL_TRACE_FUNC;
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+    RET_IF_FALSE(stat, MFX_ERR_NULL_PTR);
+
+    CpuWorkstream *ws  = reinterpret_cast<CpuWorkstream *>(session);
+    CpuEncode *encoder = ws->GetEncoder();
+    RET_IF_FALSE(encoder, MFX_ERR_NOT_INITIALIZED);
+
+    return encoder->GetEncodeStat(stat);
 }
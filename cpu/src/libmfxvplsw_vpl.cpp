@@ -38,6 +38,12 @@ mfxStatus MFXInitialize(mfxInitializationParam par, mfxSession *session) {
         return MFX_ERR_UNSUPPORTED;
     }
 
+    mfxStatus sts = ws->SetInitExtParams(par.ExtParam, par.NumExtParam);
+    if (sts != MFX_ERR_NONE) {
+        delete ws;
+        return sts;
+    }
+
     // save the handle
     *session = (mfxSession)(ws);
 
@@ -85,9 +85,7 @@ mfxStatus MFXVideoVPP_RunFrameVPPAsync(mfxSession session,
     CpuVPP *vpp       = ws->GetVPP();
     RET_IF_FALSE(vpp, MFX_ERR_NOT_INITIALIZED);
 
-    *syncp = (mfxSyncPoint)(0x12345678);
-
-    return vpp->ProcessFrame(in, out, aux);
+    return vpp->ProcessFrame(in, out, aux, syncp);
 }
 
 mfxStatus MFXVideoVPP_Reset(mfxSession session, mfxVideoParam *par) {
@@ -109,7 +107,14 @@ mfxStatus MFXVideoVPP_Reset(mfxSession session, mfxVideoParam *par) {
 
 mfxStatus MFXVideoVPP_GetVPPStat(mfxSession session, mfxVPPStat *stat) {
     VPL_TRACE_FUNC;
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+    RET_IF_FALSE(stat, MFX_ERR_NULL_PTR);
+
+    CpuWorkstream *ws = reinterpret_cast<CpuWorkstream *>(session);
+    CpuVPP *vpp       = ws->GetVPP();
+    RET_IF_FALSE(vpp, MFX_ERR_NOT_INITIALIZED);
+
+    return vpp->GetVPPStat(stat);
 }
 
 mfxStatus MFXVideoVPP_ProcessFrameAsync(mfxSession session,
@@ -126,10 +131,17 @@ mfxStatus MFXVideoVPP_ProcessFrameAsync(mfxSession session,
         // get a ref-counted surface for vpp into
         // behavior is equivalent to the application calling this and then
         //   passing the surface into ProcessFrameAsync()
-        RET_ERROR(MFXMemory_GetSurfaceForVPPOut(session, out));
+        // a bounded pool may be exhausted, returns MFX_WRN_ALLOC_TIMEOUT_EXPIRED
+        mfxStatus allocSts = MFXMemory_GetSurfaceForVPPOut(session, out);
+        if (allocSts != MFX_ERR_NONE)
+            return allocSts;
         (*out)->FrameInterface->Map(*out, MFX_MAP_WRITE);
     }
 
-    mfxStatus sts = vpp->ProcessFrame(in, *out, NULL);
+    // no sync point is returned here, so wait for the frame before returning
+    mfxSyncPoint syncp = nullptr;
+    mfxStatus sts      = vpp->ProcessFrame(in, *out, NULL, &syncp);
+    if (sts == MFX_ERR_NONE)
+        sts = ws->Sync(syncp, MFX_INFINITE);
     return sts;
 }
@@ -5,7 +5,11 @@
   ############################################################################*/
 
 #include <gtest/gtest.h>
+#include <stdlib.h>
+#include <vector>
+#include "api/test_bitstreams.h"
 #include "vpl/mfxvideo.h"
+#include "vplcpu/mfxcpumemory.h"
 
 //SetFrameAllocator
 TEST(SetFrameAllocator, SetFrameAllocatorReturnsErrNone) {
@@ -103,6 +107,155 @@ TEST(GetHandle, NullSessionReturnsInvalidHandle) {
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
 }
 
+// memory statistics of a session without components
+TEST(GetHandle, CpuMemoryStatsReturnsEmptyStats) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxCpuMemoryStats *stats = nullptr;
+    sts = MFXVideoCORE_GetHandle(session, MFX_HANDLE_CPU_MEMORY_STATS, (mfxHDL *)&stats);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_NE(stats, nullptr);
+    EXPECT_EQ(stats->FrameBytes, 0u);
+    EXPECT_EQ(stats->NumFrames, 0u);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+// init an HEVC decoder for the 96x64 test stream, internal surfaces
+static mfxStatus InitStatsDecode(mfxSession *session, mfxBitstream *bs, mfxU16 *numSuggested) {
+    mfxVersion ver = {};
+    mfxStatus sts  = MFXInit(MFX_IMPL_SOFTWARE, &ver, session);
+    if (sts != MFX_ERR_NONE)
+        return sts;
+
+    *bs           = {};
+    bs->MaxLength = bs->DataLength = test_bitstream_96x64_8bit_hevc::getlen();
+    bs->Data                       = test_bitstream_96x64_8bit_hevc::getdata();
+
+    mfxVideoParam par = {};
+    par.mfx.CodecId   = MFX_CODEC_HEVC;
+    par.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+    sts               = MFXVideoDECODE_DecodeHeader(*session, bs, &par);
+    if (sts != MFX_ERR_NONE)
+        return sts;
+
+    mfxFrameAllocRequest request = {};
+    sts                          = MFXVideoDECODE_QueryIOSurf(*session, &par, &request);
+    if (sts != MFX_ERR_NONE)
+        return sts;
+    *numSuggested = request.NumFrameSuggested;
+
+    return MFXVideoDECODE_Init(*session, &par);
+}
+
+// decode the whole stream into internal surfaces, the application keeps them
+static void DecodeHeldSurfaces(mfxSession session,
+                               mfxBitstream *bs,
+                               std::vector<mfxFrameSurface1 *> *held) {
+    mfxBitstream *input = bs;
+    for (;;) {
+        mfxFrameSurface1 *surface = nullptr;
+        mfxSyncPoint syncp        = nullptr;
+        mfxStatus sts = MFXVideoDECODE_DecodeFrameAsync(session, input, nullptr, &surface, &syncp);
+        if (sts == MFX_ERR_MORE_DATA && input) {
+            input = nullptr; // drain
+            continue;
+        }
+        if (sts != MFX_ERR_NONE)
+            break;
+
+        sts = MFXVideoCORE_SyncOperation(session, syncp, MFX_INFINITE);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        held->push_back(surface);
+    }
+}
+
+// decoded pictures held in internal surfaces are part of the frame memory
+TEST(GetHandle, CpuMemoryStatsCountDecodedFrames) {
+    mfxSession session;
+    mfxBitstream bs     = {};
+    mfxU16 numSuggested = 0;
+    mfxStatus sts       = InitStatsDecode(&session, &bs, &numSuggested);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxFrameSurface1 *> held;
+    DecodeHeldSurfaces(session, &bs, &held);
+    ASSERT_FALSE(held.empty());
+
+    mfxCpuMemoryStats *stats = nullptr;
+    sts = MFXVideoCORE_GetHandle(session, MFX_HANDLE_CPU_MEMORY_STATS, (mfxHDL *)&stats);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_NE(stats, nullptr);
+    EXPECT_GE(stats->NumFrames, held.size());
+    EXPECT_GE(stats->FrameBytes, held.size() * 96 * 64 * 3 / 2);
+
+    for (mfxFrameSurface1 *surface : held)
+        surface->FrameInterface->Release(surface);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+// decoded pictures left idle are trimmed, ctest runs this with
+//   VPL_CPU_POOL_TRIM_COUNT=1
+TEST(GetHandle, CpuMemoryStatsShrinkAfterTrim) {
+    if (!getenv("VPL_CPU_POOL_TRIM_COUNT"))
+        GTEST_SKIP();
+
+    mfxSession session;
+    mfxBitstream bs     = {};
+    mfxU16 numSuggested = 0;
+    mfxStatus sts       = InitStatsDecode(&session, &bs, &numSuggested);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxFrameSurface1 *> held;
+    DecodeHeldSurfaces(session, &bs, &held);
+    ASSERT_FALSE(held.empty());
+
+    // grow the pool past the preallocated surfaces, so the decoded ones
+    //   are above what is always kept
+    for (mfxU16 i = 0; i < numSuggested; i++) {
+        mfxFrameSurface1 *surface = nullptr;
+        sts                       = MFXMemory_GetSurfaceForDecode(session, &surface);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        held.push_back(surface);
+    }
+
+    mfxCpuMemoryStats *stats = nullptr;
+    sts = MFXVideoCORE_GetHandle(session, MFX_HANDLE_CPU_MEMORY_STATS, (mfxHDL *)&stats);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    mfxU64 heldBytes  = stats->FrameBytes;
+    mfxU32 heldFrames = stats->NumFrames;
+    EXPECT_GE(heldBytes, (held.size() - numSuggested) * 96 * 64 * 3 / 2);
+
+    for (mfxFrameSurface1 *surface : held)
+        surface->FrameInterface->Release(surface);
+
+    // the first request closes the window of the held surfaces, the next
+    //   ones trim what stayed idle since
+    for (int i = 0; i < 3; i++) {
+        mfxFrameSurface1 *surface = nullptr;
+        sts                       = MFXMemory_GetSurfaceForDecode(session, &surface);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        surface->FrameInterface->Release(surface);
+    }
+
+    sts = MFXVideoCORE_GetHandle(session, MFX_HANDLE_CPU_MEMORY_STATS, (mfxHDL *)&stats);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_LT(stats->FrameBytes, heldBytes);
+    EXPECT_LT(stats->NumFrames, heldFrames);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 //Sync
 // success
 TEST(SyncOperation, ValidInputReturnsErrNone) {
@@ -121,6 +274,22 @@ TEST(SyncOperation, ValidInputReturnsErrNone) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+// sync point not returned by this session
+TEST(SyncOperation, UnknownSyncPointReturnsNullPtr) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxSyncPoint syncp = (mfxSyncPoint)(0x12345678);
+    sts                = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    ASSERT_EQ(sts, MFX_ERR_NULL_PTR);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 // null session
 TEST(SyncOperation, NullSessionReturnsInvalidHandle) {
     mfxStatus sts = MFXVideoCORE_SyncOperation(0, 0, 0);
@@ -80,6 +80,135 @@ TEST(DecodeHeader, TenBitInReturnsCorrectMetadata) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+// sps_max_dec_pic_buffering_minus1 of the stream is 15
+TEST(DecodeHeader, HEVCReturnsDpbSizeOfSPS) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_HEVC;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_96x64_8bit_hevc::getlen();
+    mfxBS.Data                         = test_bitstream_96x64_8bit_hevc::getdata();
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(16, mfxDecParams.mfx.MaxDecFrameBuffering);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(DecodeHeader, JPEGInReturnsFullRangeI420) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_JPEG;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxExtVideoSignalInfo signalInfo = {};
+    signalInfo.Header.BufferId       = MFX_EXTBUFF_VIDEO_SIGNAL_INFO;
+    signalInfo.Header.BufferSz       = sizeof(mfxExtVideoSignalInfo);
+
+    mfxExtBuffer *extParam[1] = { &signalInfo.Header };
+    mfxDecParams.ExtParam     = extParam;
+    mfxDecParams.NumExtParam  = 1;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_32x32_mjpeg::getlen();
+    mfxBS.Data                         = test_bitstream_32x32_mjpeg::getdata();
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    //check metadata
+    ASSERT_EQ(32, mfxDecParams.mfx.FrameInfo.CropW);
+    ASSERT_EQ(32, mfxDecParams.mfx.FrameInfo.CropH);
+    ASSERT_EQ(MFX_FOURCC_I420, mfxDecParams.mfx.FrameInfo.FourCC);
+    ASSERT_EQ(1, signalInfo.VideoFullRange);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+// The JPEG streams below end after the frame header, a decoder has no
+//   picture to report the parameters from, only the header read does
+static mfxStatus DecodeJPEGHeader(mfxU8 *data, mfxU32 len, mfxVideoParam *par) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    if (sts != MFX_ERR_NONE)
+        return sts;
+
+    *par             = {};
+    par->mfx.CodecId = MFX_CODEC_JPEG;
+    par->IOPattern   = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = len;
+    mfxBS.Data                         = data;
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, par);
+    MFXClose(session);
+    return sts;
+}
+
+TEST(DecodeHeader, JPEG420FrameHeaderReturnsMetadataWithoutDecode) {
+    // stream cut before the first scan
+    mfxU8 *data = test_bitstream_32x32_mjpeg::getdata();
+    mfxU32 len  = 0;
+    while (len + 1 < test_bitstream_32x32_mjpeg::getlen() &&
+           !(data[len] == 0xFF && data[len + 1] == 0xDA))
+        len++;
+
+    mfxVideoParam mfxDecParams = {};
+    mfxStatus sts              = DecodeJPEGHeader(data, len, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    ASSERT_EQ(32, mfxDecParams.mfx.FrameInfo.CropW);
+    ASSERT_EQ(32, mfxDecParams.mfx.FrameInfo.CropH);
+    ASSERT_EQ(MFX_FOURCC_I420, mfxDecParams.mfx.FrameInfo.FourCC);
+}
+
+TEST(DecodeHeader, JPEG422FrameHeaderReturnsMetadataWithoutDecode) {
+    // 48x32, luma 2x1 and chroma 1x1 sampling
+    mfxU8 data[] = { 0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08, 0x00, 0x20, 0x00, 0x30,
+                     0x03, 0x01, 0x21, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01, 0xFF, 0xD9 };
+
+    mfxVideoParam mfxDecParams = {};
+    mfxStatus sts              = DecodeJPEGHeader(data, sizeof(data), &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // output is converted to 4:2:0
+    ASSERT_EQ(48, mfxDecParams.mfx.FrameInfo.CropW);
+    ASSERT_EQ(32, mfxDecParams.mfx.FrameInfo.CropH);
+    ASSERT_EQ(MFX_FOURCC_I420, mfxDecParams.mfx.FrameInfo.FourCC);
+}
+
+TEST(DecodeHeader, JPEGZeroSamplingFactorReturnsError) {
+    mfxU8 data[] = { 0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08, 0x00, 0x20, 0x00, 0x30,
+                     0x03, 0x01, 0x21, 0x00, 0x02, 0x00, 0x01, 0x03, 0x00, 0x01, 0xFF, 0xD9 };
+
+    mfxVideoParam mfxDecParams = {};
+    mfxStatus sts              = DecodeJPEGHeader(data, sizeof(data), &mfxDecParams);
+    ASSERT_LT(sts, MFX_ERR_NONE);
+}
+
+TEST(DecodeHeader, JPEGTruncatedFrameHeaderReturnsError) {
+    mfxU8 data[] = { 0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08, 0x00, 0x20 };
+
+    mfxVideoParam mfxDecParams = {};
+    mfxStatus sts              = DecodeJPEGHeader(data, sizeof(data), &mfxDecParams);
+    ASSERT_LT(sts, MFX_ERR_NONE);
+}
+
 TEST(DecodeHeader, NullSessionReturnsInvalidHandle) {
     mfxStatus sts = MFXVideoDECODE_DecodeHeader(0, nullptr, nullptr);
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
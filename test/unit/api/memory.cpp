@@ -9,6 +9,12 @@
 #include "vpl/mfxjpeg.h"
 #include "vpl/mfxsurfacepool.h"
 #include "vpl/mfxvideo.h"
+#include "vplcpu/mfxcpushared.h"
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
 
 /*
    Memory functions have the same states
@@ -950,6 +956,91 @@ TEST(Memory_FrameInterfaceGetNativeHandle, NullSurfaceReturnsInvalidHandle) {
     CloseDecodeBasic(session);
 }
 
+#if defined(__linux__)
+TEST(Memory_SharedInterfaceImportSurface, InvalidDescriptionReturnsError) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxCpuSharedInterface *shared = nullptr;
+    sts = MFXVideoCORE_GetHandle(session, MFX_HANDLE_CPU_SHARED_INTERFACE, (mfxHDL *)&shared);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_NE(shared, nullptr);
+
+    mfxFrameSurface1 *surface = nullptr;
+    sts                       = shared->ImportSurface(shared, nullptr, &surface);
+    EXPECT_EQ(sts, MFX_ERR_NULL_PTR);
+
+    // no file behind the description
+    mfxCpuSharedSurface desc = {};
+    desc.Fd                  = -1;
+    desc.FourCC              = MFX_FOURCC_I420;
+    desc.Width               = 128;
+    desc.Height              = 96;
+    desc.Size                = 128 * 96 * 3 / 2;
+    desc.NumPlanes           = 3;
+    sts                      = shared->ImportSurface(shared, &desc, &surface);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+    EXPECT_EQ(surface, nullptr);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(Memory_SharedInterfaceImportSurface, RangePastEndOfFileReturnsInvalidHandle) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxCpuSharedInterface *shared = nullptr;
+    sts = MFXVideoCORE_GetHandle(session, MFX_HANDLE_CPU_SHARED_INTERFACE, (mfxHDL *)&shared);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_NE(shared, nullptr);
+
+    // the file only holds half a frame
+    mfxCpuSharedSurface desc = {};
+    desc.FourCC              = MFX_FOURCC_I420;
+    desc.Width               = 128;
+    desc.Height              = 96;
+    desc.Size                = 128 * 96 * 3 / 2;
+    desc.NumPlanes           = 3;
+    desc.Pitch[0]            = 128;
+    desc.Pitch[1]            = 64;
+    desc.Pitch[2]            = 64;
+    desc.PlaneOffset[1]      = 128 * 96;
+    desc.PlaneOffset[2]      = 128 * 96 * 5 / 4;
+    desc.Fd                  = memfd_create("utest-frame", MFD_CLOEXEC);
+    ASSERT_GE(desc.Fd, 0);
+    ASSERT_EQ(ftruncate(desc.Fd, desc.Size / 2), 0);
+
+    mfxFrameSurface1 *surface = nullptr;
+    sts                       = shared->ImportSurface(shared, &desc, &surface);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_HANDLE);
+    EXPECT_EQ(surface, nullptr);
+
+    // offset and size wrapping around past the end of the file
+    ASSERT_EQ(ftruncate(desc.Fd, desc.Size), 0);
+    desc.Offset = ~0ULL - 4095;
+    sts         = shared->ImportSurface(shared, &desc, &surface);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_HANDLE);
+    EXPECT_EQ(surface, nullptr);
+
+    // the whole frame in the file
+    desc.Offset = 0;
+    sts         = shared->ImportSurface(shared, &desc, &surface);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_NE(surface, nullptr);
+    sts = surface->FrameInterface->Release(surface);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    close(desc.Fd);
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+#endif
+
 //GetDeviceHandle
 TEST(Memory_FrameInterfaceGetDeviceHandle, NullSurfaceReturnsErrNull) {
     mfxStatus sts;
@@ -1074,6 +1165,36 @@ TEST(Memory_FrameInterfaceSynchronize, InvalidSurfaceReturnsInvalidHandle) {
     CloseDecodeBasic(session);
 }
 
+TEST(Memory_FrameInterfaceSynchronize, VPPOutputWaitsForProcessing) {
+    mfxStatus sts;
+    mfxSession session;
+
+    sts = InitVPPBasic(&session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxFrameSurface1 *vppSurfaceIn  = nullptr;
+    mfxFrameSurface1 *vppSurfaceOut = nullptr;
+    sts                             = MFXMemory_GetSurfaceForVPPIn(session, &vppSurfaceIn);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXMemory_GetSurfaceForVPPOut(session, &vppSurfaceOut);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxSyncPoint syncp = nullptr;
+    sts = MFXVideoVPP_RunFrameVPPAsync(session, vppSurfaceIn, vppSurfaceOut, nullptr, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = vppSurfaceOut->FrameInterface->Synchronize(vppSurfaceOut, MFX_INFINITE);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    vppSurfaceIn->FrameInterface->Release(vppSurfaceIn);
+    vppSurfaceOut->FrameInterface->Release(vppSurfaceOut);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 // QueryInterface tests - GUID = unknown
 
 TEST(Memory_FrameInterfaceQueryInterface, GUIDUnknownReturnsErrNotImplemented) {
@@ -1458,7 +1579,7 @@ TEST(Memory_FrameInterfaceQueryInterface,
         reinterpret_cast<mfxSurfacePoolInterface *>(interface);
     EXPECT_NE(surfacePoolInterface, nullptr);
 
-    // CPU RT only supports MFX_ALLOCATION_UNLIMITED, so this should return warning (input is ignored)
+    // pools are MFX_ALLOCATION_UNLIMITED by default, so this returns a warning (input is ignored)
     sts = surfacePoolInterface->SetNumSurfaces(surfacePoolInterface, 5);
     EXPECT_EQ(sts, MFX_WRN_INCOMPATIBLE_VIDEO_PARAM);
 
@@ -1513,7 +1634,7 @@ TEST(Memory_FrameInterfaceQueryInterface,
         reinterpret_cast<mfxSurfacePoolInterface *>(interface);
     EXPECT_NE(surfacePoolInterface, nullptr);
 
-    // CPU RT only supports MFX_ALLOCATION_UNLIMITED, so this should return warning (input is ignored)
+    // pools are MFX_ALLOCATION_UNLIMITED by default, so this returns a warning (input is ignored)
     sts = surfacePoolInterface->SetNumSurfaces(surfacePoolInterface, 5);
     EXPECT_EQ(sts, MFX_WRN_INCOMPATIBLE_VIDEO_PARAM);
 
@@ -1545,7 +1666,7 @@ TEST(Memory_FrameInterfaceQueryInterface,
         reinterpret_cast<mfxSurfacePoolInterface *>(interface);
     EXPECT_NE(surfacePoolInterface, nullptr);
 
-    // CPU RT only supports MFX_ALLOCATION_UNLIMITED, so this should return warning (input is ignored)
+    // pools are MFX_ALLOCATION_UNLIMITED by default, so this returns a warning (input is ignored)
     sts = surfacePoolInterface->SetNumSurfaces(surfacePoolInterface, 5);
     EXPECT_EQ(sts, MFX_WRN_INCOMPATIBLE_VIDEO_PARAM);
 
@@ -1575,7 +1696,7 @@ TEST(Memory_FrameInterfaceQueryInterface, GUIDSurfacePoolGetAllocationPolicyVali
         reinterpret_cast<mfxSurfacePoolInterface *>(interface);
     EXPECT_NE(surfacePoolInterface, nullptr);
 
-    // CPU RT only supports MFX_ALLOCATION_UNLIMITED
+    // pools are MFX_ALLOCATION_UNLIMITED by default
     mfxPoolAllocationPolicy policy = (mfxPoolAllocationPolicy)0xFFFFFFFF;
     sts = surfacePoolInterface->GetAllocationPolicy(surfacePoolInterface, &policy);
     EXPECT_EQ(sts, MFX_ERR_NONE);
@@ -1605,7 +1726,7 @@ TEST(Memory_FrameInterfaceQueryInterface,
         reinterpret_cast<mfxSurfacePoolInterface *>(interface);
     EXPECT_NE(surfacePoolInterface, nullptr);
 
-    // CPU RT only supports MFX_ALLOCATION_UNLIMITED
+    // pools are MFX_ALLOCATION_UNLIMITED by default
     mfxPoolAllocationPolicy policy = (mfxPoolAllocationPolicy)0xFFFFFFFF;
     sts                            = surfacePoolInterface->GetAllocationPolicy(nullptr, &policy);
     EXPECT_EQ(sts, MFX_ERR_NULL_PTR);
@@ -1633,7 +1754,7 @@ TEST(Memory_FrameInterfaceQueryInterface, GUIDSurfacePoolGetMaximumPoolSizeValid
         reinterpret_cast<mfxSurfacePoolInterface *>(interface);
     EXPECT_NE(surfacePoolInterface, nullptr);
 
-    // CPU RT only supports MFX_ALLOCATION_UNLIMITED
+    // pools are MFX_ALLOCATION_UNLIMITED by default
     mfxU32 size = 0;
     sts         = surfacePoolInterface->GetMaximumPoolSize(surfacePoolInterface, &size);
     EXPECT_EQ(sts, MFX_ERR_NONE);
@@ -1663,7 +1784,7 @@ TEST(Memory_FrameInterfaceQueryInterface,
         reinterpret_cast<mfxSurfacePoolInterface *>(interface);
     EXPECT_NE(surfacePoolInterface, nullptr);
 
-    // CPU RT only supports MFX_ALLOCATION_UNLIMITED
+    // pools are MFX_ALLOCATION_UNLIMITED by default
     mfxU32 size = 0;
     sts         = surfacePoolInterface->GetMaximumPoolSize(nullptr, &size);
     EXPECT_EQ(sts, MFX_ERR_NULL_PTR);
@@ -6,6 +6,7 @@
 
 #include <gtest/gtest.h>
 #include <tuple>
+#include <vector>
 #include "vpl/mfxvideo.h"
 
 // MFXInit tests
@@ -48,6 +49,31 @@ TEST(InitEx, ValidInputReturnsErrNone) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+TEST(InitEx, ThreadsParamReturnsErrNone) {
+    mfxExtThreadsParam threadsParam = { 0 };
+    threadsParam.Header.BufferId    = MFX_EXTBUFF_THREADS_PARAM;
+    threadsParam.Header.BufferSz    = sizeof(threadsParam);
+    threadsParam.NumThread          = 2;
+
+    mfxExtBuffer *extParam[] = { &threadsParam.Header };
+
+    mfxInitParam initPar   = { 0 };
+    initPar.Version.Major  = 2;
+    initPar.Version.Minor  = 0;
+    initPar.Implementation = MFX_IMPL_SOFTWARE;
+    initPar.ExtParam       = extParam;
+    initPar.NumExtParam    = 1;
+
+    // Initialize the session.
+    mfxSession session;
+    mfxStatus sts = MFXInitEx(initPar, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 // MFXClose tests
 
 TEST(Close, InitializedSessionReturnsErrNone) {
@@ -145,6 +171,209 @@ TEST(QueryVersion, NullSessionReturnsInvalidHandle) {
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
 }
 
+// MFXJoinSession tests
+TEST(JoinSession, ValidSessionsReturnErrNone) {
+    mfxSession session1, session2;
+    mfxVersion ver = {};
+    mfxStatus sts  = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session1);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session2);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXJoinSession(session1, session2);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXDisjoinSession(session2);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    //free internal resources
+    sts = MFXClose(session1);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXClose(session2);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(JoinSession, SameSessionReturnsUndefinedBehavior) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXJoinSession(session, session);
+    ASSERT_EQ(sts, MFX_ERR_UNDEFINED_BEHAVIOR);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(JoinSession, NullSessionReturnsInvalidHandle) {
+    mfxStatus sts = MFXJoinSession(nullptr, nullptr);
+    ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
+}
+
+// MFXDisjoinSession tests
+TEST(DisjoinSession, NotJoinedSessionReturnsUndefinedBehavior) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXDisjoinSession(session);
+    ASSERT_EQ(sts, MFX_ERR_UNDEFINED_BEHAVIOR);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+static mfxStatus FailingLock(mfxHDL pthis, mfxMemId mid, mfxFrameData *ptr) {
+    return MFX_ERR_LOCK_MEMORY;
+}
+
+static mfxStatus NoUnlock(mfxHDL pthis, mfxMemId mid, mfxFrameData *ptr) {
+    return MFX_ERR_NONE;
+}
+
+TEST(DisjoinSession, FailedTaskStatusIsSyncedAfterDisjoin) {
+    mfxSession session1, session2;
+    mfxVersion ver = {};
+    mfxStatus sts  = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session1);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session2);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // input surfaces of session2 cannot be locked, its VPP tasks fail
+    mfxFrameAllocator allocator = {};
+    allocator.pthis             = reinterpret_cast<mfxHDL>(1);
+    allocator.Lock              = FailingLock;
+    allocator.Unlock            = NoUnlock;
+    sts                         = MFXVideoCORE_SetFrameAllocator(session2, &allocator);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXJoinSession(session1, session2);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam par        = {};
+    par.vpp.In.FourCC        = MFX_FOURCC_I420;
+    par.vpp.In.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    par.vpp.In.Width         = 64;
+    par.vpp.In.Height        = 64;
+    par.vpp.In.CropW         = 64;
+    par.vpp.In.CropH         = 64;
+    par.vpp.In.FrameRateExtN = 30;
+    par.vpp.In.FrameRateExtD = 1;
+    par.vpp.Out              = par.vpp.In;
+    par.IOPattern            = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+    sts                      = MFXVideoVPP_Init(session2, &par);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxU8> buffer(64 * 64 * 3 / 2 * 2);
+    mfxFrameSurface1 surfaces[2] = {};
+    for (int i = 0; i < 2; i++) {
+        surfaces[i].Info       = par.vpp.In;
+        surfaces[i].Data.Y     = buffer.data() + i * 64 * 64 * 3 / 2;
+        surfaces[i].Data.U     = surfaces[i].Data.Y + 64 * 64;
+        surfaces[i].Data.V     = surfaces[i].Data.U + 32 * 32;
+        surfaces[i].Data.Pitch = 64;
+    }
+
+    mfxSyncPoint syncp = nullptr;
+    sts = MFXVideoVPP_RunFrameVPPAsync(session2, &surfaces[0], &surfaces[1], nullptr, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // the task ran on session1's worker, its status stays with session2
+    sts = MFXDisjoinSession(session2);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXVideoCORE_SyncOperation(session2, syncp, 1000);
+    EXPECT_EQ(sts, MFX_ERR_ABORTED);
+
+    //free internal resources
+    sts = MFXClose(session2);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXClose(session1);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+// MFXCloneSession tests
+TEST(CloneSession, ValidSessionReturnsJoinedClone) {
+    mfxVersion ver = {};
+    mfxSession session, clone;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXCloneSession(session, &clone);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // clone is joined to the original session
+    sts = MFXDisjoinSession(clone);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    //free internal resources
+    sts = MFXClose(clone);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+// MFXSetPriority/MFXGetPriority tests
+TEST(SetPriority, ValidPriorityIsReturnedByGetPriority) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxPriority priority = MFX_PRIORITY_LOW;
+    sts                  = MFXGetPriority(session, &priority);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(priority, MFX_PRIORITY_NORMAL);
+
+    sts = MFXSetPriority(session, MFX_PRIORITY_HIGH);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXGetPriority(session, &priority);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(priority, MFX_PRIORITY_HIGH);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(SetPriority, InvalidPriorityReturnsUnsupported) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXSetPriority(session, (mfxPriority)100);
+    ASSERT_EQ(sts, MFX_ERR_UNSUPPORTED);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(GetPriority, NullPriorityReturnsErrNull) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXGetPriority(session, nullptr);
+    ASSERT_EQ(sts, MFX_ERR_NULL_PTR);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(Initialize, SoftwareImplReturnsErrNone) {
     mfxSession session;
     mfxInitializationParam initPar2 = {};
@@ -281,4 +281,73 @@ TEST(DecodeVPPGetChannelParam, InitializedDecodeVPPReturnsParams) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 
     delete mfxVPPChParams;
-}
\ No newline at end of file
+}
+
+// Get*Stat tests
+TEST(EncodeGetEncodeStat, UninitializedEncodeReturnsNotInitialized) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxEncodeStat stat = {};
+    sts                = MFXVideoENCODE_GetEncodeStat(session, &stat);
+    ASSERT_EQ(sts, MFX_ERR_NOT_INITIALIZED);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(DecodeGetDecodeStat, UninitializedDecodeReturnsNotInitialized) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxDecodeStat stat = {};
+    sts                = MFXVideoDECODE_GetDecodeStat(session, &stat);
+    ASSERT_EQ(sts, MFX_ERR_NOT_INITIALIZED);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(VPPGetVPPStat, InitializedVPPReturnsNoFrames) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxVPPParams = { 0 };
+
+    mfxVPPParams.vpp.In.FourCC        = MFX_FOURCC_I420;
+    mfxVPPParams.vpp.In.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxVPPParams.vpp.In.Width         = 128;
+    mfxVPPParams.vpp.In.Height        = 96;
+    mfxVPPParams.vpp.In.CropW         = 128;
+    mfxVPPParams.vpp.In.CropH         = 96;
+    mfxVPPParams.vpp.In.FrameRateExtN = 30;
+    mfxVPPParams.vpp.In.FrameRateExtD = 1;
+    mfxVPPParams.vpp.Out              = mfxVPPParams.vpp.In;
+    mfxVPPParams.IOPattern = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    sts = MFXVideoVPP_Init(session, &mfxVPPParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVPPStat stat     = {};
+    stat.NumFrame       = 1;
+    stat.NumCachedFrame = 1;
+    sts                 = MFXVideoVPP_GetVPPStat(session, &stat);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(stat.NumFrame, 0u);
+    EXPECT_EQ(stat.NumCachedFrame, 0u);
+
+    sts = MFXVideoVPP_GetVPPStat(session, nullptr);
+    EXPECT_EQ(sts, MFX_ERR_NULL_PTR);
+
+    sts = MFXVideoVPP_Close(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
@@ -510,6 +510,31 @@ TEST(DecodeInit, ValidParamsInReturnsErrNone) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+TEST(DecodeInit, NumThreadInReturnsErrNone) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_HEVC;
+    mfxDecParams.mfx.NumThread = 2;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxDecParams.mfx.FrameInfo.FourCC       = MFX_FOURCC_I420;
+    mfxDecParams.mfx.FrameInfo.ChromaFormat = MFX_CHROMAFORMAT_YUV420;
+    mfxDecParams.mfx.FrameInfo.CropW        = 320;
+    mfxDecParams.mfx.FrameInfo.CropH        = 240;
+    mfxDecParams.mfx.FrameInfo.Width        = 320;
+    mfxDecParams.mfx.FrameInfo.Height       = 240;
+
+    sts = MFXVideoDECODE_Init(session, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(DecodeInit, ProtectedInReturnsInvalidVideoParam) {
     mfxVersion ver = {};
     mfxSession session;
@@ -1391,6 +1416,64 @@ TEST(DecodeReset, NullSessionInReturnsInvalidHandle) {
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
 }
 
+//DecodeSetSkipMode
+TEST(DecodeSetSkipMode, LevelsStopAtLimits) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_HEVC;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxDecParams.mfx.FrameInfo.FourCC       = MFX_FOURCC_I420;
+    mfxDecParams.mfx.FrameInfo.ChromaFormat = MFX_CHROMAFORMAT_YUV420;
+    mfxDecParams.mfx.FrameInfo.CropW        = 320;
+    mfxDecParams.mfx.FrameInfo.CropH        = 240;
+    mfxDecParams.mfx.FrameInfo.Width        = 320;
+    mfxDecParams.mfx.FrameInfo.Height       = 240;
+
+    sts = MFXVideoDECODE_Init(session, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_LESS);
+    EXPECT_EQ(sts, MFX_WRN_VALUE_NOT_CHANGED);
+
+    for (int i = 0; i < 4; i++) {
+        sts = MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_MORE);
+        EXPECT_EQ(sts, MFX_ERR_NONE);
+    }
+    sts = MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_MORE);
+    EXPECT_EQ(sts, MFX_WRN_VALUE_NOT_CHANGED);
+
+    sts = MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_NOSKIP);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_LESS);
+    EXPECT_EQ(sts, MFX_WRN_VALUE_NOT_CHANGED);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(DecodeSetSkipMode, UninitializedReturnsNotInitialized) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_MORE);
+    ASSERT_EQ(sts, MFX_ERR_NOT_INITIALIZED);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(DecodeSetSkipMode, NullSessionInReturnsInvalidHandle) {
+    mfxStatus sts = MFXVideoDECODE_SetSkipMode(0, MFX_SKIPMODE_NOSKIP);
+    ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
+}
+
 //VPPReset
 TEST(VPPReset, ValidParamsInReturnsErrNone) {
     mfxVersion ver = {};
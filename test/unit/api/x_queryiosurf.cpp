@@ -52,6 +52,29 @@ TEST(EncodeQueryIOSurf, PopulatedParamsInReturnsRequest) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+TEST(EncodeQueryIOSurf, ZeroAsyncDepthInReturnsSurfaceInFlight) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam par;
+    memset(&par, 0, sizeof(par));
+    par.mfx.CodecId          = MFX_CODEC_HEVC;
+    par.mfx.FrameInfo.Width  = 320;
+    par.mfx.FrameInfo.Height = 240;
+
+    // AsyncDepth 0 has one frame in flight, like 1
+    mfxFrameAllocRequest request;
+    sts = MFXVideoENCODE_QueryIOSurf(session, &par, &request);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_EQ(request.NumFrameMin, 1);
+    ASSERT_EQ(request.NumFrameSuggested, 2);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(EncodeQueryIOSurf, NullSessionReturnsInvalidHandle) {
     mfxStatus sts = MFXVideoENCODE_QueryIOSurf(0, nullptr, nullptr);
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
@@ -124,6 +147,54 @@ TEST(DecodeQueryIOSurf, PopulatedParamsInReturnsRequest) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+TEST(DecodeQueryIOSurf, NoHeaderParamsInReturnsDefaultRequest) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // codec only, no DPB size or frame size from DecodeHeader
+    mfxVideoParam par;
+    memset(&par, 0, sizeof(par));
+    par.mfx.CodecId          = MFX_CODEC_AVC;
+    par.mfx.FrameInfo.FourCC = MFX_FOURCC_I420;
+    par.IOPattern            = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxFrameAllocRequest request;
+    sts = MFXVideoDECODE_QueryIOSurf(session, &par, &request);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_EQ(request.NumFrameMin, 1);
+    ASSERT_EQ(request.NumFrameSuggested, 3);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(DecodeQueryIOSurf, NoLevelParamsInReturnsRequestForFrameSize) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam par;
+    memset(&par, 0, sizeof(par));
+    par.mfx.CodecId          = MFX_CODEC_AVC;
+    par.mfx.FrameInfo.FourCC = MFX_FOURCC_I420;
+    par.mfx.FrameInfo.Width  = 3840;
+    par.mfx.FrameInfo.Height = 2160;
+    par.IOPattern            = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    // level 5.2 holds 184320 macroblocks, 5 frames of 3840x2160
+    mfxFrameAllocRequest request;
+    sts = MFXVideoDECODE_QueryIOSurf(session, &par, &request);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_EQ(request.NumFrameMin, 6);
+    ASSERT_EQ(request.NumFrameSuggested, 7);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(DecodeQueryIOSurf, InvalidParamsReturnInvalidVideoParam) {
     mfxVersion ver = {};
     mfxSession session;
@@ -5,6 +5,8 @@
   ############################################################################*/
 
 #include <gtest/gtest.h>
+#include <stdlib.h>
+#include <vector>
 #include "api/test_bitstreams.h"
 #include "vpl/mfxjpeg.h"
 #include "vpl/mfxvideo.h"
@@ -614,6 +616,160 @@ TEST(DecodeFrameAsync, CompleteFrameJPEGReturnsFrame) {
     delete[] decSurfaces;
 }
 
+// 16x32 4:4:4 JPEG of flat 8x8 blocks, block (row, col) has Y = 64 + 32 * row
+//   + 16 * col, Cb = 40 + 48 * row + 24 * col and Cr = 216 - 48 * row - 24 * col
+static mfxU8 test_jpeg_16x32_444[] = {
+    0xFF, 0xD8, 0xFF, 0xDB, 0x00, 0x43, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0xFF,
+    0xC0, 0x00, 0x11, 0x08, 0x00, 0x20, 0x00, 0x10, 0x03, 0x01, 0x11, 0x00,
+    0x02, 0x11, 0x00, 0x03, 0x11, 0x00, 0xFF, 0xC4, 0x00, 0x1F, 0x00, 0x00,
+    0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    0x09, 0x0A, 0x0B, 0xFF, 0xC4, 0x00, 0x15, 0x10, 0x01, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x00, 0x03,
+    0x00, 0x00, 0x3F, 0x00, 0xFE, 0x7F, 0xDF, 0xC9, 0xFB, 0xFA, 0xC0, 0x7D,
+    0x00, 0xFB, 0x01, 0xF1, 0xFB, 0xE8, 0x07, 0xD8, 0x0F, 0x8F, 0xDF, 0x40,
+    0x3E, 0xC0, 0x7C, 0x7E, 0xFA, 0x01, 0xF6, 0x03, 0xE3, 0xF7, 0xD0, 0x0F,
+    0xB0, 0x1F, 0x1F, 0xBE, 0x80, 0x7D, 0x80, 0xF8, 0xFD, 0xF4, 0x03, 0xEC,
+    0x07, 0xC7, 0xEF, 0xFF, 0xD9
+};
+
+TEST(DecodeFrameAsync, JPEG444ReturnsI420WithHalfPitchChroma) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_JPEG;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = sizeof(test_jpeg_16x32_444);
+    mfxBS.Data                         = test_jpeg_16x32_444;
+    mfxBS.DataFlag                     = MFX_BITSTREAM_COMPLETE_FRAME;
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_EQ(MFX_FOURCC_I420, mfxDecParams.mfx.FrameInfo.FourCC);
+
+    sts = MFXVideoDECODE_Init(session, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // internally allocated surfaces take over the decoded picture
+    mfxFrameSurface1 *pmfxOutSurface = nullptr;
+    mfxSyncPoint syncp               = {};
+    sts = MFXVideoDECODE_DecodeFrameAsync(session, &mfxBS, nullptr, &pmfxOutSurface, &syncp);
+    if (sts == MFX_ERR_MORE_DATA)
+        sts = MFXVideoDECODE_DecodeFrameAsync(session, nullptr, nullptr, &pmfxOutSurface, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_NE(nullptr, pmfxOutSurface);
+
+    sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = pmfxOutSurface->FrameInterface->Map(pmfxOutSurface, MFX_MAP_READ);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxFrameData &data = pmfxOutSurface->Data;
+    ASSERT_EQ(16, pmfxOutSurface->Info.CropW);
+    ASSERT_EQ(32, pmfxOutSurface->Info.CropH);
+    ASSERT_EQ(MFX_FOURCC_I420, pmfxOutSurface->Info.FourCC);
+
+    // an 8x8 block is 4x4 chroma samples, the inner ones are those of one block
+    mfxU32 chromaPitch = data.Pitch / 2;
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 8; x++) {
+            int row = y / 4;
+            int col = x / 4;
+            ASSERT_NEAR(64 + 32 * row + 16 * col, data.Y[2 * y * data.Pitch + 2 * x], 1);
+            if (x % 4 == 0 || x % 4 == 3 || y % 4 == 0 || y % 4 == 3)
+                continue;
+            ASSERT_NEAR(40 + 48 * row + 24 * col, data.U[y * chromaPitch + x], 1);
+            ASSERT_NEAR(216 - 48 * row - 24 * col, data.V[y * chromaPitch + x], 1);
+        }
+    }
+
+    sts = pmfxOutSurface->FrameInterface->Unmap(pmfxOutSurface);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    sts = pmfxOutSurface->FrameInterface->Release(pmfxOutSurface);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(DecodeFrameAsync, DecVideoProcessingJPEGReturnsScaledFrame) {
+    mfxStatus sts = MFX_ERR_NONE;
+
+    mfxVersion ver = {};
+    mfxSession session;
+    sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_JPEG;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_32x32_mjpeg::getlen();
+    mfxBS.Data                         = test_bitstream_32x32_mjpeg::getdata();
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // quarter of the picture size
+    mfxExtDecVideoProcessing decVpp = {};
+    decVpp.Header.BufferId          = MFX_EXTBUFF_DEC_VIDEO_PROCESSING;
+    decVpp.Header.BufferSz          = sizeof(mfxExtDecVideoProcessing);
+    decVpp.Out.FourCC               = MFX_FOURCC_I420;
+    decVpp.Out.Width                = 16;
+    decVpp.Out.Height               = 16;
+    decVpp.Out.CropW                = 16;
+    decVpp.Out.CropH                = 16;
+
+    mfxExtBuffer *extParam[1] = { &decVpp.Header };
+    mfxDecParams.ExtParam     = extParam;
+    mfxDecParams.NumExtParam  = 1;
+
+    sts = MFXVideoDECODE_Init(session, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxU8 DECoutbuf[16 * 16 * 3 / 2] = {};
+    mfxFrameSurface1 decSurface      = { 0 };
+    decSurface.Info                  = mfxDecParams.mfx.FrameInfo;
+    decSurface.Info.Width            = 16;
+    decSurface.Info.Height           = 16;
+    decSurface.Data.Y                = DECoutbuf;
+    decSurface.Data.U                = DECoutbuf + 16 * 16;
+    decSurface.Data.V                = decSurface.Data.U + 8 * 8;
+    decSurface.Data.Pitch            = 16;
+
+    mfxFrameSurface1 *pmfxOutSurface = nullptr;
+    mfxSyncPoint syncp               = {};
+
+    mfxBS.DataFlag   = MFX_BITSTREAM_COMPLETE_FRAME;
+    mfxBS.Data       = test_bitstream_32x32_mjpeg::getdata();
+    mfxBS.DataLength = test_bitstream_32x32_mjpeg::getpos(1);
+    mfxBS.DataOffset = 0;
+
+    sts = MFXVideoDECODE_DecodeFrameAsync(session, &mfxBS, &decSurface, &pmfxOutSurface, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(pmfxOutSurface->Info.CropW, 16);
+    EXPECT_EQ(pmfxOutSurface->Info.CropH, 16);
+
+    sts = MFXClose(session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(DecodeFrameAsync, EoSReturnsFrame) {
     mfxStatus sts = MFX_ERR_NONE;
 
@@ -894,6 +1050,173 @@ TEST(DecodeFrameAsync, InsufficientInBitstreamReturnsMoreData) {
     delete[] decSurfaces;
 }
 
+TEST(DecodeFrameAsync, MoreDataReturnsUntakenSurfacesUnlocked) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_HEVC;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_96x64_8bit_hevc::getlen();
+    mfxBS.Data                         = test_bitstream_96x64_8bit_hevc::getdata();
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxU32 nSurfNumDec            = 4;
+    mfxFrameSurface1 *decSurfaces = new mfxFrameSurface1[nSurfNumDec];
+    mfxU32 surfW                  = mfxDecParams.mfx.FrameInfo.Width;
+    mfxU32 surfH                  = mfxDecParams.mfx.FrameInfo.Height;
+
+    mfxU8 *DECoutbuf = new mfxU8[(mfxU32)(surfW * surfH * nSurfNumDec * 1.5)];
+
+    for (mfxU32 i = 0; i < nSurfNumDec; i++) {
+        decSurfaces[i]            = { 0 };
+        decSurfaces[i].Info       = mfxDecParams.mfx.FrameInfo;
+        int buf_offset            = i * surfW * surfH;
+        decSurfaces[i].Data.Y     = DECoutbuf + buf_offset;
+        decSurfaces[i].Data.U     = DECoutbuf + buf_offset + (surfW * surfH);
+        decSurfaces[i].Data.V     = decSurfaces[i].Data.U + ((surfW / 2) * (surfH / 2));
+        decSurfaces[i].Data.Pitch = surfW;
+    }
+
+    sts = MFXVideoDECODE_Init(session, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // a new surface with every call, none of them receives a picture
+    mfxSyncPoint syncp;
+    mfxFrameSurface1 *pmfxOutSurface = nullptr;
+    for (mfxU32 i = 0; i < nSurfNumDec; i++) {
+        mfxBS.DataOffset = i;
+        mfxBS.DataLength = 1;
+        sts              = MFXVideoDECODE_DecodeFrameAsync(session,
+                                              &mfxBS,
+                                              &decSurfaces[i],
+                                              &pmfxOutSurface,
+                                              &syncp);
+        EXPECT_EQ(sts, MFX_ERR_MORE_DATA);
+        EXPECT_EQ(0, decSurfaces[i].Data.Locked);
+    }
+
+    sts = MFXClose(session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    delete[] DECoutbuf;
+    delete[] decSurfaces;
+}
+
+static mfxStatus InitSkipDecode(mfxSession *session) {
+    mfxVersion ver = {};
+    mfxStatus sts  = MFXInit(MFX_IMPL_SOFTWARE, &ver, session);
+    if (sts != MFX_ERR_NONE)
+        return sts;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_96x64_8bit_hevc::getlen();
+    mfxBS.Data                         = test_bitstream_96x64_8bit_hevc::getdata();
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_HEVC;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+    sts                        = MFXVideoDECODE_DecodeHeader(*session, &mfxBS, &mfxDecParams);
+    if (sts != MFX_ERR_NONE)
+        return sts;
+
+    return MFXVideoDECODE_Init(*session, &mfxDecParams);
+}
+
+// Decode packets [first, last) of the test stream as complete frames into
+//   internal surfaces, last == 0 drains the decoder. Returns the number of
+//   frames output.
+static int DecodeSkipPackets(mfxSession session, unsigned int first, unsigned int last) {
+    const unsigned int npkt = 8;
+    int numFrames           = 0;
+
+    for (unsigned int i = first; i < last || !last; i++) {
+        mfxBitstream mfxBS = { 0 };
+        mfxBitstream *bs   = nullptr;
+        if (last) {
+            unsigned int begin = test_bitstream_96x64_8bit_hevc::getpos(i);
+            unsigned int end   = (i + 1 < npkt) ? test_bitstream_96x64_8bit_hevc::getpos(i + 1)
+                                                : test_bitstream_96x64_8bit_hevc::getlen();
+            mfxBS.Data         = test_bitstream_96x64_8bit_hevc::getdata() + begin;
+            mfxBS.DataLength   = end - begin;
+            mfxBS.MaxLength    = end - begin;
+            mfxBS.DataFlag     = MFX_BITSTREAM_COMPLETE_FRAME;
+            bs                 = &mfxBS;
+        }
+
+        mfxStatus sts = MFX_ERR_NONE;
+        while (sts == MFX_ERR_NONE || sts == MFX_WRN_DEVICE_BUSY) {
+            mfxFrameSurface1 *surface = nullptr;
+            mfxSyncPoint syncp        = nullptr;
+            sts = MFXVideoDECODE_DecodeFrameAsync(session, bs, nullptr, &surface, &syncp);
+            if (sts != MFX_ERR_NONE)
+                continue;
+
+            EXPECT_EQ(MFXVideoCORE_SyncOperation(session, syncp, MFX_INFINITE), MFX_ERR_NONE);
+            surface->FrameInterface->Release(surface);
+            numFrames++;
+        }
+        EXPECT_EQ(sts, MFX_ERR_MORE_DATA);
+
+        if (!last)
+            break;
+    }
+
+    return numFrames;
+}
+
+// the test stream is one IDR picture followed by seven inter pictures
+TEST(DecodeFrameAsync, KeySkipLevelReturnsOnlyKeyframes) {
+    mfxSession session;
+    mfxStatus sts = InitSkipDecode(&session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    for (int i = 0; i < 4; i++) {
+        sts = MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_MORE);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+    }
+
+    int numFrames = DecodeSkipPackets(session, 0, 8);
+    numFrames += DecodeSkipPackets(session, 0, 0);
+    EXPECT_EQ(numFrames, 1);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(DecodeFrameAsync, LeavingKeySkipLevelResumesAtNextKeyframe) {
+    mfxSession session;
+    mfxStatus sts = InitSkipDecode(&session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    int numFrames = DecodeSkipPackets(session, 0, 1);
+
+    for (int i = 0; i < 4; i++) {
+        sts = MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_MORE);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+    }
+    numFrames += DecodeSkipPackets(session, 1, 8);
+
+    // the inter pictures reference ones that were dropped, they are still
+    //   skipped until the stream reaches a keyframe
+    sts = MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_NOSKIP);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    numFrames += DecodeSkipPackets(session, 1, 8);
+
+    numFrames += DecodeSkipPackets(session, 0, 8);
+    numFrames += DecodeSkipPackets(session, 0, 0);
+    EXPECT_EQ(numFrames, 1 + 8);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(DecodeFrameAsync, NullSessionReturnsInvalidHandle) {
     mfxStatus sts = MFXVideoDECODE_DecodeFrameAsync(0, nullptr, nullptr, nullptr, nullptr);
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
@@ -1165,6 +1488,249 @@ TEST(RunFrameVPPAsync, ValidInputsReturnsErrNone) {
     delete[] DECoutbuf;
 }
 
+TEST(RunFrameVPPAsync, FullAsyncDepthReturnsDeviceBusyUntilSynced) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxVPPParams;
+    memset(&mfxVPPParams, 0, sizeof(mfxVPPParams));
+
+    // Input data
+    mfxVPPParams.vpp.In.FourCC        = MFX_FOURCC_I420;
+    mfxVPPParams.vpp.In.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxVPPParams.vpp.In.CropW         = 320;
+    mfxVPPParams.vpp.In.CropH         = 240;
+    mfxVPPParams.vpp.In.FrameRateExtN = 30;
+    mfxVPPParams.vpp.In.FrameRateExtD = 1;
+    mfxVPPParams.vpp.In.Width         = mfxVPPParams.vpp.In.CropW;
+    mfxVPPParams.vpp.In.Height        = mfxVPPParams.vpp.In.CropH;
+    // Output data
+    mfxVPPParams.vpp.Out = mfxVPPParams.vpp.In;
+
+    mfxVPPParams.IOPattern  = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+    mfxVPPParams.AsyncDepth = 1;
+
+    sts = MFXVideoVPP_Init(session, &mfxVPPParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxU32 nSurfNum               = 3;
+    mfxFrameSurface1 *vppSurfaces = new mfxFrameSurface1[nSurfNum];
+    mfxU32 surfW                  = mfxVPPParams.vpp.In.Width;
+    mfxU32 surfH                  = mfxVPPParams.vpp.In.Height;
+
+    mfxU8 *DECoutbuf = new mfxU8[(mfxU32)(surfW * surfH * nSurfNum * 1.5)];
+
+    for (mfxU32 i = 0; i < nSurfNum; i++) {
+        vppSurfaces[i]            = { 0 };
+        vppSurfaces[i].Info       = mfxVPPParams.vpp.In;
+        int buf_offset            = (int)(i * surfW * surfH * 1.5);
+        vppSurfaces[i].Data.Y     = DECoutbuf + buf_offset;
+        vppSurfaces[i].Data.U     = DECoutbuf + buf_offset + (surfW * surfH);
+        vppSurfaces[i].Data.V     = vppSurfaces[i].Data.U + ((surfW / 2) * (surfH / 2));
+        vppSurfaces[i].Data.Pitch = surfW;
+    }
+
+    mfxSyncPoint syncp1 = nullptr;
+    sts = MFXVideoVPP_RunFrameVPPAsync(session, &vppSurfaces[0], &vppSurfaces[1], nullptr, &syncp1);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // the only slot may still be busy with the first frame
+    mfxSyncPoint syncp2 = nullptr;
+    sts = MFXVideoVPP_RunFrameVPPAsync(session, &vppSurfaces[0], &vppSurfaces[2], nullptr, &syncp2);
+    ASSERT_TRUE(sts == MFX_ERR_NONE || sts == MFX_WRN_DEVICE_BUSY);
+
+    if (sts == MFX_WRN_DEVICE_BUSY) {
+        sts = MFXVideoCORE_SyncOperation(session, syncp1, MFX_INFINITE);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+
+        sts = MFXVideoVPP_RunFrameVPPAsync(session,
+                                           &vppSurfaces[0],
+                                           &vppSurfaces[2],
+                                           nullptr,
+                                           &syncp2);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+    }
+
+    sts = MFXVideoCORE_SyncOperation(session, syncp2, MFX_INFINITE);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    delete[] vppSurfaces;
+    delete[] DECoutbuf;
+}
+
+// bytes past the picture in each row, left untouched by VPP
+#define VPP_PITCH_PAD    16
+#define VPP_PAD_MARKER   0xEE
+#define VPP_SAMPLE_RANGE 2
+
+static void InitVPPInfo(mfxFrameInfo *info, mfxU32 fourcc, mfxU16 width, mfxU16 height) {
+    *info               = { 0 };
+    info->FourCC        = fourcc;
+    info->ChromaFormat  = (fourcc == MFX_FOURCC_BGRA) ? MFX_CHROMAFORMAT_YUV444
+                                                      : MFX_CHROMAFORMAT_YUV420;
+    info->Width         = width;
+    info->Height        = height;
+    info->CropW         = width;
+    info->CropH         = height;
+    info->FrameRateExtN = 30;
+    info->FrameRateExtD = 1;
+}
+
+// I420 or BGRA system memory surface of the whole picture in 'info', each
+//   row padded with VPP_PITCH_PAD marker bytes
+static void InitVPPSurface(mfxFrameSurface1 *surface,
+                           std::vector<mfxU8> *buffer,
+                           const mfxFrameInfo &info) {
+    bool bRGB    = (info.FourCC == MFX_FOURCC_BGRA);
+    mfxU16 rowW  = bRGB ? info.Width * 4 : info.Width;
+    mfxU16 pitch = rowW + VPP_PITCH_PAD;
+    buffer->assign(bRGB ? pitch * info.Height : pitch * info.Height * 3 / 2, VPP_PAD_MARKER);
+
+    *surface            = { 0 };
+    surface->Info       = info;
+    surface->Info.CropX = 0;
+    surface->Info.CropY = 0;
+    surface->Info.CropW = info.Width;
+    surface->Info.CropH = info.Height;
+    surface->Data.Pitch = pitch;
+    if (bRGB) {
+        surface->Data.B = buffer->data();
+        surface->Data.G = surface->Data.B + 1;
+        surface->Data.R = surface->Data.B + 2;
+        surface->Data.A = surface->Data.B + 3;
+    }
+    else {
+        surface->Data.Y = buffer->data();
+        surface->Data.U = surface->Data.Y + pitch * info.Height;
+        surface->Data.V = surface->Data.U + (pitch / 2) * (info.Height / 2);
+    }
+}
+
+// fill the picture of an I420 surface, columns from 'splitX' on get Y 'rightY'
+static void FillI420(mfxFrameSurface1 *surface,
+                     mfxU8 y,
+                     mfxU8 u,
+                     mfxU8 v,
+                     int splitX,
+                     mfxU8 rightY) {
+    mfxU16 pitch = surface->Data.Pitch;
+    for (int row = 0; row < surface->Info.Height; row++) {
+        for (int col = 0; col < surface->Info.Width; col++)
+            surface->Data.Y[row * pitch + col] = (col < splitX) ? y : rightY;
+    }
+    for (int row = 0; row < surface->Info.Height / 2; row++) {
+        memset(surface->Data.U + row * (pitch / 2), u, surface->Info.Width / 2);
+        memset(surface->Data.V + row * (pitch / 2), v, surface->Info.Width / 2);
+    }
+}
+
+static void RunVPPFrame(mfxVideoParam *par, mfxFrameSurface1 *in, mfxFrameSurface1 *out) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    par->IOPattern = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+    sts            = MFXVideoVPP_Init(session, par);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxSyncPoint syncp = nullptr;
+    sts                = MFXVideoVPP_RunFrameVPPAsync(session, in, out, nullptr, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoCORE_SyncOperation(session, syncp, MFX_INFINITE);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(RunFrameVPPAsync, ScaleWritesOutputPitch) {
+    mfxVideoParam mfxVPPParams = { 0 };
+    InitVPPInfo(&mfxVPPParams.vpp.In, MFX_FOURCC_I420, 64, 64);
+    InitVPPInfo(&mfxVPPParams.vpp.Out, MFX_FOURCC_I420, 32, 32);
+
+    mfxFrameSurface1 in, out;
+    std::vector<mfxU8> inBuf, outBuf;
+    InitVPPSurface(&in, &inBuf, mfxVPPParams.vpp.In);
+    InitVPPSurface(&out, &outBuf, mfxVPPParams.vpp.Out);
+    FillI420(&in, 100, 80, 160, 64, 100);
+
+    RunVPPFrame(&mfxVPPParams, &in, &out);
+
+    EXPECT_EQ(out.Info.CropW, 32);
+    EXPECT_EQ(out.Info.CropH, 32);
+    EXPECT_EQ(out.Data.Pitch, 32 + VPP_PITCH_PAD);
+
+    // a flat picture stays flat, the scaler stops at the picture width
+    mfxU16 pitch = out.Data.Pitch;
+    EXPECT_NEAR(out.Data.Y[0], 100, VPP_SAMPLE_RANGE);
+    EXPECT_NEAR(out.Data.Y[31 * pitch + 31], 100, VPP_SAMPLE_RANGE);
+    EXPECT_NEAR(out.Data.U[7 * (pitch / 2) + 9], 80, VPP_SAMPLE_RANGE);
+    EXPECT_NEAR(out.Data.V[15 * (pitch / 2) + 15], 160, VPP_SAMPLE_RANGE);
+    EXPECT_EQ(out.Data.Y[10 * pitch + 32], VPP_PAD_MARKER);
+    EXPECT_EQ(out.Data.U[10 * (pitch / 2) + 16], VPP_PAD_MARKER);
+}
+
+TEST(RunFrameVPPAsync, ColorConversionWritesOutputPitch) {
+    mfxVideoParam mfxVPPParams = { 0 };
+    InitVPPInfo(&mfxVPPParams.vpp.In, MFX_FOURCC_I420, 64, 64);
+    InitVPPInfo(&mfxVPPParams.vpp.Out, MFX_FOURCC_BGRA, 64, 64);
+
+    mfxFrameSurface1 in, out;
+    std::vector<mfxU8> inBuf, outBuf;
+    InitVPPSurface(&in, &inBuf, mfxVPPParams.vpp.In);
+    InitVPPSurface(&out, &outBuf, mfxVPPParams.vpp.Out);
+    FillI420(&in, 235, 128, 128, 64, 235);
+
+    RunVPPFrame(&mfxVPPParams, &in, &out);
+
+    EXPECT_EQ(out.Info.CropW, 64);
+    EXPECT_EQ(out.Info.CropH, 64);
+    EXPECT_EQ(out.Data.Pitch, 64 * 4 + VPP_PITCH_PAD);
+
+    // video range white
+    mfxU8 *pixel = out.Data.B + 20 * out.Data.Pitch + 30 * 4;
+    EXPECT_NEAR(pixel[0], 255, VPP_SAMPLE_RANGE);
+    EXPECT_NEAR(pixel[1], 255, VPP_SAMPLE_RANGE);
+    EXPECT_NEAR(pixel[2], 255, VPP_SAMPLE_RANGE);
+    EXPECT_EQ(pixel[3], 255);
+    EXPECT_EQ(out.Data.B[63 * out.Data.Pitch + 64 * 4], VPP_PAD_MARKER);
+}
+
+TEST(RunFrameVPPAsync, CropAndScaleWritesOutputPitch) {
+    mfxVideoParam mfxVPPParams = { 0 };
+    InitVPPInfo(&mfxVPPParams.vpp.In, MFX_FOURCC_I420, 64, 64);
+    InitVPPInfo(&mfxVPPParams.vpp.Out, MFX_FOURCC_I420, 16, 32);
+    mfxVPPParams.vpp.In.CropX = 32;
+    mfxVPPParams.vpp.In.CropW = 32;
+
+    // the surface holds the whole picture, the crop is taken from the
+    //   parameters, only its right half should reach the output
+    mfxFrameSurface1 in, out;
+    std::vector<mfxU8> inBuf, outBuf;
+    InitVPPSurface(&in, &inBuf, mfxVPPParams.vpp.In);
+    InitVPPSurface(&out, &outBuf, mfxVPPParams.vpp.Out);
+    FillI420(&in, 50, 128, 128, 32, 200);
+
+    RunVPPFrame(&mfxVPPParams, &in, &out);
+
+    EXPECT_EQ(out.Info.CropW, 16);
+    EXPECT_EQ(out.Info.CropH, 32);
+    EXPECT_EQ(out.Data.Pitch, 16 + VPP_PITCH_PAD);
+
+    mfxU16 pitch = out.Data.Pitch;
+    EXPECT_NEAR(out.Data.Y[0], 200, VPP_SAMPLE_RANGE);
+    EXPECT_NEAR(out.Data.Y[16 * pitch + 8], 200, VPP_SAMPLE_RANGE);
+    EXPECT_NEAR(out.Data.Y[31 * pitch + 15], 200, VPP_SAMPLE_RANGE);
+    EXPECT_NEAR(out.Data.U[5 * (pitch / 2) + 3], 128, VPP_SAMPLE_RANGE);
+    EXPECT_EQ(out.Data.Y[31 * pitch + 16], VPP_PAD_MARKER);
+}
+
 TEST(RunFrameVPPAsync, NullSessionReturnsInvalidHandle) {
     mfxStatus sts = MFXVideoVPP_RunFrameVPPAsync(0, nullptr, nullptr, nullptr, nullptr);
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
@@ -1793,4 +2359,160 @@ TEST(DecodeVPPDecodeFrameAsync, SkipChannel) {
     //free internal resources
     sts = MFXClose(session);
     EXPECT_EQ(sts, MFX_ERR_NONE);
-}
\ No newline at end of file
+}
+// encoded packets of a pipelined session, with the sync points of every
+//   task it queued
+struct PipelineOutput {
+    std::vector<mfxU64> timeStamps;
+    std::vector<mfxSyncPoint> syncPoints;
+};
+
+// Encode one surface, or drain the encoder if it is null. The packet is
+//   complete when the call returns it, so only its timestamp is kept.
+static mfxStatus EncodePipelined(mfxSession session,
+                                 mfxFrameSurface1 *surface,
+                                 PipelineOutput *output) {
+    std::vector<mfxU8> buffer(96 * 64 * 3);
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength    = (mfxU32)buffer.size();
+    mfxBS.Data         = buffer.data();
+
+    mfxSyncPoint syncp = nullptr;
+    mfxStatus sts      = MFX_WRN_DEVICE_BUSY;
+    while (sts == MFX_WRN_DEVICE_BUSY)
+        sts = MFXVideoENCODE_EncodeFrameAsync(session, nullptr, surface, &mfxBS, &syncp);
+
+    if (sts == MFX_ERR_NONE) {
+        EXPECT_GT(mfxBS.DataLength, (mfxU32)0);
+        output->timeStamps.push_back(mfxBS.TimeStamp);
+        output->syncPoints.push_back(syncp);
+    }
+    return sts;
+}
+
+// decode -> VPP -> encode with no sync between the stages, ctest runs this
+//   with VPL_CPU_PIPELINE=1 so each stage has its own worker
+TEST(PipelinedFrameAsync, DecodeVPPEncodeKeepsOrder) {
+    if (!getenv("VPL_CPU_PIPELINE"))
+        GTEST_SKIP();
+
+    mfxVersion ver = {};
+    mfxSession session;
+    ver.Major = 2;
+    ver.Minor = 1;
+
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_96x64_8bit_hevc::getlen();
+    mfxBS.Data                         = test_bitstream_96x64_8bit_hevc::getdata();
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_HEVC;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+    sts                        = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxDecParams.AsyncDepth = 4;
+    sts                     = MFXVideoDECODE_Init(session, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxFrameInfo info  = mfxDecParams.mfx.FrameInfo;
+    info.FrameRateExtN = 30;
+    info.FrameRateExtD = 1;
+
+    mfxVideoParam mfxVPPParams = { 0 };
+    mfxVPPParams.IOPattern     = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+    mfxVPPParams.AsyncDepth    = 4;
+    mfxVPPParams.vpp.In        = info;
+    mfxVPPParams.vpp.Out       = info;
+    sts                        = MFXVideoVPP_Init(session, &mfxVPPParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams = { 0 };
+    mfxEncParams.mfx.CodecId   = MFX_CODEC_JPEG;
+    mfxEncParams.mfx.FrameInfo = info;
+    mfxEncParams.IOPattern     = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+    mfxEncParams.AsyncDepth    = 4;
+    sts                        = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // one complete frame per call, the timestamps give the decode order
+    const unsigned int npkt = 8;
+    std::vector<mfxU64> decodedTimeStamps;
+    std::vector<mfxFrameSurface1 *> held;
+    PipelineOutput output;
+
+    for (unsigned int i = 0; i <= npkt; i++) {
+        mfxBitstream *bs = nullptr;
+        if (i < npkt) {
+            unsigned int begin = test_bitstream_96x64_8bit_hevc::getpos(i);
+            unsigned int end   = (i + 1 < npkt) ? test_bitstream_96x64_8bit_hevc::getpos(i + 1)
+                                                : test_bitstream_96x64_8bit_hevc::getlen();
+            mfxBS              = { 0 };
+            mfxBS.Data         = test_bitstream_96x64_8bit_hevc::getdata() + begin;
+            mfxBS.DataLength   = end - begin;
+            mfxBS.MaxLength    = end - begin;
+            mfxBS.DataFlag     = MFX_BITSTREAM_COMPLETE_FRAME;
+            mfxBS.TimeStamp    = (i + 1) * 3000;
+            bs                 = &mfxBS;
+        }
+
+        for (;;) {
+            mfxFrameSurface1 *decSurface = nullptr;
+            mfxSyncPoint decSyncp        = nullptr;
+            sts = MFXVideoDECODE_DecodeFrameAsync(session, bs, nullptr, &decSurface, &decSyncp);
+            if (sts == MFX_WRN_DEVICE_BUSY)
+                continue;
+            if (sts != MFX_ERR_NONE)
+                break;
+            held.push_back(decSurface);
+            decodedTimeStamps.push_back(decSurface->Data.TimeStamp);
+            output.syncPoints.push_back(decSyncp);
+
+            // the VPP task waits for the decode task on the decode stage
+            mfxFrameSurface1 *vppSurface = nullptr;
+            sts                          = MFXMemory_GetSurfaceForVPPOut(session, &vppSurface);
+            ASSERT_EQ(sts, MFX_ERR_NONE);
+            held.push_back(vppSurface);
+
+            mfxSyncPoint vppSyncp = nullptr;
+            sts                   = MFX_WRN_DEVICE_BUSY;
+            while (sts == MFX_WRN_DEVICE_BUSY)
+                sts = MFXVideoVPP_RunFrameVPPAsync(session,
+                                                   decSurface,
+                                                   vppSurface,
+                                                   nullptr,
+                                                   &vppSyncp);
+            ASSERT_EQ(sts, MFX_ERR_NONE);
+            output.syncPoints.push_back(vppSyncp);
+
+            // and the encode task for the VPP task
+            sts = EncodePipelined(session, vppSurface, &output);
+            ASSERT_TRUE(sts == MFX_ERR_NONE || sts == MFX_ERR_MORE_DATA);
+        }
+        ASSERT_EQ(sts, MFX_ERR_MORE_DATA);
+    }
+
+    do {
+        sts = EncodePipelined(session, nullptr, &output);
+    } while (sts == MFX_ERR_NONE);
+    EXPECT_EQ(sts, MFX_ERR_MORE_DATA);
+
+    for (mfxSyncPoint syncp : output.syncPoints) {
+        sts = MFXVideoCORE_SyncOperation(session, syncp, MFX_INFINITE);
+        EXPECT_EQ(sts, MFX_ERR_NONE);
+    }
+
+    // every frame made it through all stages, in the order it was decoded
+    EXPECT_EQ(decodedTimeStamps.size(), npkt);
+    EXPECT_EQ(output.timeStamps, decodedTimeStamps);
+
+    for (mfxFrameSurface1 *surface : held)
+        surface->FrameInterface->Release(surface);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
@@ -0,0 +1,172 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "src/cpu_copy.h"
+
+#define DST_SENTINEL 0xA5
+
+// a plane with a pattern in src and a sentinel in dst, so bytes written
+//   past the end of a row show up
+struct TestPlane {
+    std::vector<uint8_t> src;
+    std::vector<uint8_t> dst;
+    CpuPlaneCopy copy;
+};
+
+static void MakePlane(TestPlane *plane,
+                      size_t rowBytes,
+                      size_t rows,
+                      size_t srcPitch,
+                      size_t dstPitch,
+                      int seed) {
+    plane->src.resize(srcPitch * rows);
+    plane->dst.assign(dstPitch * rows, DST_SENTINEL);
+    for (size_t i = 0; i < plane->src.size(); i++)
+        plane->src[i] = static_cast<uint8_t>(i * 7 + seed);
+
+    plane->copy = { plane->dst.data(), dstPitch, plane->src.data(), srcPitch, rowBytes, rows };
+}
+
+// the reference, one memcpy per row
+static void ExpectCopied(const TestPlane &plane) {
+    const CpuPlaneCopy &copy = plane.copy;
+    std::vector<uint8_t> expected(plane.dst.size(), DST_SENTINEL);
+    for (size_t y = 0; y < copy.rows; y++)
+        memcpy(&expected[y * copy.dstPitch], &plane.src[y * copy.srcPitch], copy.rowBytes);
+
+    ASSERT_EQ(plane.dst.size(), expected.size());
+    EXPECT_EQ(0, memcmp(plane.dst.data(), expected.data(), expected.size()));
+}
+
+static void CopyAndCheck(size_t width,
+                         size_t height,
+                         size_t srcPad,
+                         size_t dstPad,
+                         CpuCopyMode mode,
+                         int numStripes) {
+    TestPlane planes[3];
+    CpuPlaneCopy copies[3];
+    for (int i = 0; i < 3; i++) {
+        size_t rowBytes = i ? (width + 1) / 2 : width;
+        size_t rows     = i ? (height + 1) / 2 : height;
+        MakePlane(&planes[i], rowBytes, rows, rowBytes + srcPad, rowBytes + dstPad, i);
+        copies[i] = planes[i].copy;
+    }
+
+    CpuCopyPlanes(copies, 3, mode, numStripes);
+
+    for (int i = 0; i < 3; i++)
+        ExpectCopied(planes[i]);
+}
+
+TEST(CpuCopyPlanes, CachedCopyMatchesMemcpy) {
+    CopyAndCheck(64, 16, 0, 0, CPU_COPY_CACHED, 1);
+    CopyAndCheck(33, 17, 31, 15, CPU_COPY_CACHED, 1);
+    CopyAndCheck(1, 1, 0, 3, CPU_COPY_CACHED, 1);
+}
+
+TEST(CpuCopyPlanes, StreamingCopyMatchesMemcpy) {
+    // widths around the vector sizes, unaligned heads and tails
+    const size_t widths[] = { 1, 15, 63, 64, 65, 127, 129, 257, 1921 };
+    for (size_t width : widths) {
+        CopyAndCheck(width, 9, 0, 0, CPU_COPY_STREAMING, 1);
+        CopyAndCheck(width, 9, 3, 64, CPU_COPY_STREAMING, 1);
+    }
+}
+
+TEST(CpuCopyPlanes, StripedCopyMatchesMemcpy) {
+    // more stripes than rows of chroma, and stripes of uneven height
+    const int stripes[] = { 2, 3, 4 };
+    for (int numStripes : stripes) {
+        CopyAndCheck(333, 3, 0, 0, CPU_COPY_CACHED, numStripes);
+        CopyAndCheck(333, 101, 13, 7, CPU_COPY_CACHED, numStripes);
+        CopyAndCheck(1025, 101, 0, 0, CPU_COPY_STREAMING, numStripes);
+        CopyAndCheck(1025, 101, 5, 27, CPU_COPY_STREAMING, numStripes);
+    }
+}
+
+TEST(CpuCopyPlanes, ConcurrentStripedCopiesMatchMemcpy) {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t]() {
+            for (int i = 0; i < 20; i++)
+                CopyAndCheck(640 + t, 97, 16, 32, (i & 1) ? CPU_COPY_STREAMING : CPU_COPY_CACHED, 4);
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+}
+
+TEST(CpuCopyPlanes, FrameSizedCopyMatchesMemcpy) {
+    // 4K 4:2:0, split into stripes and streamed when larger than the cache
+    TestPlane planes[3];
+    CpuPlaneCopy copies[3];
+    for (int i = 0; i < 3; i++) {
+        size_t width  = i ? 1920 : 3840;
+        size_t height = i ? 1080 : 2160;
+        MakePlane(&planes[i], width, height, width + 64, width + 128, i);
+        copies[i] = planes[i].copy;
+    }
+
+    CpuCopyPlanes(copies, 3);
+
+    for (int i = 0; i < 3; i++)
+        ExpectCopied(planes[i]);
+}
+
+// CpuCopyFrame<FourCC> against a row by row copy of the same layout
+template <mfxU32 FourCC>
+static void CopyFrameAndCheck(int width, int height) {
+    typedef CpuPlaneLayout<FourCC> Layout;
+
+    TestPlane planes[3];
+    AVFrame frame = {};
+    frame.width   = width;
+    frame.height  = height;
+
+    size_t pitch = (size_t)(width + 64) * Layout::bytesPerPixel;
+    for (int i = 0; i < Layout::numPlanes; i++) {
+        int shiftX      = i ? Layout::chromaShiftX : 0;
+        int shiftY      = i ? Layout::chromaShiftY : 0;
+        size_t rowBytes = (size_t)((width + (1 << shiftX) - 1) >> shiftX) * Layout::bytesPerPixel;
+        size_t rows     = (size_t)(height + (1 << shiftY) - 1) >> shiftY;
+        MakePlane(&planes[i], rowBytes, rows, rowBytes + 32 + i, pitch >> shiftX, i);
+        frame.data[i]     = planes[i].src.data();
+        frame.linesize[i] = (int)planes[i].copy.srcPitch;
+    }
+
+    mfxFrameData data = {};
+    data.PitchHigh    = (mfxU16)(pitch >> 16);
+    data.PitchLow     = (mfxU16)(pitch & 0xFFFF);
+    if (Layout::numPlanes == 1) {
+        data.B = planes[0].dst.data();
+    }
+    else {
+        data.Y = planes[0].dst.data();
+        data.U = planes[1].dst.data();
+        data.V = planes[2].dst.data();
+    }
+
+    CpuCopyFrame<FourCC>(&data, &frame);
+
+    for (int i = 0; i < Layout::numPlanes; i++)
+        ExpectCopied(planes[i]);
+}
+
+TEST(CpuCopyFrame, EveryLayoutMatchesMemcpy) {
+    const int sizes[][2] = { { 64, 32 }, { 33, 17 }, { 1, 1 }, { 1281, 719 } };
+    for (auto &size : sizes) {
+        CopyFrameAndCheck<MFX_FOURCC_I420>(size[0], size[1]);
+        CopyFrameAndCheck<MFX_FOURCC_I010>(size[0], size[1]);
+        CopyFrameAndCheck<MFX_FOURCC_I422>(size[0], size[1]);
+        CopyFrameAndCheck<MFX_FOURCC_I210>(size[0], size[1]);
+        CopyFrameAndCheck<MFX_FOURCC_RGB4>(size[0], size[1]);
+    }
+}
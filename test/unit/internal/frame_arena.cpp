@@ -0,0 +1,68 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <set>
+#include <vector>
+#include "src/cpu_frame_arena.h"
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Without reserved huge pages the MAP_HUGETLB mapping fails, the arena is
+//   then mapped with ordinary pages aligned for transparent huge pages.
+TEST(FrameArena, FallsBackWhenHugePagesAreNotReserved) {
+#if defined(__linux__) && defined(MAP_HUGETLB)
+    void *probe = mmap(nullptr,
+                       HUGE_PAGE_SIZE,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                       -1,
+                       0);
+    if (probe != MAP_FAILED) {
+        munmap(probe, HUGE_PAGE_SIZE);
+        GTEST_SKIP();
+    }
+#endif
+
+    const size_t slotSize = 1536 * 1024;
+    const mfxU32 numSlots = 3;
+    CpuFrameArena *arena  = CpuFrameArena::Create(slotSize, numSlots);
+    ASSERT_NE(arena, nullptr);
+    EXPECT_EQ(arena->GetNumFreeSlots(), numSlots);
+
+    std::vector<AVBufferRef *> buffers;
+    std::set<uint8_t *> slots;
+    for (mfxU32 i = 0; i < numSlots; i++) {
+        AVBufferRef *buffer = arena->GetBuffer();
+        ASSERT_NE(buffer, nullptr);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(buffer->data) % 64, 0u);
+        EXPECT_GE(buffer->size, slotSize);
+
+        // the whole slot is backed
+        memset(buffer->data, static_cast<int>(i), slotSize);
+        buffers.push_back(buffer);
+        slots.insert(buffer->data);
+    }
+    EXPECT_EQ(slots.size(), numSlots);
+    EXPECT_EQ(arena->GetBuffer(), nullptr);
+
+#if defined(__linux__)
+    // slots are handed out from the start, which is huge page aligned
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(buffers[0]->data) % HUGE_PAGE_SIZE, 0u);
+#endif
+    for (mfxU32 i = 0; i < numSlots; i++)
+        EXPECT_EQ(buffers[i]->data[slotSize - 1], i);
+
+    for (AVBufferRef *buffer : buffers)
+        av_buffer_unref(&buffer);
+    EXPECT_EQ(arena->GetNumFreeSlots(), numSlots);
+    arena->Release();
+}
@@ -0,0 +1,107 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include "src/cpu_frame_cache.h"
+#include "src/cpu_threads.h"
+
+#define CACHE_SLOT_SIZE (256 * 1024)
+
+// keys of one test differ by width only, tests use their own fourcc so
+//   arenas left by one cannot be taken by another
+static CpuFrameCacheKey MakeKey(mfxU32 fourcc, mfxU32 width) {
+    CpuFrameCacheKey key = { fourcc, width, 64, width, CPU_SET_ANY, false };
+    return key;
+}
+
+TEST(FrameCache, TakeReturnsCachedArenaWithMatchingKey) {
+    CpuFrameCacheKey key = MakeKey(MFX_FOURCC_I420, 96);
+    CpuFrameArena *arena = CpuFrameArena::Create(CACHE_SLOT_SIZE, 2);
+    ASSERT_NE(arena, nullptr);
+    size_t cachedSize = CpuFrameCache::GetCachedSize();
+
+    CpuFrameCache::Put(key, arena);
+    EXPECT_EQ(CpuFrameCache::GetCachedSize(), cachedSize + arena->GetSize());
+
+    // another layout, or more slots than the arena has free, miss
+    EXPECT_EQ(CpuFrameCache::Take(MakeKey(MFX_FOURCC_I420, 128), 2), nullptr);
+    EXPECT_EQ(CpuFrameCache::Take(key, 3), nullptr);
+
+    EXPECT_EQ(CpuFrameCache::Take(key, 2), arena);
+    EXPECT_EQ(CpuFrameCache::GetCachedSize(), cachedSize);
+    EXPECT_EQ(CpuFrameCache::Take(key, 2), nullptr);
+
+    arena->Release();
+}
+
+TEST(FrameCache, ArenaStillInUseIsTakenOnceSlotsAreFree) {
+    CpuFrameCacheKey key = MakeKey(MFX_FOURCC_NV12, 96);
+    CpuFrameArena *arena = CpuFrameArena::Create(CACHE_SLOT_SIZE, 2);
+    ASSERT_NE(arena, nullptr);
+
+    AVBufferRef *buffer = arena->GetBuffer();
+    ASSERT_NE(buffer, nullptr);
+    CpuFrameCache::Put(key, arena);
+
+    EXPECT_EQ(CpuFrameCache::Take(key, 2), nullptr);
+    av_buffer_unref(&buffer);
+    EXPECT_EQ(CpuFrameCache::Take(key, 2), arena);
+
+    arena->Release();
+}
+
+// ctest runs this with VPL_CPU_FRAME_CACHE=1, room for two of the arenas
+TEST(FrameCache, LeastRecentlyCachedArenaIsEvicted) {
+    const char *env = getenv("VPL_CPU_FRAME_CACHE");
+    if (!env || atoi(env) != 1)
+        GTEST_SKIP();
+
+    CpuFrameCacheKey keys[3];
+    CpuFrameArena *arenas[3];
+    for (int i = 0; i < 3; i++) {
+        keys[i]   = MakeKey(MFX_FOURCC_YUY2, 96 + 32 * i);
+        arenas[i] = CpuFrameArena::Create(CACHE_SLOT_SIZE, 2);
+        ASSERT_NE(arenas[i], nullptr);
+    }
+
+    CpuFrameCache::Put(keys[0], arenas[0]);
+    CpuFrameCache::Put(keys[1], arenas[1]);
+    EXPECT_EQ(CpuFrameCache::GetCachedSize(), 2 * arenas[0]->GetSize());
+
+    // taking an arena and putting it back makes it the most recent
+    EXPECT_EQ(CpuFrameCache::Take(keys[0], 2), arenas[0]);
+    CpuFrameCache::Put(keys[0], arenas[0]);
+
+    CpuFrameCache::Put(keys[2], arenas[2]);
+    EXPECT_EQ(CpuFrameCache::GetCachedSize(), 2 * arenas[0]->GetSize());
+
+    EXPECT_EQ(CpuFrameCache::Take(keys[1], 2), nullptr);
+    CpuFrameArena *first = CpuFrameCache::Take(keys[0], 2);
+    CpuFrameArena *third = CpuFrameCache::Take(keys[2], 2);
+    EXPECT_EQ(first, arenas[0]);
+    EXPECT_EQ(third, arenas[2]);
+    EXPECT_EQ(CpuFrameCache::GetCachedSize(), 0u);
+
+    if (first)
+        first->Release();
+    if (third)
+        third->Release();
+}
+
+// arenas larger than the whole cache are not kept
+TEST(FrameCache, ArenaLargerThanLimitIsNotCached) {
+    const char *env = getenv("VPL_CPU_FRAME_CACHE");
+    if (!env || atoi(env) != 1)
+        GTEST_SKIP();
+
+    CpuFrameCacheKey key = MakeKey(MFX_FOURCC_P010, 96);
+    CpuFrameArena *arena = CpuFrameArena::Create(CACHE_SLOT_SIZE, 8);
+    ASSERT_NE(arena, nullptr);
+
+    CpuFrameCache::Put(key, arena);
+    EXPECT_EQ(CpuFrameCache::Take(key, 1), nullptr);
+}
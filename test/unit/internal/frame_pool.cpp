@@ -0,0 +1,103 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "src/cpu_frame_pool.h"
+
+#define STRESS_THREADS    4
+#define STRESS_SURFACES   8
+#define STRESS_ITERATIONS 20000
+
+static mfxFrameInfo GetStressInfo() {
+    mfxFrameInfo info = {};
+    info.FourCC       = MFX_FOURCC_I420;
+    info.ChromaFormat = MFX_CHROMAFORMAT_YUV420;
+    info.Width        = 96;
+    info.Height       = 64;
+    info.CropW        = 96;
+    info.CropH        = 64;
+    return info;
+}
+
+// Threads take and release surfaces of one pool as fast as they can, every
+//   surface is marked while handed out so a surface popped by two threads
+//   at once is caught. There are more surfaces than threads, so the free
+//   list never runs empty and the pool does not grow.
+TEST(FramePool, ConcurrentGetReleaseHandsOutEachSurfaceOnce) {
+    std::unique_ptr<CpuFramePool> pool(new CpuFramePool());
+    ASSERT_EQ(pool->Init(GetStressInfo(), STRESS_SURFACES), MFX_ERR_NONE);
+
+    // take every preallocated surface once to learn its slot
+    std::vector<mfxFrameSurface1 *> surfaces;
+    for (int i = 0; i < STRESS_SURFACES; i++) {
+        mfxFrameSurface1 *surface = nullptr;
+        ASSERT_EQ(pool->GetFreeSurface(&surface), MFX_ERR_NONE);
+        surfaces.push_back(surface);
+    }
+    std::map<mfxFrameSurface1 *, int> slots;
+    for (size_t i = 0; i < surfaces.size(); i++)
+        slots[surfaces[i]] = (int)i;
+    ASSERT_EQ(slots.size(), surfaces.size());
+    for (mfxFrameSurface1 *surface : surfaces)
+        surface->FrameInterface->Release(surface);
+
+    std::unique_ptr<std::atomic<int>[]> inUse(new std::atomic<int>[STRESS_SURFACES]);
+    for (int i = 0; i < STRESS_SURFACES; i++)
+        inUse[i] = 0;
+    std::atomic<int> numTwice(0);
+    std::atomic<int> numUnknown(0);
+    std::atomic<int> numFailed(0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < STRESS_THREADS; t++) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < STRESS_ITERATIONS; i++) {
+                mfxFrameSurface1 *surface = nullptr;
+                if (pool->GetFreeSurface(&surface) != MFX_ERR_NONE) {
+                    numFailed++;
+                    continue;
+                }
+
+                auto it = slots.find(surface);
+                if (it == slots.end()) {
+                    numUnknown++;
+                }
+                else {
+                    if (inUse[it->second].exchange(1))
+                        numTwice++;
+                    if ((i & 7) == 0)
+                        std::this_thread::yield();
+                    inUse[it->second] = 0;
+                }
+
+                surface->FrameInterface->Release(surface);
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    EXPECT_EQ(numTwice, 0);
+    EXPECT_EQ(numUnknown, 0);
+    EXPECT_EQ(numFailed, 0);
+    EXPECT_EQ(pool->GetCurrentPoolSize(), (mfxU32)STRESS_SURFACES);
+
+    // every surface made it back onto the free list
+    surfaces.clear();
+    for (int i = 0; i < STRESS_SURFACES; i++) {
+        mfxFrameSurface1 *surface = nullptr;
+        ASSERT_EQ(pool->GetFreeSurface(&surface), MFX_ERR_NONE);
+        EXPECT_EQ(slots.count(surface), 1u);
+        surfaces.push_back(surface);
+    }
+    for (mfxFrameSurface1 *surface : surfaces)
+        surface->FrameInterface->Release(surface);
+}
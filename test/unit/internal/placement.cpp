@@ -0,0 +1,80 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string.h>
+#include "src/cpu_threads.h"
+
+#if defined(__linux__)
+    #include <pthread.h>
+#endif
+
+// ctest runs these with VPL_CPU_AFFINITY="0;0", two sets holding CPU 0
+static bool HasTestCpuSets() {
+    const char *env = getenv("VPL_CPU_AFFINITY");
+    return env && !strcmp(env, "0;0");
+}
+
+TEST(Placement, SessionsTakeCpuSetsInTurn) {
+    if (!HasTestCpuSets())
+        GTEST_SKIP();
+
+    int first  = CpuPlacement::AssignCpuSet();
+    int second = CpuPlacement::AssignCpuSet();
+    int third  = CpuPlacement::AssignCpuSet();
+
+    EXPECT_GE(first, 0);
+    EXPECT_LT(first, 2);
+    EXPECT_EQ(second, (first + 1) % 2);
+    EXPECT_EQ(third, first);
+}
+
+TEST(Placement, NoCpuSetsConfiguredAssignsAny) {
+    if (getenv("VPL_CPU_AFFINITY"))
+        GTEST_SKIP();
+
+    EXPECT_EQ(CpuPlacement::AssignCpuSet(), CPU_SET_ANY);
+}
+
+#if defined(__linux__)
+TEST(Placement, ScopePinsCallingThreadAndRestoresMask) {
+    if (!HasTestCpuSets())
+        GTEST_SKIP();
+
+    // start from every CPU the process may use
+    cpu_set_t all;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(cpu_set_t), &all), 0);
+    ASSERT_EQ(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &all), 0);
+    if (!CPU_ISSET(0, &all))
+        GTEST_SKIP();
+
+    cpu_set_t mask;
+    {
+        CpuPlacementScope placement(1);
+        ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask), 0);
+        EXPECT_EQ(CPU_COUNT(&mask), 1);
+        EXPECT_TRUE(CPU_ISSET(0, &mask));
+    }
+
+    ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask), 0);
+    EXPECT_TRUE(CPU_EQUAL(&mask, &all));
+}
+
+TEST(Placement, ScopeWithoutCpuSetLeavesMask) {
+    cpu_set_t before, mask;
+    ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &before), 0);
+
+    {
+        CpuPlacementScope placement(CPU_SET_ANY);
+        ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask), 0);
+        EXPECT_TRUE(CPU_EQUAL(&mask, &before));
+    }
+
+    ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask), 0);
+    EXPECT_TRUE(CPU_EQUAL(&mask, &before));
+}
+#endif
@@ -0,0 +1,57 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include "src/cpu_threads.h"
+
+TEST(ThreadBudget, ShareLeavesRoomForNextContext) {
+    int maxThreads = CpuThreadBudget::GetMaxThreads();
+
+    int first  = CpuThreadBudget::Acquire();
+    int second = CpuThreadBudget::Acquire();
+
+    EXPECT_GE(first, 1);
+    EXPECT_LE(first, std::max(1, maxThreads / 2));
+    EXPECT_GE(second, 1);
+    if (maxThreads >= 2) {
+        EXPECT_EQ(first, second);
+        EXPECT_LE(first + second, maxThreads);
+    }
+
+    CpuThreadBudget::Release(second);
+    CpuThreadBudget::Release(first);
+}
+
+TEST(ThreadBudget, RequestIsClampedToWhatIsLeft) {
+    int maxThreads = CpuThreadBudget::GetMaxThreads();
+
+    int all = CpuThreadBudget::Acquire(maxThreads + 8);
+    EXPECT_EQ(all, maxThreads);
+
+    // budget used up, later contexts still get a thread
+    int extra = CpuThreadBudget::Acquire(4);
+    EXPECT_EQ(extra, 1);
+    int share = CpuThreadBudget::Acquire();
+    EXPECT_EQ(share, 1);
+
+    CpuThreadBudget::Release(share);
+    CpuThreadBudget::Release(extra);
+    CpuThreadBudget::Release(all);
+}
+
+TEST(ThreadBudget, ReleasedThreadsGoToNextContext) {
+    int maxThreads = CpuThreadBudget::GetMaxThreads();
+
+    int all = CpuThreadBudget::Acquire(maxThreads);
+    EXPECT_EQ(CpuThreadBudget::Acquire(maxThreads), 1);
+    CpuThreadBudget::Release(1);
+    CpuThreadBudget::Release(all);
+
+    int again = CpuThreadBudget::Acquire(maxThreads);
+    EXPECT_EQ(again, maxThreads);
+    CpuThreadBudget::Release(again);
+}